@@ -316,6 +316,32 @@ uint32_t Encoder::encodeTwoOperandInst(const TwoOperandInst &inst) {
     encoded = 0xD65F0000 | (rn << 5);
     break;
   }
+  case Opcode::BR: {
+    // BR: 1 1 0 1 0 1 1 0 0 0 0 1 1 1 1 1 0 0 0 0 0 0 Rn 0 0 0 0 0
+    uint32_t rn = encodeRegister(inst.src);
+    encoded = 0xD61F0000 | (rn << 5);
+    break;
+  }
+  case Opcode::BLR: {
+    // BLR: 1 1 0 1 0 1 1 0 0 0 1 1 1 1 1 1 0 0 0 0 0 0 Rn 0 0 0 0 0
+    uint32_t rn = encodeRegister(inst.src);
+    encoded = 0xD63F0000 | (rn << 5);
+    break;
+  }
+  case Opcode::ADR: {
+    // ADR: 0 immlo 1 0 0 0 0 immhi Rd, PC-relative byte offset
+    if (!isImmediate(inst.src)) {
+      throw EncodingError("ADR only supports immediate operands");
+    }
+    int64_t offset =
+        static_cast<int64_t>(std::get<Immediate>(inst.src).value);
+    if (offset < -0x100000 || offset > 0xFFFFF) {
+      throw EncodingError("ADR offset out of range");
+    }
+    uint32_t imm = static_cast<uint32_t>(offset) & 0x1FFFFF;
+    encoded = 0x10000000 | ((imm & 0x3) << 29) | ((imm >> 2) << 5) | rd;
+    break;
+  }
   case Opcode::MOVN: {
     if (!isImmediate(inst.src)) {
       throw EncodingError("MOVN only supports immediate operands");
@@ -141,6 +141,12 @@ std::string opcodeToString(Opcode opcode) {
     return "movk";
   case Opcode::RET:
     return "ret";
+  case Opcode::BR:
+    return "br";
+  case Opcode::BLR:
+    return "blr";
+  case Opcode::ADR:
+    return "adr";
   }
 }
 
@@ -88,7 +88,10 @@ enum class Opcode {
   MOVN,
   MOVZ,
   MOVK,
-  RET
+  RET,
+  BR,
+  BLR,
+  ADR
 };
 
 enum class DataSize : uint8_t {
@@ -0,0 +1,269 @@
+#include "AotCache.h"
+#include "Error.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dinorisc {
+
+namespace {
+
+constexpr char MAGIC[8] = {'D', 'I', 'N', 'O', 'A', 'O', 'T', '\0'};
+
+// Bump whenever the layout or the generated code conventions change
+constexpr uint32_t FORMAT_VERSION = 2;
+
+// The code image starts at a multiple of every page size we run on, so it
+// can be mapped straight from the file
+constexpr uint64_t CODE_ALIGNMENT = 64 * 1024;
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t budgetChecks;
+  uint64_t elfHash;
+  uint32_t optimizationLevel;
+  uint32_t reserved;
+  uint64_t blockCount;
+  uint64_t exitCount;
+  uint64_t codeOffset;
+  uint64_t codeSize;
+};
+
+struct BlockRecord {
+  uint64_t guestAddress;
+  uint64_t guestInstructionCount;
+  uint64_t codeOffset;
+  uint64_t codeSize;
+  uint64_t exitCount;
+  uint64_t tier;
+};
+
+// Fixup for one exit stub: the branch to patch when chaining it and the
+// guest address it leaves to. Block records own consecutive runs of these.
+struct ExitRecord {
+  uint64_t branchOffset;
+  uint64_t targetAddress;
+};
+
+void readAt(int fd, void *buffer, size_t size, uint64_t offset,
+            const std::string &path) {
+  auto *out = static_cast<uint8_t *>(buffer);
+  while (size > 0) {
+    ssize_t count = pread(fd, out, size, static_cast<off_t>(offset));
+    if (count <= 0) {
+      throw RuntimeError("AOT cache file is truncated: " + path);
+    }
+    out += count;
+    size -= static_cast<size_t>(count);
+    offset += static_cast<uint64_t>(count);
+  }
+}
+
+} // namespace
+
+AotCache::AotCache() : code(nullptr), codeSize(0) {}
+
+AotCache::~AotCache() { unmap(); }
+
+uint64_t AotCache::hashFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw RuntimeError("Failed to open file for hashing: " + path);
+  }
+
+  uint64_t hash = FNV_OFFSET_BASIS;
+  char buffer[64 * 1024];
+  while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+    for (std::streamsize i = 0; i < file.gcount(); ++i) {
+      hash ^= static_cast<uint8_t>(buffer[i]);
+      hash *= FNV_PRIME;
+    }
+  }
+  return hash;
+}
+
+void AotCache::write(const std::string &path, uint64_t elfHash,
+                     const AotConfig &config, const void *code,
+                     size_t codeSize,
+                     const std::vector<TranslatedBlock> &blocks) {
+  auto *image = static_cast<const uint8_t *>(code);
+  auto offsetOf = [&](const void *address, size_t size) {
+    auto *ptr = static_cast<const uint8_t *>(address);
+    if (ptr < image || ptr + size > image + codeSize) {
+      throw RuntimeError("AOT cache: translation outside the code image");
+    }
+    return static_cast<uint64_t>(ptr - image);
+  };
+
+  std::vector<BlockRecord> blockRecords;
+  std::vector<ExitRecord> exitRecords;
+  for (const auto &block : blocks) {
+    blockRecords.push_back({block.guestAddress, block.guestInstructionCount,
+                            offsetOf(block.hostCode, block.hostCodeSize),
+                            block.hostCodeSize, block.exits.size(),
+                            block.tier});
+    for (const auto &exit : block.exits) {
+      exitRecords.push_back({offsetOf(exit.branchAddress, sizeof(uint32_t)),
+                             exit.targetAddress});
+    }
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = FORMAT_VERSION;
+  header.elfHash = elfHash;
+  header.budgetChecks = config.budgetChecks;
+  header.optimizationLevel = config.optimizationLevel;
+  header.blockCount = blockRecords.size();
+  header.exitCount = exitRecords.size();
+  uint64_t recordsEnd = sizeof(header) +
+                        blockRecords.size() * sizeof(BlockRecord) +
+                        exitRecords.size() * sizeof(ExitRecord);
+  header.codeOffset =
+      (recordsEnd + CODE_ALIGNMENT - 1) & ~(CODE_ALIGNMENT - 1);
+  header.codeSize = codeSize;
+
+  // Write to a temporary file first so a concurrent run never maps a
+  // partially written cache
+  std::string tempPath = path + ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(blockRecords.data()),
+               blockRecords.size() * sizeof(BlockRecord));
+    file.write(reinterpret_cast<const char *>(exitRecords.data()),
+               exitRecords.size() * sizeof(ExitRecord));
+    std::vector<char> padding(header.codeOffset - recordsEnd, 0);
+    file.write(padding.data(), padding.size());
+    file.write(reinterpret_cast<const char *>(image), codeSize);
+    if (!file) {
+      std::remove(tempPath.c_str());
+      throw RuntimeError("Failed to write AOT cache: " + path);
+    }
+  }
+
+  if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    throw RuntimeError("Failed to write AOT cache: " + path);
+  }
+}
+
+AotCache::Status AotCache::load(const std::string &path, uint64_t elfHash,
+                                const AotConfig &config) {
+  unmap();
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return Status::Missing;
+    }
+    throw RuntimeError("Failed to open AOT cache: " + path);
+  }
+
+  try {
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      throw RuntimeError("Failed to open AOT cache: " + path);
+    }
+    uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+
+    FileHeader header;
+    readAt(fd, &header, sizeof(header), 0, path);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+      throw RuntimeError("Not an AOT cache file: " + path);
+    }
+
+    // Caches from other versions or translated with other settings are
+    // rebuilt like those of other binaries
+    AotConfig fileConfig{header.budgetChecks != 0, header.optimizationLevel};
+    if (header.version != FORMAT_VERSION || header.elfHash != elfHash ||
+        !(fileConfig == config)) {
+      close(fd);
+      return Status::Stale;
+    }
+
+    if (header.blockCount > fileSize / sizeof(BlockRecord) ||
+        header.exitCount > fileSize / sizeof(ExitRecord)) {
+      throw RuntimeError("AOT cache file is corrupt: " + path);
+    }
+    uint64_t recordsEnd = sizeof(header) +
+                          header.blockCount * sizeof(BlockRecord) +
+                          header.exitCount * sizeof(ExitRecord);
+    if (header.codeOffset % CODE_ALIGNMENT != 0 ||
+        header.codeOffset < recordsEnd ||
+        header.codeOffset + header.codeSize > fileSize) {
+      throw RuntimeError("AOT cache file is corrupt: " + path);
+    }
+
+    std::vector<BlockRecord> blockRecords(header.blockCount);
+    std::vector<ExitRecord> exitRecords(header.exitCount);
+    readAt(fd, blockRecords.data(), blockRecords.size() * sizeof(BlockRecord),
+           sizeof(header), path);
+    readAt(fd, exitRecords.data(), exitRecords.size() * sizeof(ExitRecord),
+           sizeof(header) + blockRecords.size() * sizeof(BlockRecord), path);
+
+    if (header.codeSize > 0) {
+      void *mapping =
+          mmap(nullptr, header.codeSize, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+               fd, static_cast<off_t>(header.codeOffset));
+      if (mapping == MAP_FAILED) {
+        throw RuntimeError("Failed to map AOT cache: " + path);
+      }
+      code = mapping;
+      codeSize = header.codeSize;
+    }
+
+    auto *image = static_cast<const uint8_t *>(code);
+    size_t nextExit = 0;
+    for (const auto &record : blockRecords) {
+      if (record.codeOffset + record.codeSize > codeSize ||
+          nextExit + record.exitCount > exitRecords.size()) {
+        throw RuntimeError("AOT cache file is corrupt: " + path);
+      }
+
+      TranslatedBlock block;
+      block.guestAddress = record.guestAddress;
+      block.guestInstructionCount = record.guestInstructionCount;
+      block.hostCode = image + record.codeOffset;
+      block.hostCodeSize = record.codeSize;
+      block.tier = static_cast<unsigned>(record.tier);
+      for (size_t i = 0; i < record.exitCount; ++i) {
+        const ExitRecord &exit = exitRecords[nextExit++];
+        if (exit.branchOffset + sizeof(uint32_t) > codeSize) {
+          throw RuntimeError("AOT cache file is corrupt: " + path);
+        }
+        block.exits.push_back(
+            {image + exit.branchOffset, exit.targetAddress, false});
+      }
+      blocks.push_back(std::move(block));
+    }
+  } catch (...) {
+    close(fd);
+    unmap();
+    throw;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  return Status::Loaded;
+}
+
+void AotCache::unmap() {
+  if (code) {
+    munmap(code, codeSize);
+  }
+  code = nullptr;
+  codeSize = 0;
+  blocks.clear();
+}
+
+} // namespace dinorisc
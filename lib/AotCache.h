@@ -0,0 +1,69 @@
+#pragma once
+
+#include "CodeCache.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dinorisc {
+
+// Translations of a whole binary saved to disk ahead of time. The file
+// holds one image of host code plus a record per block giving its guest
+// address, its offset in the image and the exit stubs that can be chained
+// to other blocks. Translated code only branches PC-relatively, so the
+// image runs unmodified wherever it is mapped.
+//
+// Code generation settings an image was translated with
+struct AotConfig {
+  bool budgetChecks = false;
+  unsigned optimizationLevel = 0;
+
+  bool operator==(const AotConfig &other) const {
+    return budgetChecks == other.budgetChecks &&
+           optimizationLevel == other.optimizationLevel;
+  }
+};
+
+// Files are keyed by a hash of the ELF they were translated from and the
+// AotConfig of its translations, and are reported as stale once either
+// changes.
+class AotCache {
+public:
+  enum class Status { Loaded, Missing, Stale };
+
+  AotCache();
+  ~AotCache();
+
+  AotCache(const AotCache &) = delete;
+  AotCache &operator=(const AotCache &) = delete;
+
+  // 64-bit FNV-1a hash of a file's contents
+  static uint64_t hashFile(const std::string &path);
+
+  // Write the translations in blocks to path. Their host code and exit
+  // stubs must all lie within [code, code + codeSize).
+  static void write(const std::string &path, uint64_t elfHash,
+                    const AotConfig &config, const void *code,
+                    size_t codeSize,
+                    const std::vector<TranslatedBlock> &blocks);
+
+  // Map the code image of a cache file for the binary with hash elfHash,
+  // translated with config. Throws RuntimeError if the file exists but is
+  // damaged.
+  Status load(const std::string &path, uint64_t elfHash,
+              const AotConfig &config);
+
+  // The loaded translations, pointing into the mapped image
+  const std::vector<TranslatedBlock> &getBlocks() const { return blocks; }
+  size_t getCodeSize() const { return codeSize; }
+
+private:
+  void *code;
+  size_t codeSize;
+  std::vector<TranslatedBlock> blocks;
+
+  void unmap();
+};
+
+} // namespace dinorisc
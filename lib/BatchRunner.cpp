@@ -0,0 +1,149 @@
+#include "BatchRunner.h"
+#include "Error.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace dinorisc {
+
+BatchReader::BatchReader(std::istream &input, BatchFormat format,
+                         size_t arity)
+    : input(input), format(format), arity(arity), records(0), lineNumber(0) {
+  if (arity > Session::MAX_ARGUMENTS) {
+    throw RuntimeError("Batch arity " + std::to_string(arity) +
+                       " is more than " +
+                       std::to_string(Session::MAX_ARGUMENTS) + " arguments");
+  }
+  if (format == BatchFormat::Binary && arity == 0) {
+    throw RuntimeError("Binary batches need the number of arguments per call");
+  }
+}
+
+bool BatchReader::next(std::vector<uint64_t> &args) {
+  args.clear();
+  bool found = format == BatchFormat::CSV ? nextLine(args) : nextRecord(args);
+  if (found) {
+    ++records;
+  }
+  return found;
+}
+
+bool BatchReader::nextLine(std::vector<uint64_t> &args) {
+  while (std::getline(input, line)) {
+    ++lineNumber;
+
+    // Blank lines and # comments
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') {
+      continue;
+    }
+
+    // Every comma starts another field, so a trailing one leaves an empty
+    // field that fails to parse like the one in "1,,2"
+    while (true) {
+      size_t end = line.find(',', start);
+      bool last = end == std::string::npos;
+      if (last) {
+        end = line.size();
+      }
+      std::string field = line.substr(start, end - start);
+      try {
+        size_t parsed = 0;
+        // Base 0 takes 0x hex; negative values wrap like in C
+        args.push_back(std::stoull(field, &parsed, 0));
+        if (field.find_first_not_of(" \t\r", parsed) != std::string::npos) {
+          throw std::invalid_argument(field);
+        }
+      } catch (const std::exception &) {
+        throw RuntimeError("Batch line " + std::to_string(lineNumber) +
+                           ": invalid argument '" + field + "'");
+      }
+      if (last) {
+        break;
+      }
+      start = end + 1;
+    }
+
+    size_t expected = arity != 0 ? arity : Session::MAX_ARGUMENTS;
+    if (args.size() > expected || (arity != 0 && args.size() != arity)) {
+      throw RuntimeError("Batch line " + std::to_string(lineNumber) +
+                         ": expected " + (arity != 0 ? "" : "at most ") +
+                         std::to_string(expected) + " arguments, got " +
+                         std::to_string(args.size()));
+    }
+    return true;
+  }
+  return false;
+}
+
+bool BatchReader::nextRecord(std::vector<uint64_t> &args) {
+  args.resize(arity);
+  input.read(reinterpret_cast<char *>(args.data()),
+             arity * sizeof(uint64_t));
+  std::streamsize bytes = input.gcount();
+  if (bytes == 0) {
+    return false;
+  }
+  if (bytes != static_cast<std::streamsize>(arity * sizeof(uint64_t))) {
+    throw RuntimeError("Batch record " + std::to_string(records) +
+                       " is truncated (" + std::to_string(bytes) + " bytes)");
+  }
+  return true;
+}
+
+BatchWriter::BatchWriter(std::ostream &output, BatchFormat format)
+    : output(output), format(format) {}
+
+void BatchWriter::write(const CallResult &result) {
+  if (format == BatchFormat::Binary) {
+    uint64_t words[2] = {result.a0, result.a1};
+    output.write(reinterpret_cast<const char *>(words), sizeof(words));
+    return;
+  }
+  output << static_cast<int64_t>(result.a0) << ','
+         << static_cast<int64_t>(result.a1) << '\n';
+}
+
+BatchRunner::BatchRunner(Session &session, uint64_t address)
+    : session(session), address(address) {}
+
+BatchStatistics BatchRunner::run(BatchReader &reader, BatchWriter &writer) {
+  using Clock = std::chrono::steady_clock;
+
+  BatchStatistics statistics;
+  std::vector<uint64_t> latencies;
+  std::vector<uint64_t> args;
+  auto start = Clock::now();
+  while (reader.next(args)) {
+    auto callStart = Clock::now();
+    CallResult result = session.call(address, args);
+    auto callEnd = Clock::now();
+
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            callEnd - callStart)
+                            .count());
+    writer.write(result);
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  statistics.calls = latencies.size();
+  statistics.seconds = elapsed.count();
+  statistics.p50Nanoseconds = percentile(latencies, 50);
+  statistics.p99Nanoseconds = percentile(latencies, 99);
+  return statistics;
+}
+
+uint64_t BatchRunner::percentile(std::vector<uint64_t> &samples,
+                                 double percentile) {
+  if (samples.empty()) {
+    return 0;
+  }
+  // Nearest rank
+  size_t rank = static_cast<size_t>(
+      std::ceil(percentile / 100.0 * static_cast<double>(samples.size())));
+  size_t index = std::min(std::max<size_t>(rank, 1), samples.size()) - 1;
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+} // namespace dinorisc
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Session.h"
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dinorisc {
+
+// How argument tuples and results are laid out in a batch. CSV has one call
+// per line: comma separated integers (decimal, 0x hex or negative) in,
+// "a0,a1" as signed decimals out. Binary is little-endian 64-bit words:
+// a fixed number of arguments per call in, a0 then a1 out.
+enum class BatchFormat { CSV, Binary };
+
+// Reads argument tuples one call at a time
+class BatchReader {
+public:
+  // Binary input needs the number of arguments per call. For CSV an arity
+  // of 0 lets every line have its own.
+  BatchReader(std::istream &input, BatchFormat format, size_t arity);
+
+  // Replace args with the next tuple. Returns false at the end of the input.
+  bool next(std::vector<uint64_t> &args);
+
+  uint64_t getRecords() const { return records; }
+
+private:
+  std::istream &input;
+  BatchFormat format;
+  size_t arity;
+  uint64_t records;
+  uint64_t lineNumber;
+  std::string line;
+
+  bool nextLine(std::vector<uint64_t> &args);
+  bool nextRecord(std::vector<uint64_t> &args);
+};
+
+// Writes results as they come in, without flushing after each one
+class BatchWriter {
+public:
+  BatchWriter(std::ostream &output, BatchFormat format);
+
+  void write(const CallResult &result);
+
+private:
+  std::ostream &output;
+  BatchFormat format;
+};
+
+struct BatchStatistics {
+  uint64_t calls = 0;
+  // Wall time of the whole batch, including reading and writing
+  double seconds = 0;
+  // Latency of the calls alone
+  uint64_t p50Nanoseconds = 0;
+  uint64_t p99Nanoseconds = 0;
+
+  double getCallsPerSecond() const { return seconds > 0 ? calls / seconds : 0; }
+};
+
+// Calls one function for every tuple of a batch in a single warm session
+class BatchRunner {
+public:
+  BatchRunner(Session &session, uint64_t address);
+
+  BatchStatistics run(BatchReader &reader, BatchWriter &writer);
+
+  // Value at percentile (0-100) of samples, which get reordered
+  static uint64_t percentile(std::vector<uint64_t> &samples,
+                             double percentile);
+
+private:
+  Session &session;
+  uint64_t address;
+};
+
+} // namespace dinorisc
@@ -5,50 +5,52 @@
 #include "Lowering/InstructionSelector.h"
 #include "Lowering/LivenessAnalysis.h"
 #include "Lowering/RegisterAllocator.h"
+#include "Optimization/PassManager.h"
 #include "RISCV/Decoder.h"
 #include "RISCV/Instruction.h"
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
-#include <sys/mman.h>
-#include <unistd.h>
+#include <thread>
 
 namespace dinorisc {
 
-static constexpr size_t SHADOW_MEMORY_SIZE = 8 * 1024 * 1024; // 8MB
-static constexpr size_t STACK_RESERVE = 1024;                 // 1KB
-static constexpr int MAX_EXECUTION_BLOCKS = 10000;
-
-BinaryTranslator::BinaryTranslator() : textBaseAddress(0) {
+// Blocks the interpreter runs per dispatch when nothing gets translated
+static constexpr uint64_t INTERPRETER_SLICE_BLOCKS = 1024;
+
+// Tier-up counter slots per context, at least this many and otherwise twice
+// the statically found blocks to leave room for ones found at runtime
+static constexpr size_t MIN_COUNTER_CAPACITY = 1024;
+
+BinaryTranslator::BinaryTranslator()
+    : logStream(&std::cout), tierUpThreshold(DEFAULT_TIER_UP_THRESHOLD),
+      interpretThreshold(0), codeCacheSizeLimit(0), codeCacheBlockLimit(0),
+      optimizationLevel(optimization::PassManager::DEFAULT_LEVEL),
+      instructionLimit(0), timeLimit(0), publishedCodeSize(0),
+      runningContexts(0), codeEpoch(1), counterCapacity(0),
+      countersAssigned(0), textBaseAddress(0), dispatchHits(0),
+      dispatchMisses(0), indirectTargetFills(0), budgetExits(0),
+      tracesFormed(0), traceFallbacks(0), baselineTranslations(0), tierUps(0),
+      translationFailures(0), aotCacheBuilds(0), speculativeInstalls(0) {
   initializeTranslator();
+  setInterpretThreshold(DEFAULT_INTERPRET_THRESHOLD);
+  setCodeCacheLimits(DEFAULT_CODE_CACHE_SIZE, 0);
+  setSpeculationThreads(TranslationPool::defaultThreadCount());
 }
 
-BinaryTranslator::~BinaryTranslator() = default;
+BinaryTranslator::~BinaryTranslator() {
+  // Stop the workers before the state they translate from goes away
+  translationPool.reset();
+}
 
 void BinaryTranslator::initializeTranslator() {
   elfReader = std::make_unique<ELFReader>();
   decoder = std::make_unique<riscv::Decoder>();
-  encoder = std::make_unique<arm64::Encoder>();
   executionEngine = std::make_unique<ExecutionEngine>();
-
-  void *shadowMem = mmap(nullptr, SHADOW_MEMORY_SIZE, PROT_READ | PROT_WRITE,
-                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (shadowMem == MAP_FAILED) {
-    throw RuntimeError("Failed to allocate shadow memory");
-  }
-
-  guestState.shadowMemory = shadowMem;
-  guestState.shadowMemorySize = SHADOW_MEMORY_SIZE;
-  guestState.guestMemoryBase = 0x0;
-
-  // Stack grows down from high address within shadow memory
-  uint64_t stackTop = SHADOW_MEMORY_SIZE - STACK_RESERVE;
-  guestState.x[2] = stackTop;
-
-  std::cout << "Shadow memory allocated: " << SHADOW_MEMORY_SIZE
-            << " bytes at host " << shadowMem << ", guest base 0x" << std::hex
-            << guestState.guestMemoryBase << ", stack at 0x" << stackTop
-            << std::dec << std::endl;
+  codeCache =
+      std::make_unique<CodeCache>(&executionEngine->getCodeArena());
 }
 
 void BinaryTranslator::loadRISCVBinary(const std::string &inputPath) {
@@ -58,153 +60,857 @@ void BinaryTranslator::loadRISCVBinary(const std::string &inputPath) {
 
   textSectionData = textSection.data;
   textBaseAddress = textSection.virtualAddress;
+
+  // Translations of a previously loaded binary are no longer valid, and
+  // workers must be idle before the text they decode from is replaced.
+  // Contexts drop what they cached the next time they run.
+  if (translationPool) {
+    translationPool->reset();
+  }
+  codeCache->clear();
+  codeEpoch.fetch_add(1);
+  aotCache.reset();
+
+  interpreter =
+      std::make_unique<Interpreter>(*decoder, textSectionData, textBaseAddress);
+  interpretedExecutions.clear();
+  untranslatable.clear();
+
+  // Callers look functions up by name over and over
+  std::vector<FunctionSymbol> functionSymbols = elfReader->getFunctionSymbols();
+  functionAddresses.clear();
+  for (const auto &symbol : functionSymbols) {
+    functionAddresses.emplace(symbol.name, symbol.address);
+  }
+
+  // Blocks found statically give the tables keyed by guest PC their size
+  controlFlowGraph = std::make_unique<ControlFlowGraph>(
+      *decoder, textSectionData, textBaseAddress, elfReader->getEntryPoint(),
+      functionSymbols);
+
+  // Only the optimizing pipelines drop dead write-backs, which is all the
+  // liveness of the binary is for
+  std::unique_ptr<RegisterLiveness> liveness;
+  if (optimizationLevel > 0) {
+    liveness = std::make_unique<RegisterLiveness>(
+        *controlFlowGraph, *decoder, textSectionData, textBaseAddress);
+  }
+  passManager = std::make_unique<optimization::PassManager>(optimizationLevel,
+                                                            liveness.get());
+  registerLiveness = std::move(liveness);
+
+  size_t staticBlocks = controlFlowGraph->getBlocks().size();
+  codeCache->reserve(staticBlocks);
+  interpretedExecutions.reserve(staticBlocks);
+  counterCapacity = std::max(MIN_COUNTER_CAPACITY, 2 * staticBlocks);
+  countersAssigned = 0;
+
+  publishedCodeSize = textSectionData.size() / 4;
+  publishedCode =
+      std::make_unique<std::atomic<const void *>[]>(publishedCodeSize);
+  unpublishAll();
+
+  *logStream << "Control flow graph: " << staticBlocks << " blocks in "
+             << controlFlowGraph->getFunctions().size() << " functions"
+             << std::endl;
+}
+
+void BinaryTranslator::load(const std::string &inputPath) {
+  loadRISCVBinary(inputPath);
+
+  *logStream << "Text section: VA=0x" << std::hex << textBaseAddress
+             << " Size=" << std::dec << textSectionData.size() << " bytes"
+             << std::endl;
+
+  if (!aotCachePath.empty()) {
+    prepareAotCache(inputPath);
+  }
+}
+
+std::optional<uint64_t>
+BinaryTranslator::getFunctionAddress(const std::string &functionName) const {
+  auto it = functionAddresses.find(functionName);
+  if (it != functionAddresses.end()) {
+    return it->second;
+  }
+  // Symbols that aren't typed as functions
+  return elfReader->getFunctionAddress(functionName);
+}
+
+uint64_t BinaryTranslator::run(GuestContext &context, uint64_t pc) {
+  GuestState &state = context.getState();
+  state.x[1] = 0;
+
+  // Without a separate writable view, installing code makes the arena
+  // briefly non-executable, so only one context can run at a time
+  std::unique_lock<std::mutex> serialize;
+  if (ExecutionEngine::HOST_SUPPORTED &&
+      executionEngine->getCodeArena().getMapping() ==
+          CodeArena::Mapping::Single) {
+    serialize = std::unique_lock<std::mutex>(singleMappingMutex);
+  }
+
+  enterRun(context);
+  try {
+    startBudget(context);
+    while (pc != 0) {
+      state.pc = pc;
+      uint64_t nextPC = executeBlock(context, pc);
+      if (nextPC & GuestState::RUNTIME_EXIT_FLAG) {
+        nextPC = handleRuntimeExit(context,
+                                   nextPC & ~GuestState::RUNTIME_EXIT_FLAG);
+      }
+      pc = nextPC;
+    }
+  } catch (...) {
+    leaveRun(context);
+    throw;
+  }
+  leaveRun(context);
+
+  return state.x[10];
+}
+
+void BinaryTranslator::startBudget(GuestContext &context) {
+  // Without a time limit the whole budget is handed out at once, so the
+  // runtime only hears about it when it's used up
+  uint64_t limit =
+      instructionLimit ? instructionLimit : GuestState::UNLIMITED_BUDGET;
+  uint64_t slice = timeLimit ? std::min(limit, BUDGET_SLICE) : limit;
+  context.budgetRemaining = limit;
+  context.budgetGranted = static_cast<int64_t>(slice);
+  context.getState().instructionBudget = context.budgetGranted;
+  context.deadline = std::chrono::steady_clock::now() +
+                     std::chrono::milliseconds(timeLimit);
+}
+
+void BinaryTranslator::refillBudget(GuestContext &context, uint64_t pc) {
+  // The interpreter charges after the fact and may have overdrawn the slice
+  GuestState &state = context.getState();
+  uint64_t used = static_cast<uint64_t>(context.budgetGranted -
+                                        state.instructionBudget);
+  bool sliceWasEverything =
+      static_cast<uint64_t>(context.budgetGranted) == context.budgetRemaining;
+  if (sliceWasEverything || used > context.budgetRemaining) {
+    std::ostringstream message;
+    message << "Instruction limit of " << instructionLimit
+            << " exceeded at PC=0x" << std::hex << pc;
+    throw ExecutionLimitError(message.str());
+  }
+  if (timeLimit && std::chrono::steady_clock::now() >= context.deadline) {
+    std::ostringstream message;
+    message << "Time limit of " << timeLimit << " ms exceeded at PC=0x"
+            << std::hex << pc;
+    throw ExecutionLimitError(message.str());
+  }
+
+  context.budgetRemaining -= used;
+  context.budgetGranted = static_cast<int64_t>(
+      timeLimit ? std::min(context.budgetRemaining, BUDGET_SLICE)
+                : context.budgetRemaining);
+  state.instructionBudget = context.budgetGranted;
+}
+
+void BinaryTranslator::enterRun(GuestContext &context) {
+  // Wait out a flush in progress
+  uint64_t running = runningContexts.load(std::memory_order_acquire);
+  while (true) {
+    if (running & FLUSHING) {
+      std::this_thread::yield();
+      running = runningContexts.load(std::memory_order_acquire);
+    } else if (runningContexts.compare_exchange_weak(
+                   running, running + 1, std::memory_order_acquire)) {
+      break;
+    }
+  }
+
+  if (context.codeEpoch != codeEpoch.load(std::memory_order_acquire) ||
+      context.blockCounters.size() != counterCapacity) {
+    refreshContext(context);
+  }
+  context.getState().blockCounters = context.blockCounters.data();
+}
+
+void BinaryTranslator::leaveRun(GuestContext &context) {
+  runningContexts.fetch_sub(1, std::memory_order_release);
+
+  DispatchStatistics &statistics = context.statistics;
+  dispatchHits.fetch_add(statistics.hits, std::memory_order_relaxed);
+  dispatchMisses.fetch_add(statistics.misses, std::memory_order_relaxed);
+  indirectTargetFills.fetch_add(statistics.indirectTargetFills,
+                                std::memory_order_relaxed);
+  budgetExits.fetch_add(statistics.budgetExits, std::memory_order_relaxed);
+  statistics = DispatchStatistics();
+}
+
+void BinaryTranslator::refreshContext(GuestContext &context) {
+  // Host addresses from before a flush point at discarded code, and counter
+  // slots get handed out again
+  GuestState &state = context.getState();
+  state.flushIndirectTargets();
+  state.flushReturnPredictions();
+  context.blockCounters.assign(counterCapacity, tierUpThreshold);
+  state.blockCounters = context.blockCounters.data();
+  context.codeEpoch = codeEpoch.load(std::memory_order_acquire);
 }
 
-std::vector<arm64::Instruction>
-BinaryTranslator::translateToARM64(const ir::BasicBlock &irBlock) {
-  std::cout << "  Starting ARM64 translation for IR block..." << std::endl;
+const void *BinaryTranslator::lookupPublished(uint64_t pc) const {
+  uint64_t offset = pc - textBaseAddress;
+  if (pc < textBaseAddress || (offset & 3) != 0 ||
+      (offset >> 2) >= publishedCodeSize) {
+    return nullptr;
+  }
+  return publishedCode[offset >> 2].load(std::memory_order_acquire);
+}
+
+void BinaryTranslator::publish(uint64_t pc, const void *hostCode) {
+  uint64_t offset = pc - textBaseAddress;
+  if (pc < textBaseAddress || (offset & 3) != 0 ||
+      (offset >> 2) >= publishedCodeSize) {
+    return;
+  }
+  publishedCode[offset >> 2].store(hostCode, std::memory_order_release);
+}
+
+void BinaryTranslator::unpublishAll() {
+  for (size_t i = 0; i < publishedCodeSize; ++i) {
+    publishedCode[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+bool BinaryTranslator::beginExclusive(bool callerRunning) {
+  // Only possible while no other context is in run()
+  uint64_t expected = callerRunning ? 1 : 0;
+  return runningContexts.compare_exchange_strong(
+      expected, expected | FLUSHING, std::memory_order_acquire);
+}
+
+void BinaryTranslator::endExclusive() {
+  runningContexts.fetch_and(~FLUSHING, std::memory_order_release);
+}
 
-  std::cout << "    Step 1: Instruction selection (IR -> ARM64)" << std::endl;
+void BinaryTranslator::setInterpretThreshold(uint64_t threshold) {
+  interpretThreshold =
+      ExecutionEngine::HOST_SUPPORTED ? threshold : INTERPRET_ONLY;
+}
+
+void BinaryTranslator::setCodeCacheLimits(size_t maxCodeBytes,
+                                          size_t maxBlocks) {
+  // Anything smaller would be flushed again before every translation
+  if (maxCodeBytes < MIN_CODE_CACHE_SIZE) {
+    throw RuntimeError("Code cache size " + std::to_string(maxCodeBytes) +
+                       " is below the minimum of " +
+                       std::to_string(MIN_CODE_CACHE_SIZE) + " bytes");
+  }
+  codeCacheSizeLimit =
+      std::min(maxCodeBytes, executionEngine->getCodeCapacity());
+  codeCacheBlockLimit = maxBlocks;
+}
+
+void BinaryTranslator::setSpeculationThreads(size_t threads) {
+  // Nothing is translated on demand if generated code can't run
+  if (!ExecutionEngine::HOST_SUPPORTED || threads == 0) {
+    translationPool.reset();
+    return;
+  }
+
+  translationPool = std::make_unique<TranslationPool>(
+      threads, [this](const TranslationRequest &request) {
+        std::ostream discard(nullptr);
+        return compileBlock(request, discard);
+      });
+}
+
+void BinaryTranslator::setOptimizationLevel(unsigned level) {
+  // The pipeline is built by load(), and speculation workers may be running
+  // it once a binary is loaded
+  if (controlFlowGraph) {
+    throw RuntimeError("The optimization level can't change after load()");
+  }
+  if (level > optimization::PassManager::MAX_LEVEL) {
+    throw RuntimeError("Unknown optimization level -O" +
+                       std::to_string(level));
+  }
+  optimizationLevel = level;
+}
+
+std::vector<arm64::Instruction> BinaryTranslator::translateTrace(
+    const Trace &trace, std::vector<lowering::BlockExit> &exits,
+    std::optional<lowering::TierUpCounter> counter, std::ostream &log) const {
+  log << "  Lifting " << trace.instructions.size() << " instructions in "
+      << trace.blockCount << " blocks to IR" << std::endl;
+  Lifter lifter;
+  ir::BasicBlock irBlock = lifter.liftTrace(trace.instructions);
+
+  if (passManager->getPassCount() > 0) {
+    log << "  Optimizing " << irBlock.instructions.size()
+        << " IR instructions at -O" << passManager->getLevel() << std::endl;
+    passManager->run(irBlock);
+  }
+
+  std::optional<lowering::BudgetCheck> budget;
+  if (hasBudgetChecks()) {
+    budget = lowering::BudgetCheck{trace.instructions.size(),
+                                   trace.instructions.front().address};
+  }
+
+  log << "  Translating IR to ARM64" << std::endl;
+  return translateToARM64(irBlock, exits, counter, budget, log);
+}
+
+std::vector<arm64::Instruction> BinaryTranslator::translateToARM64(
+    const ir::BasicBlock &irBlock, std::vector<lowering::BlockExit> &exits,
+    std::optional<lowering::TierUpCounter> counter,
+    std::optional<lowering::BudgetCheck> budget, std::ostream &log) const {
+  log << "  Starting ARM64 translation for IR block..." << std::endl;
+
+  log << "    Step 1: Instruction selection (IR -> ARM64)" << std::endl;
   lowering::InstructionSelector instructionSelector;
-  auto arm64Instructions = instructionSelector.selectInstructions(irBlock);
-  std::cout << "      Generated " << arm64Instructions.size()
-            << " ARM64 instructions" << std::endl;
+  auto arm64Instructions =
+      instructionSelector.selectInstructions(irBlock, counter, budget);
+  log << "      Generated " << arm64Instructions.size()
+      << " ARM64 instructions" << std::endl;
+  exits = instructionSelector.getBlockExits();
 
-  std::cout << "    Step 2: Liveness analysis" << std::endl;
+  log << "    Step 2: Liveness analysis" << std::endl;
   lowering::LivenessAnalysis liveness(arm64Instructions);
   auto liveIntervals = liveness.computeLiveIntervals();
-  std::cout << "      Computed " << liveIntervals.size() << " live intervals"
-            << std::endl;
+  log << "      Computed " << liveIntervals.size() << " live intervals"
+      << std::endl;
 
-  std::cout << "    Step 3: Linear scan register allocation" << std::endl;
+  log << "    Step 3: Linear scan register allocation" << std::endl;
   lowering::RegisterAllocator registerAllocator;
   if (!registerAllocator.allocateRegisters(arm64Instructions, liveIntervals)) {
-    std::cout << "      WARNING: Register allocation failed - using "
-                 "placeholder registers"
-              << std::endl;
-  } else {
-    std::cout << "      Register allocation successful" << std::endl;
+    throw LoweringError("Register allocation failed");
   }
+  log << "      Register allocation successful" << std::endl;
 
-  std::cout << "    Final ARM64 instructions:" << std::endl;
+  log << "    Final ARM64 instructions:" << std::endl;
   for (size_t i = 0; i < arm64Instructions.size(); ++i) {
-    std::cout << "      [" << i << "] " << arm64Instructions[i].toString()
-              << std::endl;
+    log << "      [" << i << "] " << arm64Instructions[i].toString()
+        << std::endl;
   }
 
   return arm64Instructions;
 }
 
-uint64_t BinaryTranslator::executeBlock(uint64_t pc) {
-  if (!isValidPC(pc)) {
-    std::ostringstream oss;
-    oss << "PC out of bounds: 0x" << std::hex << pc;
-    throw RuntimeError(oss.str());
+Translation BinaryTranslator::compileBlock(const TranslationRequest &request,
+                                           std::ostream &log) const {
+  // Runs on speculation workers too, so it only reads state that stays put
+  // while the translation pool has work
+  TraceBuilder traceBuilder(*decoder, textSectionData, textBaseAddress);
+
+  // The baseline tier translates single blocks and counts how often they
+  // run; hot ones are retranslated as traces
+  std::optional<lowering::TierUpCounter> counter;
+  Trace trace;
+  if (request.counterIndex) {
+    trace = traceBuilder.buildTrace(request.pc, 1);
+    counter = lowering::TierUpCounter{*request.counterIndex, request.pc};
+  } else {
+    trace = traceBuilder.buildTrace(request.pc);
   }
 
-  std::vector<riscv::Instruction> blockInstructions;
-  size_t offset = pc - textBaseAddress;
-  uint64_t currentPC = pc;
-  Lifter lifter;
+  Translation translation;
+  translation.guestAddress = request.pc;
+  translation.tier = request.tier;
+  translation.counterIndex = request.counterIndex;
+
+  std::vector<arm64::Instruction> arm64Instructions;
+  try {
+    arm64Instructions = translateTrace(trace, translation.exits, counter, log);
+  } catch (const LoweringError &e) {
+    if (trace.blockCount == 1) {
+      throw;
+    }
+
+    // Long traces can run out of host registers; a single block won't
+    log << "  Trace translation failed (" << e.what()
+        << "), retrying as a single block" << std::endl;
+    translation.fellBack = true;
+    trace = traceBuilder.buildTrace(request.pc, 1);
+    arm64Instructions =
+        translateTrace(trace, translation.exits, std::nullopt, log);
+  }
+  translation.guestInstructionCount = trace.instructions.size();
+  translation.blockCount = trace.blockCount;
+
+  // Encode to machine code
+  log << "  Encoding to machine code" << std::endl;
+  arm64::Encoder encoder;
+  for (const auto &instruction : arm64Instructions) {
+    auto encoded = encoder.encodeInstruction(instruction);
+    translation.machineCode.insert(translation.machineCode.end(),
+                                   encoded.begin(), encoded.end());
+  }
 
-  while (offset < textSectionData.size()) {
-    riscv::Instruction inst =
-        decoder->decode(textSectionData.data(), offset, currentPC);
-    if (!inst.isValid()) {
-      std::ostringstream oss;
-      oss << "Invalid instruction at PC=0x" << std::hex << currentPC;
-      throw DecodingError(oss.str());
+  if (translation.machineCode.empty()) {
+    throw EncodingError("Failed to encode machine code");
+  }
+  return translation;
+}
+
+const TranslatedBlock &
+BinaryTranslator::installTranslation(const Translation &translation) {
+  if (translation.fellBack) {
+    ++traceFallbacks;
+  }
+  if (translation.blockCount > 1) {
+    ++tracesFormed;
+  }
+  if (translation.counterIndex) {
+    ++baselineTranslations;
+  }
+
+  TranslatedBlock block;
+  block.guestAddress = translation.guestAddress;
+  block.guestInstructionCount = translation.guestInstructionCount;
+  block.hostCode = executionEngine->installCode(translation.machineCode);
+  block.hostCodeSize = translation.machineCode.size();
+  block.tier = translation.tier;
+  block.patchableEntry = translation.counterIndex.has_value();
+
+  // Every ARM64 instruction encodes to exactly one 32-bit word
+  for (const auto &exit : translation.exits) {
+    const void *branchAddress =
+        static_cast<const uint8_t *>(block.hostCode) +
+        exit.instructionIndex * sizeof(uint32_t);
+    block.exits.push_back({branchAddress, exit.targetAddress, false});
+  }
+
+  *logStream << "  Installed " << translation.machineCode.size()
+             << " bytes of machine code at host " << block.hostCode
+             << std::endl;
+
+  // Other threads may jump to the code as soon as it is chained to or
+  // published, so it has to be executable first
+  executionEngine->commitCode();
+  const TranslatedBlock &installed = codeCache->insert(block);
+  publish(installed.guestAddress, installed.hostCode);
+  return installed;
+}
+
+const TranslatedBlock *BinaryTranslator::translateBlock(uint64_t pc,
+                                                        unsigned tier,
+                                                        GuestContext *caller) {
+  // Make room before anything (like the tier-up counter index) is assigned.
+  // Code other contexts are running can't be flushed, so until they are
+  // all out of run() nothing new gets translated.
+  if (isCodeCacheFull()) {
+    if (!beginExclusive(caller != nullptr)) {
+      return nullptr;
     }
+    *logStream << "Code cache full (" << executionEngine->getCodeSize()
+               << " bytes, " << codeCache->size() << " blocks), flushing"
+               << std::endl;
+    flushCodeCache(caller);
+    endExclusive();
+  }
 
-    blockInstructions.push_back(inst);
+  return &installTranslation(
+      compileBlock(makeRequest(pc, tier), *logStream));
+}
 
-    if (lifter.isTerminator(inst)) {
-      break;
+TranslationRequest BinaryTranslator::makeRequest(uint64_t pc, unsigned tier) {
+  TranslationRequest request{pc, tier, std::nullopt};
+  if (tier == 0 && countersAssigned < counterCapacity) {
+    // Reserve the counter up front so concurrent translations never share
+    // one. Slots of translations that are never installed just go unused.
+    request.counterIndex = countersAssigned++;
+  } else if (tier == 0) {
+    // Out of counters; go straight to the optimizing tier
+    request.tier = 1;
+  }
+  return request;
+}
+
+void BinaryTranslator::speculateSuccessors(const TranslatedBlock &block) {
+  if (!translationPool || translationPool->getThreadCount() == 0 ||
+      isCodeCacheFull()) {
+    return;
+  }
+
+  for (const auto &exit : block.exits) {
+    uint64_t target = exit.targetAddress;
+    if (exit.linked || !isValidPC(target) || codeCache->contains(target) ||
+        untranslatable.count(target) || translationPool->contains(target)) {
+      continue;
     }
+    translationPool->enqueue(makeRequest(target, tierUpThreshold > 0 ? 0 : 1));
+  }
+}
 
-    offset += 4;
-    currentPC += 4;
+const TranslatedBlock *
+BinaryTranslator::installSpeculativeTranslation(uint64_t pc) {
+  if (!translationPool) {
+    return nullptr;
   }
 
-  if (blockInstructions.empty()) {
-    std::ostringstream oss;
-    oss << "No instructions decoded for block at PC=0x" << std::hex << pc;
-    throw RuntimeError(oss.str());
+  // Cancels the request if no worker got to it yet. A full cache is
+  // flushed by the demand translation, which drops this one anyway.
+  std::optional<Translation> translation = translationPool->take(pc);
+  if (!translation || isCodeCacheFull()) {
+    return nullptr;
   }
 
-  std::cout << "  Lifting " << blockInstructions.size() << " instructions to IR"
-            << std::endl;
-  ir::BasicBlock irBlock = lifter.liftBasicBlock(blockInstructions);
+  ++speculativeInstalls;
+  return &installTranslation(*translation);
+}
 
-  std::cout << "  Translating IR to ARM64" << std::endl;
-  auto arm64Instructions = translateToARM64(irBlock);
+bool BinaryTranslator::isCodeCacheFull() const {
+  // Blocks mapped from the AOT cache don't take up code memory
+  size_t aotBlocks = aotCache ? aotCache->getBlocks().size() : 0;
+  if (codeCacheBlockLimit > 0 &&
+      codeCache->size() - aotBlocks >= codeCacheBlockLimit) {
+    return true;
+  }
+  return executionEngine->getCodeSize() + MAX_TRANSLATION_SIZE >
+         codeCacheSizeLimit;
+}
 
-  // Encode to machine code
-  std::cout << "  Encoding to machine code" << std::endl;
-  std::vector<uint8_t> machineCode;
-  for (const auto &instruction : arm64Instructions) {
-    auto encoded = encoder->encodeInstruction(instruction);
-    machineCode.insert(machineCode.end(), encoded.begin(), encoded.end());
+void BinaryTranslator::flushCodeCache(GuestContext *caller) {
+  // Only called with no other context running and the caller (if any) in
+  // the dispatcher, so no translated code is running. Chains between blocks
+  // disappear along with the code; everything else that points into it has
+  // to be dropped.
+  codeCache->clear();
+  unpublishAll();
+  if (translationPool) {
+    translationPool->reset();
+  }
+  countersAssigned = 0;
+  executionEngine->flushCode();
+  codeEpoch.fetch_add(1, std::memory_order_release);
+  if (caller) {
+    refreshContext(*caller);
   }
 
-  if (machineCode.empty()) {
-    throw EncodingError("Failed to encode machine code");
+  // The mapped AOT image isn't affected
+  installAotBlocks();
+}
+
+void BinaryTranslator::prepareAotCache(const std::string &inputPath) {
+  // Code with budget checks or from another -O level is a different image
+  // of the same binary
+  uint64_t elfHash = AotCache::hashFile(inputPath);
+  AotConfig config{hasBudgetChecks(), optimizationLevel};
+  aotCache = std::make_unique<AotCache>();
+
+  AotCache::Status status = aotCache->load(aotCachePath, elfHash, config);
+  if (status == AotCache::Status::Stale) {
+    *logStream << "AOT cache " << aotCachePath << " is stale, rebuilding"
+               << std::endl;
   }
 
-  std::cout << "  Executing " << machineCode.size() << " bytes of machine code"
-            << std::endl;
-  uint64_t nextPC = executionEngine->executeBlock(machineCode, &guestState);
+  if (status != AotCache::Status::Loaded) {
+    *logStream << "Translating " << inputPath << " ahead of time"
+               << std::endl;
+    std::vector<TranslatedBlock> blocks = translateAheadOfTime();
+    if (blocks.empty()) {
+      // Nothing to map later, so leave everything to the JIT
+      *logStream << "No blocks translated ahead of time, not writing "
+                 << aotCachePath << std::endl;
+      aotCache.reset();
+      return;
+    }
 
-  return nextPC;
+    // Blocks were installed back to back, so together they form one image
+    const uint8_t *start = nullptr;
+    const uint8_t *end = nullptr;
+    size_t codeSize = 0;
+    for (const auto &block : blocks) {
+      auto *code = static_cast<const uint8_t *>(block.hostCode);
+      if (!start || code < start) {
+        start = code;
+      }
+      if (!end || code + block.hostCodeSize > end) {
+        end = code + block.hostCodeSize;
+      }
+      codeSize += block.hostCodeSize;
+    }
+    // A flush in between would leave gaps or overlapping blocks
+    if (static_cast<size_t>(end - start) != codeSize) {
+      throw RuntimeError("AOT translation of " + inputPath +
+                         " does not fit in the code cache");
+    }
+    AotCache::write(aotCachePath, elfHash, config, start, codeSize, blocks);
+    ++aotCacheBuilds;
+
+    // Run from the mapped file, exactly like later runs will
+    flushCodeCache(nullptr);
+    if (aotCache->load(aotCachePath, elfHash, config) !=
+        AotCache::Status::Loaded) {
+      throw RuntimeError("Failed to reload AOT cache " + aotCachePath);
+    }
+  }
+
+  installAotBlocks();
+  *logStream << "AOT cache: mapped " << aotCache->getBlocks().size()
+             << " blocks (" << aotCache->getCodeSize() << " bytes) from "
+             << aotCachePath << std::endl;
 }
 
-int BinaryTranslator::executeFunction(const std::string &inputPath,
-                                      const std::string &functionName) {
-  loadRISCVBinary(inputPath);
+std::vector<TranslatedBlock> BinaryTranslator::translateAheadOfTime() {
+  // Every place execution can enter the binary from outside, and functions
+  // only reached through calls
+  std::vector<uint64_t> worklist;
+  for (const auto &function : controlFlowGraph->getFunctions()) {
+    worklist.push_back(function.address);
+  }
 
-  std::cout << "Text section: VA=0x" << std::hex << textBaseAddress
-            << " Size=" << std::dec << textSectionData.size() << " bytes"
-            << std::endl;
+  // Follow direct exits until nothing new is reachable. Indirect branch
+  // targets other than function entries are left to the JIT.
+  size_t staticBlocks = controlFlowGraph->getBlocks().size();
+  std::unordered_set<uint64_t> visited;
+  std::vector<TranslatedBlock> blocks;
+  visited.reserve(staticBlocks);
+  blocks.reserve(staticBlocks);
+  uint64_t flushes = executionEngine->getCodeFlushes();
+  while (!worklist.empty()) {
+    uint64_t pc = worklist.back();
+    worklist.pop_back();
+    if (!isValidPC(pc) || !visited.insert(pc).second) {
+      continue;
+    }
+
+    try {
+      blocks.push_back(*translateBlock(pc, 1, nullptr));
+    } catch (const Error &e) {
+      *logStream << "  Skipping block at 0x" << std::hex << pc << std::dec
+                << " (" << e.what() << ")" << std::endl;
+      continue;
+    }
+
+    for (const auto &exit : blocks.back().exits) {
+      worklist.push_back(exit.targetAddress);
+    }
+  }
+
+  if (executionEngine->getCodeFlushes() != flushes) {
+    throw RuntimeError("AOT translation does not fit in the code cache");
+  }
+  return blocks;
+}
 
-  auto functionAddr = elfReader->getFunctionAddress(functionName);
-  if (!functionAddr.has_value()) {
-    throw ELFError("Function '" + functionName + "' not found in binary");
+void BinaryTranslator::installAotBlocks() {
+  if (!aotCache) {
+    return;
+  }
+  for (const auto &block : aotCache->getBlocks()) {
+    codeCache->insert(block);
+    publish(block.guestAddress, block.hostCode);
   }
+}
 
-  guestState.pc = functionAddr.value();
-  guestState.x[1] = 0;
+uint64_t BinaryTranslator::executeBlock(GuestContext &context, uint64_t pc) {
+  // Hosts that can't run generated code may still have mapped an AOT cache
+  if (interpretThreshold == INTERPRET_ONLY) {
+    return interpretBlock(context, pc);
+  }
 
-  uint64_t currentPC = functionAddr.value();
-  int maxBlocks = MAX_EXECUTION_BLOCKS;
-  int blockCount = 0;
+  if (const void *hostCode = lookupPublished(pc)) {
+    ++context.statistics.hits;
+    return runBlock(context, pc, hostCode);
+  }
+  ++context.statistics.misses;
 
-  while (blockCount < maxBlocks && currentPC != 0) {
-    guestState.pc = currentPC;
-    uint64_t nextPC = executeBlock(currentPC);
+  // Another context may have translated the block since the lookup
+  std::unique_lock<std::mutex> lock(translationMutex);
+  const TranslatedBlock *block = codeCache->lookup(pc);
 
-    if (nextPC == 0) {
-      break;
+  // A block a worker already translated is cheaper to install than to
+  // interpret
+  if (!block) {
+    block = installSpeculativeTranslation(pc);
+  }
+  if (!block && shouldInterpret(pc)) {
+    lock.unlock();
+    return interpretBlock(context, pc);
+  }
+
+  if (!block) {
+    try {
+      block = translateBlock(pc, tierUpThreshold > 0 ? 0 : 1, &context);
+    } catch (const Error &e) {
+      // The interpreter covers all of RV64I and reports its own error if
+      // the block really can't run
+      *logStream << "  Translation failed (" << e.what()
+                 << "), interpreting block at 0x" << std::hex << pc
+                 << std::dec << std::endl;
+      untranslatable.insert(pc);
+      ++translationFailures;
+    }
+
+    // No room until other contexts let the code cache be flushed
+    if (!block) {
+      lock.unlock();
+      return interpretBlock(context, pc);
     }
 
-    currentPC = nextPC;
-    blockCount++;
+    // The blocks likely to run next are translated while this one runs
+    speculateSuccessors(*block);
+  }
+
+  // The cache entry may change once the lock is released
+  const void *hostCode = block->hostCode;
+  lock.unlock();
+  return runBlock(context, pc, hostCode);
+}
+
+uint64_t BinaryTranslator::runBlock(GuestContext &context, uint64_t pc,
+                                    const void *hostCode) {
+  // Any block reached through the dispatcher may be the target of an
+  // indirect branch, so let translated code and the trampoline find it
+  // directly next time
+  GuestState &state = context.getState();
+  const IndirectTarget &entry = state.ibtc[GuestState::indirectTargetIndex(pc)];
+  if (entry.guestPC != pc || entry.hostCode != hostCode) {
+    state.cacheIndirectTarget(pc, hostCode);
+    ++context.statistics.indirectTargetFills;
   }
 
-  return static_cast<int>(getReturnValue());
+  return executionEngine->enter(hostCode, &state);
 }
 
-void BinaryTranslator::setArgumentRegisters(const std::vector<uint64_t> &args) {
-  for (size_t i = 0; i < args.size() && i < 8; ++i) {
-    guestState.writeRegister(10 + i, args[i]);
+bool BinaryTranslator::shouldInterpret(uint64_t pc) {
+  if (untranslatable.count(pc)) {
+    return true;
+  }
+
+  uint64_t &executions = interpretedExecutions[pc];
+  if (executions >= interpretThreshold) {
+    interpretedExecutions.erase(pc);
+    return false;
   }
+
+  ++executions;
+  return true;
+}
+
+uint64_t BinaryTranslator::interpretBlock(GuestContext &context,
+                                          uint64_t pc) {
+  // Without translation there is no reason to come back to the dispatcher
+  // after every block
+  uint64_t maxBlocks =
+      interpretThreshold == INTERPRET_ONLY ? INTERPRETER_SLICE_BLOCKS : 1;
+  return interpreter->run(context.getState(), pc, maxBlocks);
+}
+
+uint64_t BinaryTranslator::handleRuntimeExit(GuestContext &context,
+                                             uint64_t pc) {
+  GuestState &state = context.getState();
+  uint64_t reason = state.exitReason;
+  state.exitReason = GuestState::EXIT_NONE;
+
+  switch (reason) {
+  case GuestState::EXIT_TIER_UP: {
+    // Every context counts on its own, so another one may have got there
+    // first. If there's no room the block just stays in the baseline tier.
+    std::lock_guard<std::mutex> lock(translationMutex);
+    const TranslatedBlock *block = codeCache->lookup(pc);
+    if (block && block->tier > 0) {
+      break;
+    }
+    *logStream << "Tier-up: block at 0x" << std::hex << pc << std::dec
+               << " reached " << tierUpThreshold << " executions"
+               << std::endl;
+    if (translateBlock(pc, 1, &context)) {
+      ++tierUps;
+    }
+    break;
+  }
+  case GuestState::EXIT_BUDGET: {
+    ++context.statistics.budgetExits;
+    // What's left may not cover a whole trace but still its first blocks,
+    // which the interpreter charges one at a time
+    if (state.instructionBudget > 0) {
+      uint64_t nextPC = interpreter->run(state, pc, 1);
+      if (!(nextPC & GuestState::RUNTIME_EXIT_FLAG)) {
+        return nextPC;
+      }
+      pc = nextPC & ~GuestState::RUNTIME_EXIT_FLAG;
+      state.exitReason = GuestState::EXIT_NONE;
+    }
+    refillBudget(context, pc);
+    break;
+  }
+  default:
+    throw RuntimeError("Unknown runtime exit reason " +
+                       std::to_string(reason));
+  }
+
+  return pc;
 }
 
 bool BinaryTranslator::isValidPC(uint64_t pc) const {
   return pc >= textBaseAddress && pc < textBaseAddress + textSectionData.size();
 }
 
-int BinaryTranslator::getReturnValue() const {
-  return static_cast<int>(guestState.x[10]);
+void BinaryTranslator::printStatistics() const {
+  std::cout << "Code cache: " << codeCache->size() << " blocks, "
+            << dispatchHits.load() << " hits, " << dispatchMisses.load()
+            << " misses, " << codeCache->getChainsLinked()
+            << " chains linked, " << codeCache->getChainsUnlinked()
+            << " unlinked" << std::endl;
+
+  std::cout << "Code cache occupancy: " << executionEngine->getCodeSize()
+            << "/" << codeCacheSizeLimit << " bytes, " << codeCache->size()
+            << "/";
+  if (codeCacheBlockLimit > 0) {
+    std::cout << codeCacheBlockLimit;
+  } else {
+    std::cout << "unlimited";
+  }
+  std::cout << " blocks, " << executionEngine->getCodeFlushes() << " flushes"
+            << std::endl;
+
+  std::cout << "Tiers: " << baselineTranslations
+            << " baseline translations, " << tierUps
+            << " tier-ups (threshold " << tierUpThreshold << "), "
+            << codeCache->getEntriesRedirected() << " entries redirected"
+            << std::endl;
+  if (aotCache) {
+    std::cout << "AOT cache: " << aotCache->getBlocks().size()
+              << " blocks mapped, " << aotCacheBuilds << " rebuilds"
+              << std::endl;
+  }
+  std::cout << "Interpreter: " << interpreter->getBlocksExecuted()
+            << " blocks, " << interpreter->getInstructionsExecuted()
+            << " instructions, " << translationFailures
+            << " translation failures" << std::endl;
+  if (translationPool) {
+    uint64_t completed = translationPool->getCompleted();
+    std::cout << "Speculation: " << translationPool->getThreadCount()
+              << " threads, " << translationPool->getQueued() << " queued, "
+              << completed << " translated, " << speculativeInstalls
+              << " used, " << completed - speculativeInstalls << " wasted, "
+              << translationPool->getCancelled() << " cancelled, "
+              << translationPool->getFailures() << " failed" << std::endl;
+  }
+  if (passManager) {
+    passManager->printStatistics(std::cout);
+  }
+  std::cout << "Traces: " << tracesFormed << " spanning multiple blocks, "
+            << traceFallbacks << " retried as single blocks" << std::endl;
+  std::cout << "Indirect branch cache: " << indirectTargetFills.load()
+            << " fills" << std::endl;
+  if (hasBudgetChecks()) {
+    std::cout << "Execution limits: " << instructionLimit
+              << " instructions, " << timeLimit << " ms, "
+              << budgetExits.load() << " budget exits" << std::endl;
+  }
+  std::cout << "Dispatch trampoline: "
+            << executionEngine->getTrampolineEntries() << " entries"
+            << std::endl;
+
+  const CodeArena &arena = executionEngine->getCodeArena();
+  bool dualMapped = arena.getMapping() == CodeArena::Mapping::Dual;
+  std::cout << "Code arena: " << arena.getUsed() << "/" << arena.getCapacity()
+            << " bytes used, " << (dualMapped ? "dual" : "single")
+            << " mapping, " << arena.getProtectionChanges()
+            << " protection changes (" << arena.getProtectionChangesAvoided()
+            << " avoided), " << arena.getCacheFlushes() << " icache flushes"
+            << std::endl;
 }
 
 } // namespace dinorisc
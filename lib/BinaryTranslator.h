@@ -1,11 +1,25 @@
 #pragma once
 
+#include "AotCache.h"
+#include "CodeCache.h"
+#include "ControlFlowGraph.h"
 #include "ELFReader.h"
 #include "ExecutionEngine.h"
+#include "GuestContext.h"
 #include "GuestState.h"
+#include "Interpreter.h"
+#include "RegisterLiveness.h"
+#include "TraceBuilder.h"
+#include "TranslationPool.h"
+#include <atomic>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace dinorisc {
@@ -14,40 +28,220 @@ namespace riscv {
 class Decoder;
 }
 namespace arm64 {
-class Encoder;
 struct Instruction;
 } // namespace arm64
 namespace ir {
 struct BasicBlock;
 }
+namespace optimization {
+class PassManager;
+}
 
 class BinaryTranslator {
 public:
+  // Executions of a baseline block before it is retranslated as a trace
+  static constexpr uint64_t DEFAULT_TIER_UP_THRESHOLD = 50;
+
+  // Executions of a block in the interpreter before it is translated
+  static constexpr uint64_t DEFAULT_INTERPRET_THRESHOLD = 1;
+
+  // Interpret threshold that never translates anything
+  static constexpr uint64_t INTERPRET_ONLY = ~0ULL;
+
+  // Guest instructions between checks of the time limit
+  static constexpr uint64_t BUDGET_SLICE = 1 << 20;
+
+  // Bytes of translated code kept before the code cache is flushed
+  static constexpr size_t DEFAULT_CODE_CACHE_SIZE = CodeArena::DEFAULT_CAPACITY;
+
+  // Room kept free for the translation about to be installed. Traces are
+  // capped at a few hundred host instructions, far below this.
+  static constexpr size_t MAX_TRANSLATION_SIZE = 64 * 1024;
+
+  // Smallest code cache that still fits the largest translation next to the
+  // dispatch trampoline, which survives flushes
+  static constexpr size_t MIN_CODE_CACHE_SIZE = 2 * MAX_TRANSLATION_SIZE;
+
   BinaryTranslator();
   ~BinaryTranslator();
 
-  int executeFunction(const std::string &inputPath,
-                      const std::string &functionName);
+  // Load a binary, mapping or building its AOT cache if one is set. Must
+  // not overlap with run().
+  void load(const std::string &inputPath);
+
+  std::optional<uint64_t>
+  getFunctionAddress(const std::string &functionName) const;
+
+  // Run the loaded binary in context from pc until it returns to address 0
+  // and return a0. Safe to call from several threads at once, each with its
+  // own context; they all share the decoded binary and the code cache.
+  uint64_t run(GuestContext &context, uint64_t pc);
+
+  void printStatistics() const;
+
+  const CodeCache &getCodeCache() const { return *codeCache; }
+
+  // 0 disables the baseline tier, translating everything as traces up front
+  void setTierUpThreshold(uint64_t threshold) { tierUpThreshold = threshold; }
+
+  // 0 translates blocks the first time they run. Hosts that can't run
+  // generated code always interpret.
+  void setInterpretThreshold(uint64_t threshold);
+
+  // Flush all translations when the next one could take generated code past
+  // maxCodeBytes (capped at the code arena size) or the cache past maxBlocks
+  // blocks (0 = no limit). Throws RuntimeError if maxCodeBytes is below
+  // MIN_CODE_CACHE_SIZE.
+  void setCodeCacheLimits(size_t maxCodeBytes, size_t maxBlocks);
+
+  // Map translations of the whole binary from this file before running.
+  // A missing or stale file is rebuilt by translating every block reachable
+  // from the entry point and function symbols.
+  void setAotCachePath(const std::string &path) { aotCachePath = path; }
 
-  void setArgumentRegisters(const std::vector<uint64_t> &args);
+  // Translate the successors of newly translated blocks on this many
+  // background threads (0 = translate only on demand)
+  void setSpeculationThreads(size_t threads);
+
+  // Stop a run with ExecutionLimitError after this many guest instructions
+  // (0 = no limit). Translated code charges a whole block or trace on entry
+  // and side exits give back what they skip. A trace the rest of the budget
+  // doesn't cover is interpreted block by block, and the interpreter charges
+  // after running a block, so a run may stop up to one block late.
+  void setInstructionLimit(uint64_t instructions) {
+    instructionLimit = instructions;
+  }
+
+  // Stop a run with ExecutionLimitError once it has taken this long (0 = no
+  // limit). Checked every BUDGET_SLICE guest instructions.
+  void setTimeLimit(uint64_t milliseconds) { timeLimit = milliseconds; }
+
+  // Optimize lifted IR with the pass pipeline of this -O level (default
+  // PassManager::DEFAULT_LEVEL). Throws RuntimeError once a binary is
+  // loaded.
+  void setOptimizationLevel(unsigned level);
+
+  // Where translation progress is reported (std::cout by default)
+  void setLog(std::ostream &stream) { logStream = &stream; }
+  std::ostream &getLog() const { return *logStream; }
 
 private:
   std::unique_ptr<ELFReader> elfReader;
   std::unique_ptr<riscv::Decoder> decoder;
-  std::unique_ptr<arm64::Encoder> encoder;
   std::unique_ptr<ExecutionEngine> executionEngine;
-  GuestState guestState;
+  std::unique_ptr<CodeCache> codeCache;
+  std::unique_ptr<Interpreter> interpreter;
+  std::unique_ptr<AotCache> aotCache;
+  std::unique_ptr<ControlFlowGraph> controlFlowGraph;
+  std::unique_ptr<RegisterLiveness> registerLiveness;
+  std::unique_ptr<TranslationPool> translationPool;
+  std::unique_ptr<optimization::PassManager> passManager;
+  std::string aotCachePath;
+  std::ostream *logStream;
+  uint64_t tierUpThreshold;
+  uint64_t interpretThreshold;
+  size_t codeCacheSizeLimit;
+  size_t codeCacheBlockLimit;
+  unsigned optimizationLevel;
+
+  // Limits set with setInstructionLimit() and setTimeLimit(). Translated
+  // code only checks the instruction budget if either is set, which has to
+  // happen before load().
+  uint64_t instructionLimit;
+  uint64_t timeLimit;
+
+  // How often each not yet translated block has been interpreted
+  std::unordered_map<uint64_t, uint64_t> interpretedExecutions;
+
+  // Function symbols of the loaded binary by name
+  std::unordered_map<std::string, uint64_t> functionAddresses;
+
+  // Blocks that failed to translate and are always interpreted
+  std::unordered_set<uint64_t> untranslatable;
+
+  // Everything that changes the code cache or the state above happens
+  // under this lock. Running translated code doesn't take it.
+  std::mutex translationMutex;
+
+  // Serializes run() when the code arena has a single mapping
+  std::mutex singleMappingMutex;
+
+  // Host code of every cached block by guest instruction index, for lookups
+  // from the dispatcher that don't take the lock. Entries are stored after
+  // their code is committed.
+  std::unique_ptr<std::atomic<const void *>[]> publishedCode;
+  size_t publishedCodeSize;
+
+  // Number of contexts in run(), plus FLUSHING while the code cache is
+  // being flushed, which keeps everyone else out of translated code
+  static constexpr uint64_t FLUSHING = 1ULL << 63;
+  std::atomic<uint64_t> runningContexts;
+
+  // Bumped by every flush. Contexts drop their cached host addresses and
+  // counters when they start running in a newer epoch.
+  std::atomic<uint64_t> codeEpoch;
+
+  // Tier-up counter slots each context has and how many are handed out.
+  // Baseline blocks translated once they run out don't count.
+  size_t counterCapacity;
+  size_t countersAssigned;
 
   void initializeTranslator();
   void loadRISCVBinary(const std::string &inputPath);
+  void enterRun(GuestContext &context);
+  void leaveRun(GuestContext &context);
+  void refreshContext(GuestContext &context);
+  const void *lookupPublished(uint64_t pc) const;
+  void publish(uint64_t pc, const void *hostCode);
+  void unpublishAll();
+  bool beginExclusive(bool callerRunning);
+  void endExclusive();
+  bool hasBudgetChecks() const { return instructionLimit || timeLimit; }
+  void startBudget(GuestContext &context);
+  void refillBudget(GuestContext &context, uint64_t pc);
+  std::vector<arm64::Instruction>
+  translateTrace(const Trace &trace, std::vector<lowering::BlockExit> &exits,
+                 std::optional<lowering::TierUpCounter> counter,
+                 std::ostream &log) const;
   std::vector<arm64::Instruction>
-  translateToARM64(const ir::BasicBlock &irBlock);
-  uint64_t executeBlock(uint64_t pc);
+  translateToARM64(const ir::BasicBlock &irBlock,
+                   std::vector<lowering::BlockExit> &exits,
+                   std::optional<lowering::TierUpCounter> counter,
+                   std::optional<lowering::BudgetCheck> budget,
+                   std::ostream &log) const;
+  Translation compileBlock(const TranslationRequest &request,
+                           std::ostream &log) const;
+  const TranslatedBlock &installTranslation(const Translation &translation);
+  const TranslatedBlock *translateBlock(uint64_t pc, unsigned tier,
+                                        GuestContext *caller);
+  TranslationRequest makeRequest(uint64_t pc, unsigned tier);
+  void speculateSuccessors(const TranslatedBlock &block);
+  const TranslatedBlock *installSpeculativeTranslation(uint64_t pc);
+  bool isCodeCacheFull() const;
+  void flushCodeCache(GuestContext *caller);
+  void prepareAotCache(const std::string &inputPath);
+  std::vector<TranslatedBlock> translateAheadOfTime();
+  void installAotBlocks();
+  uint64_t executeBlock(GuestContext &context, uint64_t pc);
+  uint64_t runBlock(GuestContext &context, uint64_t pc, const void *hostCode);
+  bool shouldInterpret(uint64_t pc);
+  uint64_t interpretBlock(GuestContext &context, uint64_t pc);
+  uint64_t handleRuntimeExit(GuestContext &context, uint64_t pc);
   bool isValidPC(uint64_t pc) const;
-  int getReturnValue() const;
 
   std::vector<uint8_t> textSectionData;
   uint64_t textBaseAddress;
+  std::atomic<uint64_t> dispatchHits;
+  std::atomic<uint64_t> dispatchMisses;
+  std::atomic<uint64_t> indirectTargetFills;
+  std::atomic<uint64_t> budgetExits;
+  uint64_t tracesFormed;
+  uint64_t traceFallbacks;
+  uint64_t baselineTranslations;
+  uint64_t tierUps;
+  uint64_t translationFailures;
+  uint64_t aotCacheBuilds;
+  uint64_t speculativeInstalls;
 };
 
 } // namespace dinorisc
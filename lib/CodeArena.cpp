@@ -0,0 +1,188 @@
+#include "CodeArena.h"
+#include "Error.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace dinorisc {
+
+namespace {
+// Keep every block instruction-aligned
+constexpr size_t CODE_ALIGNMENT = 4;
+} // namespace
+
+CodeArena::CodeArena(size_t capacity, Mapping mapping)
+    : base(nullptr), writable(nullptr), capacity(capacity),
+      pageSize(getpagesize()), mapping(mapping), used(0), sealedEnd(0),
+      flushStart(0), protectionChanges(0), protectionChangesAvoided(0),
+      cacheFlushes(0) {
+  this->capacity = pageCeil(capacity);
+
+  if (mapping == Mapping::Dual && mapDual()) {
+    return;
+  }
+  this->mapping = Mapping::Single;
+
+  void *memory = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw RuntimeError("CodeArena: Failed to reserve code memory");
+  }
+  base = static_cast<uint8_t *>(memory);
+  writable = base;
+}
+
+CodeArena::~CodeArena() {
+  if (writable && writable != base) {
+    munmap(writable, capacity);
+  }
+  if (base) {
+    munmap(base, capacity);
+  }
+}
+
+bool CodeArena::mapDual() {
+#ifdef __linux__
+  int fd = memfd_create("dinorisc-code", MFD_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Both views share the memfd's pages; they stay alive after the
+  // descriptor is closed
+  void *writeView = MAP_FAILED;
+  void *executeView = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(capacity)) == 0) {
+    writeView = mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_NORESERVE, fd, 0);
+    executeView = mmap(nullptr, capacity, PROT_READ | PROT_EXEC,
+                       MAP_SHARED | MAP_NORESERVE, fd, 0);
+  }
+  close(fd);
+
+  if (writeView == MAP_FAILED || executeView == MAP_FAILED) {
+    // Hardened kernels may refuse executable shared mappings
+    if (writeView != MAP_FAILED) {
+      munmap(writeView, capacity);
+    }
+    if (executeView != MAP_FAILED) {
+      munmap(executeView, capacity);
+    }
+    return false;
+  }
+
+  writable = static_cast<uint8_t *>(writeView);
+  base = static_cast<uint8_t *>(executeView);
+  return true;
+#else
+  return false;
+#endif
+}
+
+const void *CodeArena::emit(const uint8_t *code, size_t size) {
+  if (size == 0) {
+    throw RuntimeError("CodeArena: No machine code to emit");
+  }
+
+  size_t offset = (used + CODE_ALIGNMENT - 1) & ~(CODE_ALIGNMENT - 1);
+  if (offset + size > capacity) {
+    throw RuntimeError("CodeArena: Out of code memory");
+  }
+
+  // The tail of the last committed batch may share a page with the new code,
+  // so take that page back out of the executable range before writing
+  if (offset < sealedEnd) {
+    size_t page = pageFloor(offset);
+    protect(page, sealedEnd - page, PROT_READ | PROT_WRITE);
+    sealedEnd = page;
+  }
+
+  std::memcpy(writable + offset, code, size);
+  used = offset + size;
+  return base + offset;
+}
+
+void CodeArena::commit() {
+  if (!hasPendingCode()) {
+    return;
+  }
+
+  size_t end = pageCeil(used);
+  if (end > sealedEnd) {
+    protect(sealedEnd, end - sealedEnd, PROT_READ | PROT_EXEC);
+    sealedEnd = end;
+  }
+
+  flushInstructionCache(flushStart, used - flushStart);
+  flushStart = used;
+}
+
+void CodeArena::patch(const void *address, uint32_t word) {
+  if (!contains(address)) {
+    throw RuntimeError("CodeArena: Patch address outside code memory");
+  }
+
+  size_t offset = static_cast<const uint8_t *>(address) - base;
+  bool sealed = offset < sealedEnd;
+  if (sealed) {
+    protect(pageFloor(offset), pageSize, PROT_READ | PROT_WRITE);
+  }
+
+  std::memcpy(writable + offset, &word, sizeof(word));
+
+  if (sealed) {
+    protect(pageFloor(offset), pageSize, PROT_READ | PROT_EXEC);
+  }
+
+  // Code that is still pending gets flushed by the next commit()
+  if (offset < flushStart) {
+    flushInstructionCache(offset, sizeof(word));
+  }
+}
+
+void CodeArena::rewind(size_t offset) {
+  if (offset > used) {
+    throw RuntimeError("CodeArena: Rewind past the end of emitted code");
+  }
+
+  // Pages that are still executable get made writable again by the next
+  // emit(), and the reused range is flushed by the commit after it
+  used = offset;
+  flushStart = std::min(flushStart, offset);
+}
+
+bool CodeArena::contains(const void *address) const {
+  auto *ptr = static_cast<const uint8_t *>(address);
+  return ptr >= base && ptr < base + used;
+}
+
+void CodeArena::protect(size_t offset, size_t length, int protection) {
+  // The execute view never becomes writable, so there is nothing to flip
+  if (mapping == Mapping::Dual) {
+    ++protectionChangesAvoided;
+    return;
+  }
+
+  if (mprotect(base + offset, length, protection) != 0) {
+    throw RuntimeError("CodeArena: Failed to change code memory protection");
+  }
+  ++protectionChanges;
+}
+
+void CodeArena::flushInstructionCache(size_t offset, size_t length) {
+  char *start = reinterpret_cast<char *>(base + offset);
+  __builtin___clear_cache(start, start + length);
+  ++cacheFlushes;
+}
+
+size_t CodeArena::pageFloor(size_t offset) const {
+  return offset & ~(pageSize - 1);
+}
+
+size_t CodeArena::pageCeil(size_t offset) const {
+  return (offset + pageSize - 1) & ~(pageSize - 1);
+}
+
+} // namespace dinorisc
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dinorisc {
+
+// One large region of host memory that translated code is bump-allocated
+// into. Code becomes executable on commit(), which flushes the instruction
+// cache for everything emitted since the previous commit in a single batch.
+//
+// Where the kernel allows it the region is a memfd mapped twice: writes go
+// through a read+write view and code runs from a separate read+execute view,
+// so no page is ever writable and executable and patching needs no syscall.
+// Otherwise there is a single mapping whose pages are flipped between
+// writable and executable with mprotect.
+class CodeArena {
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024; // 64MB
+
+  enum class Mapping { Dual, Single };
+
+  // Asking for a dual mapping falls back to a single one if it can't be set
+  // up on this host
+  explicit CodeArena(size_t capacity = DEFAULT_CAPACITY,
+                     Mapping mapping = Mapping::Dual);
+  ~CodeArena();
+
+  CodeArena(const CodeArena &) = delete;
+  CodeArena &operator=(const CodeArena &) = delete;
+
+  // Copy machine code into the arena and return the address it will execute
+  // from. The code is not executable until the next commit().
+  const void *emit(const uint8_t *code, size_t size);
+
+  // Make all pending code executable
+  void commit();
+  bool hasPendingCode() const { return flushStart != used; }
+
+  // Overwrite one instruction word of already emitted code
+  void patch(const void *address, uint32_t word);
+
+  // Discard everything emitted at or after offset so the space can be
+  // reused. Code below offset stays where it is.
+  void rewind(size_t offset);
+
+  // Whether address lies in emitted code (as returned by emit())
+  bool contains(const void *address) const;
+
+  Mapping getMapping() const { return mapping; }
+
+  size_t getCapacity() const { return capacity; }
+  size_t getUsed() const { return used; }
+  uint64_t getProtectionChanges() const { return protectionChanges; }
+  // mprotect calls a single mapping would have made
+  uint64_t getProtectionChangesAvoided() const {
+    return protectionChangesAvoided;
+  }
+  uint64_t getCacheFlushes() const { return cacheFlushes; }
+
+private:
+  // Where code executes from
+  uint8_t *base;
+  // Where code is written; the same as base for a single mapping
+  uint8_t *writable;
+  size_t capacity;
+  size_t pageSize;
+  Mapping mapping;
+
+  // Bytes handed out so far
+  size_t used;
+  // Pages below this offset are currently executable (and with a single
+  // mapping not writable)
+  size_t sealedEnd;
+  // Start of code written since the last instruction cache flush
+  size_t flushStart;
+
+  uint64_t protectionChanges;
+  uint64_t protectionChangesAvoided;
+  uint64_t cacheFlushes;
+
+  bool mapDual();
+  void protect(size_t offset, size_t length, int protection);
+  void flushInstructionCache(size_t offset, size_t length);
+  size_t pageFloor(size_t offset) const;
+  size_t pageCeil(size_t offset) const;
+};
+
+} // namespace dinorisc
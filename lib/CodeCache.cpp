@@ -0,0 +1,162 @@
+#include "CodeCache.h"
+#include "ARM64/Encoder.h"
+#include "CodeArena.h"
+#include <algorithm>
+#include <cstring>
+
+namespace dinorisc {
+
+namespace {
+
+// An unlinked exit branches to the instruction right after it
+constexpr int64_t UNLINKED_BRANCH_OFFSET = 4;
+
+// B has a signed 26-bit word offset
+constexpr int64_t MAX_BRANCH_OFFSET = 0x1FFFFFC;
+constexpr int64_t MIN_BRANCH_OFFSET = -0x2000000;
+
+uint32_t encodeBranch(int64_t offset) {
+  arm64::Encoder encoder;
+  arm64::Instruction branch;
+  branch.kind =
+      arm64::BranchInst{arm64::Opcode::B, static_cast<uint64_t>(offset)};
+  auto bytes = encoder.encodeInstruction(branch);
+
+  uint32_t word;
+  std::memcpy(&word, bytes.data(), sizeof(word));
+  return word;
+}
+
+} // namespace
+
+CodeCache::CodeCache(CodeArena *arena)
+    : arena(arena), hits(0), misses(0), chainsLinked(0), chainsUnlinked(0),
+      entriesRedirected(0) {}
+
+const TranslatedBlock *CodeCache::lookup(uint64_t guestAddress) {
+  auto it = blocks.find(guestAddress);
+  if (it == blocks.end()) {
+    ++misses;
+    return nullptr;
+  }
+
+  ++hits;
+  return &it->second;
+}
+
+const TranslatedBlock &CodeCache::insert(const TranslatedBlock &block) {
+  const void *replacedEntry = nullptr;
+  auto replaced = blocks.find(block.guestAddress);
+  if (replaced != blocks.end() && replaced->second.patchableEntry) {
+    replacedEntry = replaced->second.hostCode;
+  }
+
+  invalidate(block.guestAddress);
+
+  TranslatedBlock &cached =
+      blocks.emplace(block.guestAddress, block).first->second;
+
+  if (replacedEntry && patchBranch(replacedEntry, cached.hostCode)) {
+    ++entriesRedirected;
+  }
+
+  // Chain this block's exits to targets that are already translated
+  for (size_t i = 0; i < cached.exits.size(); ++i) {
+    ExitStub &exit = cached.exits[i];
+    exit.linked = false;
+    incomingExits[exit.targetAddress].push_back({cached.guestAddress, i});
+
+    auto target = blocks.find(exit.targetAddress);
+    if (target != blocks.end()) {
+      link(exit, target->second);
+    }
+  }
+
+  // Chain exits that were waiting for this block to be translated
+  auto incoming = incomingExits.find(cached.guestAddress);
+  if (incoming != incomingExits.end()) {
+    for (const auto &[source, index] : incoming->second) {
+      ExitStub &exit = blocks.at(source).exits[index];
+      if (!exit.linked) {
+        link(exit, cached);
+      }
+    }
+  }
+
+  return cached;
+}
+
+void CodeCache::invalidate(uint64_t guestAddress) {
+  auto it = blocks.find(guestAddress);
+  if (it == blocks.end()) {
+    return;
+  }
+
+  // Send every chained predecessor back through the dispatcher
+  auto incoming = incomingExits.find(guestAddress);
+  if (incoming != incomingExits.end()) {
+    for (const auto &[source, index] : incoming->second) {
+      ExitStub &exit = blocks.at(source).exits[index];
+      if (exit.linked) {
+        unlink(exit);
+      }
+    }
+  }
+
+  // Forget this block's own exits
+  for (const ExitStub &exit : it->second.exits) {
+    auto &refs = incomingExits[exit.targetAddress];
+    refs.erase(std::remove_if(refs.begin(), refs.end(),
+                              [guestAddress](const ExitRef &ref) {
+                                return ref.first == guestAddress;
+                              }),
+               refs.end());
+    if (refs.empty()) {
+      incomingExits.erase(exit.targetAddress);
+    }
+  }
+
+  blocks.erase(it);
+}
+
+void CodeCache::clear() {
+  blocks.clear();
+  incomingExits.clear();
+}
+
+void CodeCache::reserve(size_t count) {
+  blocks.reserve(count);
+  incomingExits.reserve(count);
+}
+
+void CodeCache::link(ExitStub &exit, const TranslatedBlock &target) {
+  if (!patchBranch(exit.branchAddress, target.hostCode)) {
+    return;
+  }
+
+  exit.linked = true;
+  ++chainsLinked;
+}
+
+bool CodeCache::patchBranch(const void *branchAddress, const void *target) {
+  if (!arena || !arena->contains(branchAddress)) {
+    return false;
+  }
+
+  int64_t offset = static_cast<const uint8_t *>(target) -
+                   static_cast<const uint8_t *>(branchAddress);
+  if (offset < MIN_BRANCH_OFFSET || offset > MAX_BRANCH_OFFSET) {
+    return false;
+  }
+
+  arena->patch(branchAddress, encodeBranch(offset));
+  return true;
+}
+
+void CodeCache::unlink(ExitStub &exit) {
+  arena->patch(exit.branchAddress, encodeBranch(UNLINKED_BRANCH_OFFSET));
+  exit.linked = false;
+  ++chainsUnlinked;
+}
+
+} // namespace dinorisc
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dinorisc {
+
+class CodeArena;
+
+// A direct exit from translated code to a guest address that was known at
+// translation time. The exit starts with a branch that initially falls
+// through to "return to dispatcher" code and can be redirected to the
+// target's translation once it exists.
+struct ExitStub {
+  const void *branchAddress;
+  uint64_t targetAddress;
+  bool linked;
+};
+
+// A guest basic block that has been translated to resident host code
+struct TranslatedBlock {
+  uint64_t guestAddress;
+  size_t guestInstructionCount;
+  const void *hostCode;
+  size_t hostCodeSize;
+  std::vector<ExitStub> exits;
+  // Execution tier the block was translated for (0 = baseline)
+  unsigned tier = 0;
+  // Whether the code starts with a "B #4" that can be redirected to a
+  // replacement translation
+  bool patchableEntry = false;
+};
+
+// Maps guest PCs to their translations so each block is only translated once.
+// When given a code arena, direct exits between cached blocks are chained so
+// control flows from block to block without returning to the dispatcher.
+class CodeCache {
+public:
+  explicit CodeCache(CodeArena *arena = nullptr);
+
+  // Find the translation for a guest PC, or nullptr if it hasn't been
+  // translated yet. Updates the hit/miss counters.
+  const TranslatedBlock *lookup(uint64_t guestAddress);
+
+  // Whether a guest PC has a translation, without touching the counters
+  bool contains(uint64_t guestAddress) const {
+    return blocks.count(guestAddress) != 0;
+  }
+
+  // Register a new translation, chain its exits to already translated
+  // targets and chain pending exits of other blocks to it. A replaced
+  // translation with a patchable entry is redirected to the new one, so
+  // anything still holding its address ends up in the new code.
+  const TranslatedBlock &insert(const TranslatedBlock &block);
+
+  // Unlink all chains into a block and drop its translation
+  void invalidate(uint64_t guestAddress);
+
+  // Drop all translations (the host code itself is owned elsewhere)
+  void clear();
+
+  // Make room for this many translations without rehashing
+  void reserve(size_t count);
+
+  size_t size() const { return blocks.size(); }
+  uint64_t getHits() const { return hits; }
+  uint64_t getMisses() const { return misses; }
+  uint64_t getChainsLinked() const { return chainsLinked; }
+  uint64_t getChainsUnlinked() const { return chainsUnlinked; }
+  uint64_t getEntriesRedirected() const { return entriesRedirected; }
+
+private:
+  // An exit stub identified by its owning block and index into its exits
+  using ExitRef = std::pair<uint64_t, size_t>;
+
+  CodeArena *arena;
+  std::unordered_map<uint64_t, TranslatedBlock> blocks;
+
+  // Every exit stub of every cached block, keyed by the guest address it
+  // leaves to
+  std::unordered_map<uint64_t, std::vector<ExitRef>> incomingExits;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t chainsLinked;
+  uint64_t chainsUnlinked;
+  uint64_t entriesRedirected;
+
+  void link(ExitStub &exit, const TranslatedBlock &target);
+  bool patchBranch(const void *branchAddress, const void *target);
+  void unlink(ExitStub &exit);
+};
+
+} // namespace dinorisc
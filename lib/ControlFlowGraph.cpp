@@ -0,0 +1,284 @@
+#include "ControlFlowGraph.h"
+#include "Error.h"
+#include "Lifter.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+namespace dinorisc {
+
+namespace {
+
+constexpr uint64_t INSTRUCTION_SIZE = 4;
+
+// Per-instruction flags of the discovery pass
+constexpr uint8_t LEADER = 1 << 0;
+constexpr uint8_t REACHED = 1 << 1;
+constexpr uint8_t INVALID = 1 << 2;
+
+struct Successor {
+  uint64_t address;
+  EdgeKind kind;
+};
+
+// Statically known successors of a block ending in inst
+std::vector<Successor> successorsOf(const riscv::Instruction &inst) {
+  uint64_t next = inst.address + INSTRUCTION_SIZE;
+  switch (inst.opcode) {
+  case riscv::Instruction::Opcode::BEQ:
+  case riscv::Instruction::Opcode::BNE:
+  case riscv::Instruction::Opcode::BLT:
+  case riscv::Instruction::Opcode::BGE:
+  case riscv::Instruction::Opcode::BLTU:
+  case riscv::Instruction::Opcode::BGEU:
+    return {{inst.address + inst.getImmediate(2), EdgeKind::Branch},
+            {next, EdgeKind::FallThrough}};
+  case riscv::Instruction::Opcode::JAL: {
+    uint64_t target = inst.address + inst.getImmediate(1);
+    if (inst.getRegister(0) == 0) {
+      return {{target, EdgeKind::Jump}};
+    }
+    return {{target, EdgeKind::Call}, {next, EdgeKind::CallReturn}};
+  }
+  case riscv::Instruction::Opcode::JALR:
+    if (inst.getRegister(0) == 0) {
+      return {};
+    }
+    return {{next, EdgeKind::CallReturn}};
+  default:
+    return {{next, EdgeKind::FallThrough}};
+  }
+}
+
+const char *edgeKindName(EdgeKind kind) {
+  switch (kind) {
+  case EdgeKind::FallThrough:
+    return "fallthrough";
+  case EdgeKind::Branch:
+    return "branch";
+  case EdgeKind::Jump:
+    return "jump";
+  case EdgeKind::Call:
+    return "call";
+  case EdgeKind::CallReturn:
+    return "call-return";
+  }
+  return "unknown";
+}
+
+std::string hexAddress(uint64_t address) {
+  std::ostringstream oss;
+  oss << "0x" << std::hex << address;
+  return oss.str();
+}
+
+} // namespace
+
+ControlFlowGraph::ControlFlowGraph(
+    const riscv::Decoder &decoder, const std::vector<uint8_t> &textSection,
+    uint64_t textBaseAddress, uint64_t entryPoint,
+    const std::vector<FunctionSymbol> &functionSymbols)
+    : instructionCount(0) {
+  size_t wordCount = textSection.size() / INSTRUCTION_SIZE;
+  uint64_t textEnd = textBaseAddress + wordCount * INSTRUCTION_SIZE;
+  auto indexOf = [&](uint64_t pc) -> std::optional<size_t> {
+    if (pc < textBaseAddress || pc >= textEnd ||
+        (pc - textBaseAddress) % INSTRUCTION_SIZE != 0) {
+      return std::nullopt;
+    }
+    return (pc - textBaseAddress) / INSTRUCTION_SIZE;
+  };
+  auto decodeAt = [&](size_t index) {
+    uint64_t offset = index * INSTRUCTION_SIZE;
+    try {
+      return decoder.decode(textSection.data(), offset,
+                            textBaseAddress + offset);
+    } catch (const DecodingError &) {
+      // Data in the text section ends the block before it
+      return riscv::Instruction();
+    }
+  };
+
+  std::vector<uint8_t> flags(wordCount, 0);
+  std::vector<uint64_t> worklist;
+  auto addLeader = [&](uint64_t pc) {
+    auto index = indexOf(pc);
+    if (index && !(flags[*index] & LEADER)) {
+      flags[*index] |= LEADER;
+      worklist.push_back(pc);
+    }
+  };
+
+  // Function entries with their symbol size, 0 if unknown. Symbols come
+  // sorted by address, so the first of several aliases names the function.
+  std::map<uint64_t, std::pair<std::string, uint64_t>> functionEntries;
+  for (const auto &symbol : functionSymbols) {
+    if (indexOf(symbol.address)) {
+      functionEntries.emplace(symbol.address,
+                              std::make_pair(symbol.name, symbol.size));
+      addLeader(symbol.address);
+    }
+  }
+  if (indexOf(entryPoint)) {
+    functionEntries.emplace(entryPoint,
+                            std::make_pair(hexAddress(entryPoint), 0));
+    addLeader(entryPoint);
+  }
+
+  // Discovery: decode forward from every leader until a control transfer
+  // and queue its successors. Scans stop early at code already scanned.
+  Lifter lifter;
+  while (!worklist.empty()) {
+    uint64_t pc = worklist.back();
+    worklist.pop_back();
+
+    for (auto index = indexOf(pc); index && !(flags[*index] & REACHED);
+         index = indexOf(pc)) {
+      flags[*index] |= REACHED;
+      riscv::Instruction inst = decodeAt(*index);
+      if (!inst.isValid()) {
+        flags[*index] |= INVALID;
+        break;
+      }
+      if (lifter.isTerminator(inst)) {
+        for (const auto &successor : successorsOf(inst)) {
+          addLeader(successor.address);
+          if (successor.kind == EdgeKind::Call && indexOf(successor.address)) {
+            functionEntries.emplace(
+                successor.address,
+                std::make_pair(hexAddress(successor.address), 0));
+          }
+        }
+        break;
+      }
+      pc += INSTRUCTION_SIZE;
+    }
+  }
+
+  // Split the scanned code at every leader. Successor addresses are
+  // resolved to block indices once all blocks exist.
+  std::vector<Successor> pendingEdges;
+  for (size_t index = 0; index < wordCount; ++index) {
+    if (!(flags[index] & LEADER) || (flags[index] & INVALID)) {
+      continue;
+    }
+
+    CFGBlock block{textBaseAddress + index * INSTRUCTION_SIZE, 0,
+                   static_cast<uint32_t>(pendingEdges.size()), 0, false};
+    size_t current = index;
+    while (true) {
+      riscv::Instruction inst = decodeAt(current);
+      ++block.instructionCount;
+      size_t next = current + 1;
+      if (lifter.isTerminator(inst)) {
+        for (const auto &successor : successorsOf(inst)) {
+          pendingEdges.push_back(successor);
+        }
+        block.indirectExit =
+            inst.opcode == riscv::Instruction::Opcode::JALR;
+        break;
+      }
+      if (next >= wordCount || (flags[next] & INVALID)) {
+        break;
+      }
+      if (flags[next] & LEADER) {
+        pendingEdges.push_back(
+            {textBaseAddress + next * INSTRUCTION_SIZE, EdgeKind::FallThrough});
+        break;
+      }
+      current = next;
+    }
+
+    block.edgeCount =
+        static_cast<uint32_t>(pendingEdges.size()) - block.firstEdge;
+    instructionCount += block.instructionCount;
+    blocks.push_back(block);
+  }
+
+  // Successors that didn't become blocks (undecodable or outside the text
+  // section) are dropped
+  for (auto &block : blocks) {
+    uint32_t firstEdge = static_cast<uint32_t>(edges.size());
+    for (uint32_t i = 0; i < block.edgeCount; ++i) {
+      const Successor &successor = pendingEdges[block.firstEdge + i];
+      if (auto target = findBlock(successor.address)) {
+        edges.push_back({static_cast<uint32_t>(*target), successor.kind});
+      }
+    }
+    block.firstEdge = firstEdge;
+    block.edgeCount = static_cast<uint32_t>(edges.size()) - firstEdge;
+  }
+
+  // Functions without a symbol size extend to the next function
+  for (auto it = functionEntries.begin(); it != functionEntries.end(); ++it) {
+    auto next = std::next(it);
+    uint64_t end = next != functionEntries.end() ? next->first : textEnd;
+    if (it->second.second > 0) {
+      end = std::min(it->first + it->second.second, textEnd);
+    }
+
+    auto first = std::lower_bound(
+        blocks.begin(), blocks.end(), it->first,
+        [](const CFGBlock &block, uint64_t pc) { return block.address < pc; });
+    auto last = std::lower_bound(
+        first, blocks.end(), end,
+        [](const CFGBlock &block, uint64_t pc) { return block.address < pc; });
+    functions.push_back({it->second.first, it->first, end,
+                         static_cast<uint32_t>(first - blocks.begin()),
+                         static_cast<uint32_t>(last - first)});
+  }
+}
+
+std::optional<size_t> ControlFlowGraph::findBlock(uint64_t pc) const {
+  auto it = std::lower_bound(
+      blocks.begin(), blocks.end(), pc,
+      [](const CFGBlock &block, uint64_t pc) { return block.address < pc; });
+  if (it == blocks.end() || it->address != pc) {
+    return std::nullopt;
+  }
+  return static_cast<size_t>(it - blocks.begin());
+}
+
+std::vector<uint64_t> ControlFlowGraph::getSuccessors(uint64_t pc) const {
+  std::vector<uint64_t> successors;
+  if (auto index = findBlock(pc)) {
+    const CFGBlock &block = blocks[*index];
+    for (uint32_t i = 0; i < block.edgeCount; ++i) {
+      successors.push_back(blocks[edges[block.firstEdge + i].target].address);
+    }
+  }
+  return successors;
+}
+
+void ControlFlowGraph::dump(std::ostream &os) const {
+  os << "Control flow graph: " << functions.size() << " functions, "
+     << blocks.size() << " blocks, " << edges.size() << " edges, "
+     << instructionCount << " instructions" << std::endl;
+
+  for (const auto &function : functions) {
+    os << "function " << function.name << " [" << hexAddress(function.address)
+       << ", " << hexAddress(function.end) << "), " << function.blockCount
+       << " blocks" << std::endl;
+
+    for (uint32_t i = 0; i < function.blockCount; ++i) {
+      const CFGBlock &block = blocks[function.firstBlock + i];
+      os << "  " << hexAddress(block.address) << ": "
+         << block.instructionCount << " instructions ->";
+      for (uint32_t e = 0; e < block.edgeCount; ++e) {
+        const CFGEdge &edge = edges[block.firstEdge + e];
+        os << " " << hexAddress(blocks[edge.target].address) << " ("
+           << edgeKindName(edge.kind) << ")";
+      }
+      if (block.indirectExit) {
+        os << " indirect";
+      }
+      if (block.edgeCount == 0 && !block.indirectExit) {
+        os << " none";
+      }
+      os << std::endl;
+    }
+  }
+}
+
+} // namespace dinorisc
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "ELFReader.h"
+#include "RISCV/Decoder.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dinorisc {
+
+// How control gets from one block to a successor
+enum class EdgeKind : uint8_t {
+  // Falls off the end of the block or the not taken side of a branch
+  FallThrough,
+  // Taken side of a conditional branch
+  Branch,
+  // Direct jump (JAL x0)
+  Jump,
+  // Direct call; the callee returns to the block's CallReturn successor
+  Call,
+  // Instruction after a direct or indirect call
+  CallReturn,
+};
+
+// Edges are stored by index into the block table
+struct CFGEdge {
+  uint32_t target;
+  EdgeKind kind;
+};
+
+// A basic block found by static analysis. Its successors are the edges
+// [firstEdge, firstEdge + edgeCount).
+struct CFGBlock {
+  uint64_t address;
+  uint32_t instructionCount;
+  uint32_t firstEdge;
+  uint32_t edgeCount;
+  // Whether the block ends in JALR, whose targets aren't known statically
+  bool indirectExit;
+};
+
+// A function's blocks are [firstBlock, firstBlock + blockCount) of the
+// block table, which is sorted by address
+struct CFGFunction {
+  std::string name;
+  uint64_t address;
+  uint64_t end;
+  uint32_t firstBlock;
+  uint32_t blockCount;
+};
+
+// Basic blocks of a whole binary recovered by recursive descent over the
+// text section, starting from the entry point and every function symbol.
+// Direct branches, jumps and calls are followed; the targets of indirect
+// jumps aren't, so code only reached that way is missing. Call targets
+// without a symbol become functions named after their address.
+class ControlFlowGraph {
+public:
+  ControlFlowGraph(const riscv::Decoder &decoder,
+                   const std::vector<uint8_t> &textSection,
+                   uint64_t textBaseAddress, uint64_t entryPoint,
+                   const std::vector<FunctionSymbol> &functionSymbols);
+
+  const std::vector<CFGBlock> &getBlocks() const { return blocks; }
+  const std::vector<CFGEdge> &getEdges() const { return edges; }
+  const std::vector<CFGFunction> &getFunctions() const { return functions; }
+  size_t getInstructionCount() const { return instructionCount; }
+
+  // Index of the block starting at pc
+  std::optional<size_t> findBlock(uint64_t pc) const;
+  bool isLeader(uint64_t pc) const { return findBlock(pc).has_value(); }
+
+  // Guest addresses of a block's successors
+  std::vector<uint64_t> getSuccessors(uint64_t pc) const;
+
+  void dump(std::ostream &os) const;
+
+private:
+  std::vector<CFGBlock> blocks;
+  std::vector<CFGEdge> edges;
+  std::vector<CFGFunction> functions;
+  size_t instructionCount;
+};
+
+} // namespace dinorisc
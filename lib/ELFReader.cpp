@@ -1,4 +1,5 @@
 #include "ELFReader.h"
+#include <algorithm>
 
 namespace dinorisc {
 
@@ -83,4 +84,34 @@ ELFReader::getFunctionAddress(const std::string &functionName) const {
   return std::nullopt;
 }
 
+std::vector<FunctionSymbol> ELFReader::getFunctionSymbols() const {
+  std::vector<FunctionSymbol> functions;
+  for (const auto &sec : reader.sections) {
+    if (sec->get_type() == ELFIO::SHT_SYMTAB ||
+        sec->get_type() == ELFIO::SHT_DYNSYM) {
+      ELFIO::symbol_section_accessor symbols(reader, sec.get());
+
+      for (ELFIO::Elf_Xword i = 0; i < symbols.get_symbols_num(); ++i) {
+        std::string name;
+        ELFIO::Elf64_Addr value;
+        ELFIO::Elf_Xword size;
+        unsigned char bind, type, other;
+        ELFIO::Elf_Half section;
+
+        if (symbols.get_symbol(i, name, value, size, bind, type, section,
+                               other) &&
+            type == ELFIO::STT_FUNC) {
+          functions.push_back({name, value, size});
+        }
+      }
+    }
+  }
+
+  std::sort(functions.begin(), functions.end(),
+            [](const FunctionSymbol &a, const FunctionSymbol &b) {
+              return a.address < b.address;
+            });
+  return functions;
+}
+
 } // namespace dinorisc
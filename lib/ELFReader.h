@@ -14,6 +14,12 @@ struct TextSection {
   std::vector<uint8_t> data;
 };
 
+struct FunctionSymbol {
+  std::string name;
+  uint64_t address;
+  uint64_t size;
+};
+
 class ELFReader {
 public:
   ELFReader();
@@ -27,6 +33,9 @@ public:
   std::optional<uint64_t>
   getFunctionAddress(const std::string &functionName) const;
 
+  // All symbols typed as functions, sorted by address
+  std::vector<FunctionSymbol> getFunctionSymbols() const;
+
 private:
   ELFIO::elfio reader;
   uint64_t entryPoint;
@@ -40,4 +40,10 @@ public:
   using Error::Error;
 };
 
+// The guest ran past its instruction or time limit
+class ExecutionLimitError : public RuntimeError {
+public:
+  using RuntimeError::RuntimeError;
+};
+
 } // namespace dinorisc
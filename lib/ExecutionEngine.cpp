@@ -1,36 +1,161 @@
 #include "ExecutionEngine.h"
+#include "ARM64/Encoder.h"
 #include "Error.h"
-#include <cstring>
-#include <sys/mman.h>
-#include <unistd.h>
+#include <cstddef>
 
 namespace dinorisc {
 
-uint64_t ExecutionEngine::executeBlock(const std::vector<uint8_t> &machineCode,
-                                       GuestState *guestState) {
-  size_t pageSize = getpagesize();
-  size_t allocSize =
-      ((machineCode.size() + pageSize - 1) / pageSize) * pageSize;
-
-  void *memory = mmap(nullptr, allocSize, PROT_READ | PROT_WRITE,
-                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (memory == MAP_FAILED) {
-    throw RuntimeError("ExecutionEngine: mmap failed");
+namespace {
+
+using namespace arm64;
+
+// X19-X28 are callee-saved under AAPCS64 and translated blocks use them
+// freely, so the trampoline saves them once along with X29/X30
+constexpr Register SAVED_REGISTERS[] = {
+    Register::X19, Register::X20, Register::X21, Register::X22,
+    Register::X23, Register::X24, Register::X25, Register::X26,
+    Register::X27, Register::X28, Register::X29, Register::X30};
+constexpr size_t SAVED_COUNT = sizeof(SAVED_REGISTERS) / sizeof(Register);
+constexpr uint64_t SAVE_AREA_SIZE = SAVED_COUNT * 8;
+static_assert(SAVE_AREA_SIZE % 16 == 0, "SP must stay 16-byte aligned");
+
+// GuestState stays pinned in X19 across blocks
+constexpr Register GUEST_STATE = Register::X19;
+
+// uint64_t trampoline(GuestState *state, const void *hostCode)
+//
+//         save X19-X30
+//         mov  x19, x0
+// call:   mov  x0, x19
+//         blr  x1                   ; block returns next PC in X0
+//         cmp  x0, #0
+//         b.eq exit
+//         <x9 = &state->ibtc[(x0 >> 2) % IBTC_SIZE]>
+//         ldr  x10, [x9, #ibtc.guestPC]
+//         cmp  x10, x0
+//         b.ne exit                 ; miss: let C++ translate it
+//         ldr  x1, [x9, #ibtc.hostCode]
+//         b    call
+// exit:   restore X19-X30
+//         ret
+std::vector<Instruction> buildTrampoline() {
+  constexpr int32_t ibtcOffset = offsetof(GuestState, ibtc);
+
+  std::vector<Instruction> insts;
+  auto emit = [&insts](InstructionKind kind) {
+    insts.push_back(Instruction{kind});
+    return insts.size() - 1;
+  };
+  auto branchOffset = [&insts](size_t from, size_t to) {
+    return static_cast<uint64_t>((static_cast<int64_t>(to) -
+                                  static_cast<int64_t>(from)) *
+                                 4);
+  };
+
+  emit(ThreeOperandInst{Opcode::SUB, DataSize::X, Register::XSP,
+                        Register::XSP, Immediate{SAVE_AREA_SIZE}});
+  for (size_t i = 0; i < SAVED_COUNT; ++i) {
+    emit(MemoryInst{Opcode::STR, DataSize::X, SAVED_REGISTERS[i],
+                    Register::XSP, static_cast<int32_t>(i * 8)});
+  }
+  emit(TwoOperandInst{Opcode::MOV, DataSize::X, GUEST_STATE, Register::X0});
+
+  size_t call = emit(
+      TwoOperandInst{Opcode::MOV, DataSize::X, Register::X0, GUEST_STATE});
+  emit(TwoOperandInst{Opcode::BLR, DataSize::X, Register::X1, Register::X1});
+
+  emit(TwoOperandInst{Opcode::CMP, DataSize::X, Register::X0, Immediate{0}});
+  size_t doneBranch = emit(BranchInst{Opcode::B_EQ, 0});
+
+  emit(ThreeOperandInst{Opcode::LSR, DataSize::X, Register::X9, Register::X0,
+                        Immediate{2}});
+  emit(ThreeOperandInst{Opcode::LSL, DataSize::X, Register::X9, Register::X9,
+                        Immediate{64 - GuestState::IBTC_BITS}});
+  emit(ThreeOperandInst{Opcode::LSR, DataSize::X, Register::X9, Register::X9,
+                        Immediate{60 - GuestState::IBTC_BITS}});
+  emit(ThreeOperandInst{Opcode::ADD, DataSize::X, Register::X9, GUEST_STATE,
+                        Register::X9});
+  emit(MemoryInst{Opcode::LDR, DataSize::X, Register::X10, Register::X9,
+                  ibtcOffset});
+  emit(TwoOperandInst{Opcode::CMP, DataSize::X, Register::X10, Register::X0});
+  size_t missBranch = emit(BranchInst{Opcode::B_NE, 0});
+  emit(MemoryInst{
+      Opcode::LDR, DataSize::X, Register::X1, Register::X9,
+      ibtcOffset + static_cast<int32_t>(offsetof(IndirectTarget, hostCode))});
+  size_t loop = emit(BranchInst{Opcode::B, 0});
+  std::get<BranchInst>(insts[loop].kind).target = branchOffset(loop, call);
+
+  size_t exit = insts.size();
+  std::get<BranchInst>(insts[doneBranch].kind).target =
+      branchOffset(doneBranch, exit);
+  std::get<BranchInst>(insts[missBranch].kind).target =
+      branchOffset(missBranch, exit);
+  for (size_t i = 0; i < SAVED_COUNT; ++i) {
+    emit(MemoryInst{Opcode::LDR, DataSize::X, SAVED_REGISTERS[i],
+                    Register::XSP, static_cast<int32_t>(i * 8)});
+  }
+  emit(ThreeOperandInst{Opcode::ADD, DataSize::X, Register::XSP,
+                        Register::XSP, Immediate{SAVE_AREA_SIZE}});
+  emit(TwoOperandInst{Opcode::RET, DataSize::X, Register::X30,
+                      Register::X30});
+
+  return insts;
+}
+
+} // namespace
+
+ExecutionEngine::ExecutionEngine(size_t codeCapacity)
+    : codeArena(codeCapacity), trampoline(nullptr), trampolineEntries(0),
+      persistentCodeEnd(0), codeFlushes(0) {
+  installTrampoline();
+  persistentCodeEnd = codeArena.getUsed();
+}
+
+void ExecutionEngine::installTrampoline() {
+  arm64::Encoder encoder;
+  std::vector<uint8_t> machineCode;
+  for (const auto &inst : buildTrampoline()) {
+    auto encoded = encoder.encodeInstruction(inst);
+    machineCode.insert(machineCode.end(), encoded.begin(), encoded.end());
   }
+  trampoline = installCode(machineCode);
 
-  std::memcpy(memory, machineCode.data(), machineCode.size());
+  // Translations may all come from elsewhere (like an AOT cache) and be
+  // entered without anything else being committed
+  codeArena.commit();
+}
 
-  if (mprotect(memory, allocSize, PROT_READ | PROT_EXEC) != 0) {
-    munmap(memory, allocSize);
-    throw RuntimeError("ExecutionEngine: Failed to set execute permissions");
+const void *
+ExecutionEngine::installCode(const std::vector<uint8_t> &machineCode) {
+  if (machineCode.empty()) {
+    throw RuntimeError("ExecutionEngine: No machine code to install");
   }
+  return codeArena.emit(machineCode.data(), machineCode.size());
+}
 
-  typedef uint64_t (*CompiledBlockFunctionPtr)(GuestState *);
-  auto func = reinterpret_cast<CompiledBlockFunctionPtr>(memory);
-  uint64_t nextPC = func(guestState);
+uint64_t ExecutionEngine::execute(const void *code, GuestState *guestState) {
+  // Newly installed blocks become executable in one batch before we jump
+  codeArena.commit();
+  return enter(code, guestState);
+}
 
-  munmap(memory, allocSize);
-  return nextPC;
+uint64_t ExecutionEngine::enter(const void *code, GuestState *guestState) {
+  trampolineEntries.fetch_add(1, std::memory_order_relaxed);
+
+  typedef uint64_t (*TrampolineFunctionPtr)(GuestState *, const void *);
+  auto func = reinterpret_cast<TrampolineFunctionPtr>(
+      const_cast<void *>(trampoline));
+  return func(guestState, code);
+}
+
+void ExecutionEngine::flushCode() {
+  codeArena.rewind(persistentCodeEnd);
+  ++codeFlushes;
+}
+
+uint64_t ExecutionEngine::executeBlock(const std::vector<uint8_t> &machineCode,
+                                       GuestState *guestState) {
+  return execute(installCode(machineCode), guestState);
 }
 
 } // namespace dinorisc
@@ -1,6 +1,8 @@
 #pragma once
 
+#include "CodeArena.h"
 #include "GuestState.h"
+#include <atomic>
 #include <cstdint>
 #include <vector>
 
@@ -8,8 +10,67 @@ namespace dinorisc {
 
 class ExecutionEngine {
 public:
+  // Whether generated code can run on this host at all
+#if defined(__aarch64__)
+  static constexpr bool HOST_SUPPORTED = true;
+#else
+  static constexpr bool HOST_SUPPORTED = false;
+#endif
+
+  explicit ExecutionEngine(size_t codeCapacity = CodeArena::DEFAULT_CAPACITY);
+
+  // Copy machine code into the code arena. The code stays resident so it can
+  // be called any number of times.
+  const void *installCode(const std::vector<uint8_t> &machineCode);
+
+  // Make all installed code executable
+  void commitCode() { codeArena.commit(); }
+
+  // Commit and run previously installed code through the dispatch
+  // trampoline. Control stays in generated code for as long as each next
+  // guest PC is found in the GuestState indirect branch target cache.
+  // Returns the first next PC that isn't (0 when the guest is done).
+  uint64_t execute(const void *code, GuestState *guestState);
+
+  // Like execute() for code that has already been committed. Safe to call
+  // from several threads at once, each with its own GuestState.
+  uint64_t enter(const void *code, GuestState *guestState);
+
+  // Discard all installed code except the trampoline. Nothing may still
+  // branch to the discarded code once execution resumes.
+  void flushCode();
+
+  // Install and run a single block of machine code
   uint64_t executeBlock(const std::vector<uint8_t> &machineCode,
                         GuestState *guestState);
+
+  CodeArena &getCodeArena() { return codeArena; }
+  const CodeArena &getCodeArena() const { return codeArena; }
+
+  // Number of times the trampoline has been entered from C++
+  uint64_t getTrampolineEntries() const {
+    return trampolineEntries.load(std::memory_order_relaxed);
+  }
+
+  // Bytes of code installed since the last flush
+  size_t getCodeSize() const { return codeArena.getUsed() - persistentCodeEnd; }
+  // Bytes available to code that can be flushed
+  size_t getCodeCapacity() const {
+    return codeArena.getCapacity() - persistentCodeEnd;
+  }
+  uint64_t getCodeFlushes() const { return codeFlushes; }
+
+private:
+  CodeArena codeArena;
+  const void *trampoline;
+  std::atomic<uint64_t> trampolineEntries;
+
+  // End of the code that survives flushes
+  size_t persistentCodeEnd;
+  uint64_t codeFlushes;
+
+  // Assemble the dispatch trampoline into the code arena
+  void installTrampoline();
 };
 
 } // namespace dinorisc
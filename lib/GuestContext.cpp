@@ -0,0 +1,36 @@
+#include "GuestContext.h"
+#include "Error.h"
+#include <cstring>
+#include <sys/mman.h>
+
+namespace dinorisc {
+
+GuestContext::GuestContext(size_t shadowMemorySize)
+    : codeEpoch(0), budgetRemaining(0), budgetGranted(0) {
+  if (shadowMemorySize <= STACK_RESERVE) {
+    throw RuntimeError("Shadow memory too small for the guest stack");
+  }
+
+  void *shadowMem = mmap(nullptr, shadowMemorySize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (shadowMem == MAP_FAILED) {
+    throw RuntimeError("Failed to allocate shadow memory");
+  }
+
+  // The GuestState unmaps it when destroyed
+  state.shadowMemory = shadowMem;
+  state.shadowMemorySize = shadowMemorySize;
+  state.guestMemoryBase = 0x0;
+
+  // Stack grows down from high address within shadow memory
+  state.x[2] = getStackTop();
+}
+
+void GuestContext::reset() {
+  std::memset(state.x, 0, sizeof(state.x));
+  state.x[2] = getStackTop();
+  state.pc = 0;
+  state.exitReason = GuestState::EXIT_NONE;
+}
+
+} // namespace dinorisc
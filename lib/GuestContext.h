@@ -0,0 +1,73 @@
+#pragma once
+
+#include "GuestState.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dinorisc {
+
+// Counters a context collects while it runs; added to the translator's
+// totals whenever a run ends so threads never share a hot cache line
+struct DispatchStatistics {
+  // Blocks entered from the dispatcher with a translation already published
+  uint64_t hits = 0;
+  // Blocks the dispatcher had to interpret or translate
+  uint64_t misses = 0;
+  uint64_t indirectTargetFills = 0;
+  // Returns to the runtime for more instruction budget
+  uint64_t budgetExits = 0;
+};
+
+// Everything one guest instance needs to run: registers, its own shadow
+// memory with the stack at the top, and the caches and tier-up counters
+// translated code reaches through GuestState. Any number of contexts can
+// run against one BinaryTranslator at the same time, one per thread.
+class GuestContext {
+public:
+  static constexpr size_t DEFAULT_SHADOW_MEMORY_SIZE = 8 * 1024 * 1024;
+  static constexpr size_t STACK_RESERVE = 1024;
+
+  explicit GuestContext(size_t shadowMemorySize = DEFAULT_SHADOW_MEMORY_SIZE);
+
+  GuestContext(const GuestContext &) = delete;
+  GuestContext &operator=(const GuestContext &) = delete;
+
+  GuestState &getState() { return state; }
+  const GuestState &getState() const { return state; }
+
+  // Initial stack pointer, just below the top of shadow memory
+  uint64_t getStackTop() const {
+    return state.shadowMemorySize - STACK_RESERVE;
+  }
+
+  const DispatchStatistics &getStatistics() const { return statistics; }
+
+  // Get ready for the next call: registers are zeroed and sp is back at the
+  // stack top. Memory, cached host addresses and tier-up counters are kept,
+  // so this costs the same however much the guest has run.
+  void reset();
+
+private:
+  friend class BinaryTranslator;
+
+  GuestState state;
+
+  // Tier-up counters of baseline blocks; GuestState::blockCounters points
+  // here while the context runs
+  std::vector<uint64_t> blockCounters;
+
+  // Code cache flushes the cached host addresses above are valid for
+  uint64_t codeEpoch;
+
+  // Instruction budget of the current run: what's left of it, including
+  // the slice last put in GuestState::instructionBudget, and that slice
+  uint64_t budgetRemaining;
+  int64_t budgetGranted;
+  std::chrono::steady_clock::time_point deadline;
+
+  DispatchStatistics statistics;
+};
+
+} // namespace dinorisc
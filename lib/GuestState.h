@@ -6,7 +6,43 @@
 
 namespace dinorisc {
 
+// An indirect branch target cache or shadow return stack entry mapping a
+// guest PC to host code that continues execution there
+struct IndirectTarget {
+  uint64_t guestPC;
+  const void *hostCode;
+};
+
 struct GuestState {
+  // Number of indirect branch target cache entries (must be a power of two)
+  static constexpr size_t IBTC_BITS = 8;
+  static constexpr size_t IBTC_SIZE = size_t(1) << IBTC_BITS;
+
+  // Marks an empty entry; guest PCs are always 2-byte aligned
+  static constexpr uint64_t IBTC_EMPTY = ~0ULL;
+
+  // Number of shadow return stack entries (must be a power of two). Deeper
+  // call chains wrap around and mispredict on the way back up.
+  static constexpr size_t RAS_BITS = 6;
+  static constexpr size_t RAS_SIZE = size_t(1) << RAS_BITS;
+
+  // Set in a next PC returned by translated code when it needs the runtime
+  // to act before execution continues at (pc & ~RUNTIME_EXIT_FLAG). Guest
+  // PCs are always even, so the flag can't be confused with a real PC.
+  static constexpr uint64_t RUNTIME_EXIT_FLAG = 1;
+
+  // Why translated code exited to the runtime
+  enum ExitReason : uint64_t {
+    EXIT_NONE = 0,
+    // A tier-0 block's hotness counter reached zero
+    EXIT_TIER_UP = 1,
+    // instructionBudget doesn't cover the next block
+    EXIT_BUDGET = 2,
+  };
+
+  // Instruction budget that never runs out in practice
+  static constexpr int64_t UNLIMITED_BUDGET = INT64_MAX;
+
   // RISC-V 64-bit general-purpose registers (x0-x31)
   uint64_t x[32];
 
@@ -18,9 +54,35 @@ struct GuestState {
   size_t shadowMemorySize;
   uint64_t guestMemoryBase;
 
+  // Probed inline by translated code for JALR targets, indexed by
+  // (pc >> 2) & (IBTC_SIZE - 1). Filled by the dispatcher.
+  IndirectTarget ibtc[IBTC_SIZE];
+
+  // Shadow return stack pushed by translated calls and popped by returns.
+  // Each entry pairs a return address with the caller's continuation exit.
+  // rasTop counts pushes and is reduced modulo RAS_SIZE when indexing.
+  IndirectTarget ras[RAS_SIZE];
+  uint64_t rasTop;
+
+  // Hotness counters of tier-0 blocks, counted down on every block entry
+  uint64_t *blockCounters;
+
+  // Set together with RUNTIME_EXIT_FLAG
+  uint64_t exitReason;
+
+  // Guest instructions left before the runtime has to be asked for more.
+  // Translated code with budget checks charges a whole block or trace on
+  // entry and exits with EXIT_BUDGET instead if it doesn't fit; the
+  // interpreter charges blocks after running them and may go negative.
+  int64_t instructionBudget;
+
   GuestState()
       : x{}, pc(0), shadowMemory(nullptr), shadowMemorySize(0),
-        guestMemoryBase(0) {}
+        guestMemoryBase(0), rasTop(0), blockCounters(nullptr),
+        exitReason(EXIT_NONE), instructionBudget(UNLIMITED_BUDGET) {
+    flushIndirectTargets();
+    flushReturnPredictions();
+  }
 
   ~GuestState() {
     if (shadowMemory) {
@@ -34,6 +96,30 @@ struct GuestState {
       return;
     x[reg] = value;
   }
+
+  static size_t indirectTargetIndex(uint64_t guestPC) {
+    return (guestPC >> 2) & (IBTC_SIZE - 1);
+  }
+
+  // Remember the translation of an indirect branch target
+  void cacheIndirectTarget(uint64_t guestPC, const void *hostCode) {
+    ibtc[indirectTargetIndex(guestPC)] = {guestPC, hostCode};
+  }
+
+  // Forget all indirect branch targets, e.g. when their code is discarded
+  void flushIndirectTargets() {
+    for (auto &entry : ibtc) {
+      entry = {IBTC_EMPTY, nullptr};
+    }
+  }
+
+  // Forget all predicted returns
+  void flushReturnPredictions() {
+    for (auto &entry : ras) {
+      entry = {IBTC_EMPTY, nullptr};
+    }
+    rasTop = 0;
+  }
 };
 
 } // namespace dinorisc
\ No newline at end of file
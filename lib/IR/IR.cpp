@@ -7,9 +7,10 @@ namespace ir {
 std::string Instruction::toString() const {
   std::stringstream ss;
 
-  // Store and RegWrite instructions don't produce values
+  // Store, RegWrite and SideExit instructions don't produce values
   if (!std::holds_alternative<Store>(kind) &&
-      !std::holds_alternative<RegWrite>(kind)) {
+      !std::holds_alternative<RegWrite>(kind) &&
+      !std::holds_alternative<SideExit>(kind)) {
     ss << "%" << valueId << " = ";
   }
 
@@ -37,6 +38,11 @@ std::string Instruction::toString() const {
           ss << "regread x" << inst.regNumber;
         } else if constexpr (std::is_same_v<T, RegWrite>) {
           ss << "regwrite x" << inst.regNumber << ", %" << inst.value;
+        } else if constexpr (std::is_same_v<T, SideExit>) {
+          ss << "sideexit %" << inst.condition << ", bb" << inst.target;
+          for (const auto &write : inst.writes) {
+            ss << ", x" << write.regNumber << " = %" << write.value;
+          }
         }
         return ss.str();
       },
@@ -50,15 +56,21 @@ std::string Terminator::toString() const {
       [&](const auto &term) -> std::string {
         using T = std::decay_t<decltype(term)>;
         if constexpr (std::is_same_v<T, Branch>) {
-          ss << "br bb" << term.targetBlock;
+          ss << (term.link && term.link->isCall ? "call bb" : "br bb")
+             << term.targetBlock;
         } else if constexpr (std::is_same_v<T, CondBranch>) {
           ss << "condbr %" << term.condition << ", bb" << term.trueBlock
              << ", bb" << term.falseBlock;
         } else if constexpr (std::is_same_v<T, Return>) {
+          ss << (term.link && term.link->isCall ? "call" : "ret");
           if (term.value) {
-            ss << "ret %" << *term.value;
-          } else {
-            ss << "ret";
+            ss << " %" << *term.value;
+          }
+        }
+
+        if constexpr (!std::is_same_v<T, CondBranch>) {
+          if (term.link) {
+            ss << ", x" << term.link->regNum << " = %" << term.link->value;
           }
         }
         return ss.str();
@@ -76,6 +88,68 @@ std::string BasicBlock::toString() const {
   return ss.str();
 }
 
+void forEachOperand(Instruction &inst,
+                    const std::function<void(ValueId &)> &callback) {
+  std::visit(
+      [&](auto &kind) {
+        using T = std::decay_t<decltype(kind)>;
+        if constexpr (std::is_same_v<T, BinaryOp>) {
+          callback(kind.lhs);
+          callback(kind.rhs);
+        } else if constexpr (std::is_same_v<T, Sext> ||
+                             std::is_same_v<T, Zext> ||
+                             std::is_same_v<T, Trunc>) {
+          callback(kind.operand);
+        } else if constexpr (std::is_same_v<T, Load>) {
+          callback(kind.address);
+        } else if constexpr (std::is_same_v<T, Store>) {
+          callback(kind.value);
+          callback(kind.address);
+        } else if constexpr (std::is_same_v<T, RegWrite>) {
+          callback(kind.value);
+        } else if constexpr (std::is_same_v<T, SideExit>) {
+          callback(kind.condition);
+          for (auto &write : kind.writes) {
+            callback(write.value);
+          }
+        }
+      },
+      inst.kind);
+}
+
+void forEachOperand(Terminator &term,
+                    const std::function<void(ValueId &)> &callback) {
+  std::visit(
+      [&](auto &kind) {
+        using T = std::decay_t<decltype(kind)>;
+        if constexpr (std::is_same_v<T, CondBranch>) {
+          callback(kind.condition);
+        } else {
+          if constexpr (std::is_same_v<T, Return>) {
+            if (kind.value) {
+              callback(*kind.value);
+            }
+          }
+          if (kind.link) {
+            callback(kind.link->value);
+          }
+        }
+      },
+      term.kind);
+}
+
+void forEachOperand(const Instruction &inst,
+                    const std::function<void(ValueId)> &callback) {
+  forEachOperand(const_cast<Instruction &>(inst),
+                 [&](ValueId &value) { callback(value); });
+}
+
+void forEachOperand(const Terminator &term,
+                    const std::function<void(ValueId)> &callback) {
+  forEachOperand(const_cast<Terminator &>(term),
+                 [&](ValueId &value) { callback(value); });
+}
+
 std::string binaryOpcodeToString(BinaryOpcode op) {
   switch (op) {
   case BinaryOpcode::Add:
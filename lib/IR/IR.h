@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <optional>
 #include <string>
 #include <variant>
@@ -90,8 +91,19 @@ struct RegWrite {
   ValueId value;
 };
 
+// Leaves a trace early when condition is true, writing back the guest
+// registers modified so far and continuing at target. skippedInstructions
+// counts the guest instructions of the trace after it, which were charged
+// to the instruction budget on entry but don't run when it is taken.
+struct SideExit {
+  ValueId condition;
+  uint64_t target;
+  std::vector<RegWrite> writes;
+  uint64_t skippedInstructions = 0;
+};
+
 using InstructionKind = std::variant<Const, BinaryOp, Sext, Zext, Trunc, Load,
-                                     Store, RegRead, RegWrite>;
+                                     Store, RegRead, RegWrite, SideExit>;
 
 struct Instruction {
   ValueId valueId;
@@ -100,8 +112,18 @@ struct Instruction {
   std::string toString() const;
 };
 
+// Link register write of a jump-and-link, performed as part of the jump
+struct Link {
+  uint32_t regNum;
+  ValueId value;
+  uint64_t returnAddress;
+  // Whether this is a call whose matching return should be predicted
+  bool isCall;
+};
+
 struct Branch {
   uint64_t targetBlock;
+  std::optional<Link> link = std::nullopt;
 };
 
 struct CondBranch {
@@ -112,6 +134,9 @@ struct CondBranch {
 
 struct Return {
   std::optional<ValueId> value;
+  std::optional<Link> link = std::nullopt;
+  // Whether this returns from a function, i.e. pops a predicted return
+  bool isFunctionReturn = false;
 };
 
 using TerminatorKind = std::variant<Branch, CondBranch, Return>;
@@ -129,6 +154,17 @@ struct BasicBlock {
   std::string toString() const;
 };
 
+// Call callback on every value an instruction or terminator uses. The
+// values are passed by reference so passes can rewrite them.
+void forEachOperand(Instruction &inst,
+                    const std::function<void(ValueId &)> &callback);
+void forEachOperand(Terminator &term,
+                    const std::function<void(ValueId &)> &callback);
+void forEachOperand(const Instruction &inst,
+                    const std::function<void(ValueId)> &callback);
+void forEachOperand(const Terminator &term,
+                    const std::function<void(ValueId)> &callback);
+
 std::string binaryOpcodeToString(BinaryOpcode op);
 std::string typeToString(Type type);
 
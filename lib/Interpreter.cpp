@@ -0,0 +1,440 @@
+#include "Interpreter.h"
+#include "Error.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace dinorisc {
+
+namespace {
+
+// Guest opcodes with a handler of the same name in the dispatch loop
+#define DINORISC_INTERPRETED_OPCODES(X)                                        \
+  X(ADD) X(ADDI) X(ADDW) X(ADDIW) X(SUB) X(SUBW) X(AND) X(ANDI) X(OR) X(ORI)   \
+  X(XOR) X(XORI) X(SLL) X(SLLI) X(SLLW) X(SLLIW) X(SRL) X(SRLI) X(SRLW)        \
+  X(SRLIW) X(SRA) X(SRAI) X(SRAW) X(SRAIW) X(SLT) X(SLTI) X(SLTU) X(SLTIU)     \
+  X(LB) X(LH) X(LW) X(LD) X(LBU) X(LHU) X(LWU) X(SB) X(SH) X(SW) X(SD)         \
+  X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) X(JAL) X(JALR) X(LUI) X(AUIPC)   \
+  X(ECALL) X(EBREAK)
+
+enum class Handler : uint8_t {
+#define DINORISC_HANDLER_ENUM(name) name,
+  DINORISC_INTERPRETED_OPCODES(DINORISC_HANDLER_ENUM)
+#undef DINORISC_HANDLER_ENUM
+  // An instruction whose only effect is writing x0
+  NOP,
+  // A word that didn't decode
+  INVALID,
+  // Execution ran past the end of the text section
+  END,
+};
+
+bool isLoad(riscv::Instruction::Opcode opcode) {
+  switch (opcode) {
+  case riscv::Instruction::Opcode::LB:
+  case riscv::Instruction::Opcode::LH:
+  case riscv::Instruction::Opcode::LW:
+  case riscv::Instruction::Opcode::LD:
+  case riscv::Instruction::Opcode::LBU:
+  case riscv::Instruction::Opcode::LHU:
+  case riscv::Instruction::Opcode::LWU:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isStoreOrBranch(riscv::Instruction::Opcode opcode) {
+  switch (opcode) {
+  case riscv::Instruction::Opcode::SB:
+  case riscv::Instruction::Opcode::SH:
+  case riscv::Instruction::Opcode::SW:
+  case riscv::Instruction::Opcode::SD:
+  case riscv::Instruction::Opcode::BEQ:
+  case riscv::Instruction::Opcode::BNE:
+  case riscv::Instruction::Opcode::BLT:
+  case riscv::Instruction::Opcode::BGE:
+  case riscv::Instruction::Opcode::BLTU:
+  case riscv::Instruction::Opcode::BGEU:
+    return true;
+  default:
+    return false;
+  }
+}
+
+uint64_t signExtend32(uint64_t value) {
+  return static_cast<uint64_t>(
+      static_cast<int64_t>(static_cast<int32_t>(value)));
+}
+
+std::string hexAddress(uint64_t address) {
+  std::ostringstream oss;
+  oss << "0x" << std::hex << address;
+  return oss.str();
+}
+
+} // namespace
+
+Interpreter::Interpreter(const riscv::Decoder &decoder,
+                         const std::vector<uint8_t> &textSection,
+                         uint64_t textBaseAddress)
+    : textBaseAddress(textBaseAddress), instructionsExecuted(0),
+      blocksExecuted(0) {
+  static_assert(sizeof(Operation) == 8, "operations should stay compact");
+
+  size_t wordCount = textSection.size() / 4;
+  operations.reserve(wordCount + 1);
+  for (size_t i = 0; i < wordCount; ++i) {
+    uint64_t pc = textBaseAddress + i * 4;
+    Operation op{static_cast<uint8_t>(Handler::INVALID), 0, 0, 0, 0};
+    try {
+      riscv::Instruction inst = decoder.decode(textSection.data(), i * 4, pc);
+      if (inst.isValid()) {
+        op = compile(inst);
+      }
+    } catch (const DecodingError &) {
+      // Data in the text section; only an error if it's executed
+    }
+    operations.push_back(op);
+  }
+  operations.push_back({static_cast<uint8_t>(Handler::END), 0, 0, 0, 0});
+}
+
+Interpreter::Operation Interpreter::compile(const riscv::Instruction &inst) {
+  Operation op{0, 0, 0, 0, 0};
+
+  switch (inst.opcode) {
+#define DINORISC_HANDLER_CASE(name)                                            \
+  case riscv::Instruction::Opcode::name:                                       \
+    op.handler = static_cast<uint8_t>(Handler::name);                          \
+    break;
+    DINORISC_INTERPRETED_OPCODES(DINORISC_HANDLER_CASE)
+#undef DINORISC_HANDLER_CASE
+  default:
+    op.handler = static_cast<uint8_t>(Handler::INVALID);
+    return op;
+  }
+
+  // Registers are listed destination first, except for stores and branches
+  // which have no destination
+  bool hasDestination = !isStoreOrBranch(inst.opcode);
+  uint8_t *registerFields[] = {&op.rd, &op.rs1, &op.rs2};
+  size_t nextField = hasDestination ? 0 : 1;
+  for (const auto &operand : inst.operands) {
+    if (auto *reg = std::get_if<riscv::Instruction::Register>(&operand)) {
+      *registerFields[nextField++] = static_cast<uint8_t>(reg->value);
+    } else {
+      op.imm = static_cast<int32_t>(
+          std::get<riscv::Instruction::Immediate>(operand).value);
+    }
+  }
+
+  // x0 is hardwired to zero, so instructions that only write it do nothing.
+  // Jumps still have to transfer control and loads still fault on a bad
+  // address, like they do in translated code.
+  if (hasDestination && !inst.operands.empty() && op.rd == 0 &&
+      inst.opcode != riscv::Instruction::Opcode::JAL &&
+      inst.opcode != riscv::Instruction::Opcode::JALR &&
+      !isLoad(inst.opcode)) {
+    op.handler = static_cast<uint8_t>(Handler::NOP);
+  }
+
+  return op;
+}
+
+uint64_t Interpreter::run(GuestState &state, uint64_t pc,
+                          uint64_t maxBlocks) {
+  // Indexed by Handler
+  static const void *const dispatchTable[] = {
+#define DINORISC_HANDLER_LABEL(name) &&handle_##name,
+      DINORISC_INTERPRETED_OPCODES(DINORISC_HANDLER_LABEL)
+#undef DINORISC_HANDLER_LABEL
+      &&handle_NOP, &&handle_INVALID, &&handle_END};
+
+  uint64_t *x = state.x;
+  const Operation *op = fetch(pc);
+  uint64_t instructions = 0;
+  uint64_t blocks = 0;
+
+  // Checked once per block; the block that runs past the budget finishes
+  uint64_t budget = static_cast<uint64_t>(std::max<int64_t>(
+      state.instructionBudget, 0));
+
+  // Threaded dispatch: every handler jumps straight to the handler of the
+  // next operation instead of returning to a central switch
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    ++instructions;                                                            \
+    goto *dispatchTable[op->handler];                                          \
+  } while (0)
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++op;                                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+#define JUMP(target)                                                           \
+  do {                                                                         \
+    pc = (target);                                                             \
+    goto transfer;                                                             \
+  } while (0)
+#define BRANCH(condition)                                                      \
+  JUMP((condition) ? addressOf(op) + op->imm : addressOf(op) + 4)
+#define LOAD(type)                                                             \
+  [&] {                                                                        \
+    type value;                                                                \
+    std::memcpy(&value,                                                        \
+                translateAddress(state, x[op->rs1] + op->imm, sizeof(type)),   \
+                sizeof(type));                                                 \
+    return value;                                                              \
+  }()
+// Loads may target x0, which has to read as zero again afterwards
+#define LOAD_NEXT()                                                            \
+  do {                                                                         \
+    x[0] = 0;                                                                  \
+    NEXT();                                                                    \
+  } while (0)
+#define STORE(type)                                                            \
+  do {                                                                         \
+    type value = static_cast<type>(x[op->rs2]);                                \
+    std::memcpy(translateAddress(state, x[op->rs1] + op->imm, sizeof(type)),   \
+                &value, sizeof(type));                                         \
+  } while (0)
+
+  DISPATCH();
+
+  // Arithmetic and logic
+handle_ADD:
+  x[op->rd] = x[op->rs1] + x[op->rs2];
+  NEXT();
+handle_ADDI:
+  x[op->rd] = x[op->rs1] + op->imm;
+  NEXT();
+handle_ADDW:
+  x[op->rd] = signExtend32(x[op->rs1] + x[op->rs2]);
+  NEXT();
+handle_ADDIW:
+  x[op->rd] = signExtend32(x[op->rs1] + op->imm);
+  NEXT();
+handle_SUB:
+  x[op->rd] = x[op->rs1] - x[op->rs2];
+  NEXT();
+handle_SUBW:
+  x[op->rd] = signExtend32(x[op->rs1] - x[op->rs2]);
+  NEXT();
+handle_AND:
+  x[op->rd] = x[op->rs1] & x[op->rs2];
+  NEXT();
+handle_ANDI:
+  x[op->rd] = x[op->rs1] & static_cast<uint64_t>(int64_t{op->imm});
+  NEXT();
+handle_OR:
+  x[op->rd] = x[op->rs1] | x[op->rs2];
+  NEXT();
+handle_ORI:
+  x[op->rd] = x[op->rs1] | static_cast<uint64_t>(int64_t{op->imm});
+  NEXT();
+handle_XOR:
+  x[op->rd] = x[op->rs1] ^ x[op->rs2];
+  NEXT();
+handle_XORI:
+  x[op->rd] = x[op->rs1] ^ static_cast<uint64_t>(int64_t{op->imm});
+  NEXT();
+
+  // Shifts use the low 6 bits of the amount (5 for word operations). The
+  // decoded SRAI/SRAIW immediates still carry the funct7 bit, which the
+  // mask drops.
+handle_SLL:
+  x[op->rd] = x[op->rs1] << (x[op->rs2] & 63);
+  NEXT();
+handle_SLLI:
+  x[op->rd] = x[op->rs1] << (op->imm & 63);
+  NEXT();
+handle_SLLW:
+  x[op->rd] = signExtend32(x[op->rs1] << (x[op->rs2] & 31));
+  NEXT();
+handle_SLLIW:
+  x[op->rd] = signExtend32(x[op->rs1] << (op->imm & 31));
+  NEXT();
+handle_SRL:
+  x[op->rd] = x[op->rs1] >> (x[op->rs2] & 63);
+  NEXT();
+handle_SRLI:
+  x[op->rd] = x[op->rs1] >> (op->imm & 63);
+  NEXT();
+handle_SRLW:
+  x[op->rd] = signExtend32(static_cast<uint32_t>(x[op->rs1]) >>
+                           (x[op->rs2] & 31));
+  NEXT();
+handle_SRLIW:
+  x[op->rd] =
+      signExtend32(static_cast<uint32_t>(x[op->rs1]) >> (op->imm & 31));
+  NEXT();
+handle_SRA:
+  x[op->rd] = static_cast<uint64_t>(static_cast<int64_t>(x[op->rs1]) >>
+                                    (x[op->rs2] & 63));
+  NEXT();
+handle_SRAI:
+  x[op->rd] = static_cast<uint64_t>(static_cast<int64_t>(x[op->rs1]) >>
+                                    (op->imm & 63));
+  NEXT();
+handle_SRAW:
+  x[op->rd] = signExtend32(static_cast<uint64_t>(
+      static_cast<int32_t>(x[op->rs1]) >> (x[op->rs2] & 31)));
+  NEXT();
+handle_SRAIW:
+  x[op->rd] = signExtend32(static_cast<uint64_t>(
+      static_cast<int32_t>(x[op->rs1]) >> (op->imm & 31)));
+  NEXT();
+
+  // Comparisons
+handle_SLT:
+  x[op->rd] =
+      static_cast<int64_t>(x[op->rs1]) < static_cast<int64_t>(x[op->rs2]);
+  NEXT();
+handle_SLTI:
+  x[op->rd] = static_cast<int64_t>(x[op->rs1]) < op->imm;
+  NEXT();
+handle_SLTU:
+  x[op->rd] = x[op->rs1] < x[op->rs2];
+  NEXT();
+handle_SLTIU:
+  x[op->rd] = x[op->rs1] < static_cast<uint64_t>(int64_t{op->imm});
+  NEXT();
+
+  // Loads and stores
+handle_LB:
+  x[op->rd] = static_cast<uint64_t>(int64_t{LOAD(int8_t)});
+  LOAD_NEXT();
+handle_LH:
+  x[op->rd] = static_cast<uint64_t>(int64_t{LOAD(int16_t)});
+  LOAD_NEXT();
+handle_LW:
+  x[op->rd] = static_cast<uint64_t>(int64_t{LOAD(int32_t)});
+  LOAD_NEXT();
+handle_LD:
+  x[op->rd] = LOAD(uint64_t);
+  LOAD_NEXT();
+handle_LBU:
+  x[op->rd] = LOAD(uint8_t);
+  LOAD_NEXT();
+handle_LHU:
+  x[op->rd] = LOAD(uint16_t);
+  LOAD_NEXT();
+handle_LWU:
+  x[op->rd] = LOAD(uint32_t);
+  LOAD_NEXT();
+handle_SB:
+  STORE(uint8_t);
+  NEXT();
+handle_SH:
+  STORE(uint16_t);
+  NEXT();
+handle_SW:
+  STORE(uint32_t);
+  NEXT();
+handle_SD:
+  STORE(uint64_t);
+  NEXT();
+
+  // Control transfers. Not taken branches end a block too.
+handle_BEQ:
+  BRANCH(x[op->rs1] == x[op->rs2]);
+handle_BNE:
+  BRANCH(x[op->rs1] != x[op->rs2]);
+handle_BLT:
+  BRANCH(static_cast<int64_t>(x[op->rs1]) <
+         static_cast<int64_t>(x[op->rs2]));
+handle_BGE:
+  BRANCH(static_cast<int64_t>(x[op->rs1]) >=
+         static_cast<int64_t>(x[op->rs2]));
+handle_BLTU:
+  BRANCH(x[op->rs1] < x[op->rs2]);
+handle_BGEU:
+  BRANCH(x[op->rs1] >= x[op->rs2]);
+handle_JAL: {
+  uint64_t address = addressOf(op);
+  if (op->rd != 0) {
+    x[op->rd] = address + 4;
+  }
+  JUMP(address + op->imm);
+}
+handle_JALR: {
+  // Read rs1 before writing the link register, which may be the same
+  uint64_t target = (x[op->rs1] + op->imm) & ~uint64_t{1};
+  if (op->rd != 0) {
+    x[op->rd] = addressOf(op) + 4;
+  }
+  JUMP(target);
+}
+
+  // Upper immediates (the decoder has already shifted them into place)
+handle_LUI:
+  x[op->rd] = static_cast<uint64_t>(int64_t{op->imm});
+  NEXT();
+handle_AUIPC:
+  x[op->rd] = addressOf(op) + op->imm;
+  NEXT();
+
+handle_NOP:
+  NEXT();
+
+handle_ECALL:
+handle_EBREAK:
+  throw UnsupportedInstructionError("Unsupported RISC-V instruction at PC=" +
+                                    hexAddress(addressOf(op)));
+handle_INVALID:
+  throw DecodingError("Invalid instruction at PC=" +
+                      hexAddress(addressOf(op)));
+handle_END:
+  throw RuntimeError("PC out of bounds: " + hexAddress(addressOf(op)));
+
+transfer:
+  ++blocks;
+  if (pc == 0 || blocks == maxBlocks || instructions > budget) {
+    instructionsExecuted.fetch_add(instructions, std::memory_order_relaxed);
+    blocksExecuted.fetch_add(blocks, std::memory_order_relaxed);
+    state.instructionBudget -= static_cast<int64_t>(instructions);
+    if (instructions > budget) {
+      state.exitReason = GuestState::EXIT_BUDGET;
+      return pc | GuestState::RUNTIME_EXIT_FLAG;
+    }
+    return pc;
+  }
+  op = fetch(pc);
+  DISPATCH();
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BRANCH
+#undef LOAD
+#undef LOAD_NEXT
+#undef STORE
+}
+
+const Interpreter::Operation *Interpreter::fetch(uint64_t pc) const {
+  // The sentinel isn't a valid target
+  uint64_t offset = pc - textBaseAddress;
+  if (pc < textBaseAddress || (offset & 3) != 0 ||
+      offset / 4 >= operations.size() - 1) {
+    throw RuntimeError("PC out of bounds: " + hexAddress(pc));
+  }
+  return &operations[offset / 4];
+}
+
+uint64_t Interpreter::addressOf(const Operation *op) const {
+  return textBaseAddress + static_cast<uint64_t>(op - operations.data()) * 4;
+}
+
+void *Interpreter::translateAddress(const GuestState &state, uint64_t address,
+                                    size_t size) {
+  uint64_t offset = address - state.guestMemoryBase;
+  if (address < state.guestMemoryBase || offset > state.shadowMemorySize ||
+      size > state.shadowMemorySize - offset) {
+    throw RuntimeError("Guest memory access out of bounds: " +
+                       hexAddress(address));
+  }
+  return static_cast<uint8_t *>(state.shadowMemory) + offset;
+}
+
+} // namespace dinorisc
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "GuestState.h"
+#include "RISCV/Decoder.h"
+#include "RISCV/Instruction.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dinorisc {
+
+// Executes guest code directly from a pre-decoded copy of the text section,
+// without translating it. Works on any host and operates on the same
+// GuestState registers and shadow memory as translated code, so execution
+// can move between the two at any block boundary.
+class Interpreter {
+public:
+  // Decodes the whole text section up front. Words that don't decode only
+  // raise an error if they are executed.
+  Interpreter(const riscv::Decoder &decoder,
+              const std::vector<uint8_t> &textSection,
+              uint64_t textBaseAddress);
+
+  // Interpret from pc until maxBlocks control transfers have executed
+  // (0 = no limit) or the guest jumps to address 0. Returns the next PC.
+  // Executed instructions are charged to state.instructionBudget; once it
+  // is used up, the next PC is returned with RUNTIME_EXIT_FLAG and
+  // EXIT_BUDGET. Several threads may run different GuestStates at once.
+  uint64_t run(GuestState &state, uint64_t pc, uint64_t maxBlocks);
+
+  size_t getDecodedInstructions() const { return operations.size() - 1; }
+  uint64_t getInstructionsExecuted() const {
+    return instructionsExecuted.load(std::memory_order_relaxed);
+  }
+  uint64_t getBlocksExecuted() const {
+    return blocksExecuted.load(std::memory_order_relaxed);
+  }
+
+private:
+  // A decoded instruction in the compact form the dispatch loop reads.
+  // Immediates of RV64I instructions fit in 32 bits.
+  struct Operation {
+    uint8_t handler;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int32_t imm;
+  };
+
+  // One operation per text word, followed by a sentinel for running off the
+  // end of the section
+  std::vector<Operation> operations;
+  uint64_t textBaseAddress;
+  std::atomic<uint64_t> instructionsExecuted;
+  std::atomic<uint64_t> blocksExecuted;
+
+  static Operation compile(const riscv::Instruction &inst);
+  const Operation *fetch(uint64_t pc) const;
+  uint64_t addressOf(const Operation *op) const;
+  static void *translateAddress(const GuestState &state, uint64_t address,
+                                size_t size);
+};
+
+} // namespace dinorisc
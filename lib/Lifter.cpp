@@ -6,12 +6,63 @@ namespace {
 constexpr uint32_t REG_ZERO = 0;
 constexpr uint32_t REG_RA = 1;
 constexpr uint64_t JALR_ALIGN_MASK = ~1ULL;
+
+// Comparison performed by a conditional branch
+std::optional<ir::BinaryOpcode>
+branchComparison(riscv::Instruction::Opcode op) {
+  switch (op) {
+  case riscv::Instruction::Opcode::BEQ:
+    return ir::BinaryOpcode::Eq;
+  case riscv::Instruction::Opcode::BNE:
+    return ir::BinaryOpcode::Ne;
+  case riscv::Instruction::Opcode::BLT:
+    return ir::BinaryOpcode::Lt;
+  case riscv::Instruction::Opcode::BGE:
+    return ir::BinaryOpcode::Ge;
+  case riscv::Instruction::Opcode::BLTU:
+    return ir::BinaryOpcode::LtU;
+  case riscv::Instruction::Opcode::BGEU:
+    return ir::BinaryOpcode::GeU;
+  default:
+    return std::nullopt;
+  }
+}
+
+ir::BinaryOpcode invertComparison(ir::BinaryOpcode op) {
+  switch (op) {
+  case ir::BinaryOpcode::Eq:
+    return ir::BinaryOpcode::Ne;
+  case ir::BinaryOpcode::Ne:
+    return ir::BinaryOpcode::Eq;
+  case ir::BinaryOpcode::Lt:
+    return ir::BinaryOpcode::Ge;
+  case ir::BinaryOpcode::Ge:
+    return ir::BinaryOpcode::Lt;
+  case ir::BinaryOpcode::LtU:
+    return ir::BinaryOpcode::GeU;
+  case ir::BinaryOpcode::GeU:
+    return ir::BinaryOpcode::LtU;
+  default:
+    return op;
+  }
+}
 } // namespace
 
 Lifter::Lifter() : nextValueId(1) {}
 
 ir::BasicBlock
 Lifter::liftBasicBlock(const std::vector<riscv::Instruction> &instructions) {
+  return liftInstructions(instructions, false);
+}
+
+ir::BasicBlock
+Lifter::liftTrace(const std::vector<riscv::Instruction> &instructions) {
+  return liftInstructions(instructions, true);
+}
+
+ir::BasicBlock
+Lifter::liftInstructions(const std::vector<riscv::Instruction> &instructions,
+                         bool followTrace) {
   currentInstructions.clear();
   cachedRegisterValues.clear();
   modifiedRegisters.clear();
@@ -21,7 +72,10 @@ Lifter::liftBasicBlock(const std::vector<riscv::Instruction> &instructions) {
   for (size_t i = 0; i < instructions.size(); ++i) {
     const auto &inst = instructions[i];
 
-    if (isTerminator(inst)) {
+    if (isTerminator(inst) && followTrace && i + 1 < instructions.size()) {
+      liftTraceTransfer(inst, instructions[i + 1].address,
+                        instructions.size() - i - 1);
+    } else if (isTerminator(inst)) {
       finalizeRegisterWrites();
 
       uint64_t fallThroughAddress = (i + 1 < instructions.size())
@@ -337,20 +391,12 @@ ir::Terminator Lifter::liftTerminator(const riscv::Instruction &inst,
   // Unconditional jumps
   case riscv::Instruction::Opcode::JAL: {
     // JAL rd, imm: rd = pc + 4, pc = pc + imm
-    ir::ValueId returnAddr = createConstant(ir::Type::i64, inst.address + 4);
-    setRegisterValue(inst.getRegister(0), returnAddr);
     uint64_t target = inst.address + inst.getImmediate(1);
-    return ir::Terminator{ir::Branch{target}};
+    return ir::Terminator{ir::Branch{target, createLink(inst)}};
   }
   case riscv::Instruction::Opcode::JALR: {
     // JALR rd, rs1, imm: rd = pc + 4, pc = (rs1 + imm) & ~1
 
-    // Check if this is a RET instruction (jalr x0, x1, 0)
-    if (inst.getRegister(0) == REG_ZERO && inst.getRegister(1) == REG_RA &&
-        inst.getImmediate(2) == 0) {
-      return ir::Terminator{ir::Return{}};
-    }
-
     // Calculate the target address: (rs1 + imm) & ~1
     ir::ValueId rs1Value = getRegisterValue(inst.getRegister(1));
     ir::ValueId immValue = createConstant(ir::Type::i64, inst.getImmediate(2));
@@ -362,13 +408,14 @@ ir::Terminator Lifter::liftTerminator(const riscv::Instruction &inst,
     ir::ValueId alignedTarget =
         createBinaryOp(ir::BinaryOpcode::And, ir::Type::i64, targetAddr, mask);
 
-    // Now write the return address to the destination register (if rd != x0)
-    if (inst.getRegister(0) != REG_ZERO) {
-      ir::ValueId returnAddr = createConstant(ir::Type::i64, inst.address + 4);
-      setRegisterValue(inst.getRegister(0), returnAddr);
-    }
+    // RET (jalr x0, x1, 0) pops the return address predicted by its call
+    bool isFunctionReturn = inst.getRegister(0) == REG_ZERO &&
+                            inst.getRegister(1) == REG_RA &&
+                            inst.getImmediate(2) == 0;
 
-    return ir::Terminator{ir::Return{alignedTarget}};
+    // The return address is written after rs1 has been read
+    return ir::Terminator{
+        ir::Return{alignedTarget, createLink(inst), isFunctionReturn}};
   }
 
   default:
@@ -377,6 +424,19 @@ ir::Terminator Lifter::liftTerminator(const riscv::Instruction &inst,
   }
 }
 
+std::optional<ir::Link> Lifter::createLink(const riscv::Instruction &inst) {
+  uint32_t rd = inst.getRegister(0);
+  if (rd == REG_ZERO) {
+    return std::nullopt;
+  }
+
+  // Register writes have already been finalized, so the jump itself
+  // performs the link register write
+  uint64_t returnAddress = inst.address + 4;
+  ir::ValueId returnAddr = createConstant(ir::Type::i64, returnAddress);
+  return ir::Link{rd, returnAddr, returnAddress, rd == REG_RA};
+}
+
 ir::Terminator Lifter::createConditionalBranch(ir::BinaryOpcode compareOp,
                                                const riscv::Instruction &inst,
                                                uint64_t fallThroughAddress) {
@@ -387,6 +447,51 @@ ir::Terminator Lifter::createConditionalBranch(ir::BinaryOpcode compareOp,
   return ir::Terminator{ir::CondBranch{condition, target, fallThroughAddress}};
 }
 
+void Lifter::liftTraceTransfer(const riscv::Instruction &inst,
+                               uint64_t nextAddress,
+                               uint64_t remainingInstructions) {
+  if (inst.opcode == riscv::Instruction::Opcode::JAL &&
+      inst.getRegister(0) == REG_ZERO &&
+      inst.address + inst.getImmediate(1) == nextAddress) {
+    // The jump is implied by the trace
+    return;
+  }
+
+  auto compareOp = branchComparison(inst.opcode);
+  if (compareOp) {
+    uint64_t taken = inst.address + inst.getImmediate(2);
+    uint64_t fallThrough = inst.address + 4;
+
+    // Leave the trace on the side of the branch it doesn't follow
+    uint64_t offTrace = 0;
+    if (nextAddress == taken) {
+      compareOp = invertComparison(*compareOp);
+      offTrace = fallThrough;
+    } else if (nextAddress == fallThrough) {
+      offTrace = taken;
+    } else {
+      compareOp.reset();
+    }
+
+    if (compareOp) {
+      ir::ValueId rs1 = getRegisterValue(inst.getRegister(0));
+      ir::ValueId rs2 = getRegisterValue(inst.getRegister(1));
+      ir::ValueId condition =
+          createBinaryOp(*compareOp, ir::Type::i1, rs1, rs2);
+
+      ir::SideExit sideExit{condition, offTrace, {}, remainingInstructions};
+      for (uint32_t regNum : modifiedRegisters) {
+        sideExit.writes.push_back({regNum, cachedRegisterValues[regNum]});
+      }
+      addInstruction(sideExit);
+      return;
+    }
+  }
+
+  throw LoweringError("Trace does not continue at a successor of " +
+                      inst.toString());
+}
+
 void Lifter::finalizeRegisterWrites() {
   for (uint32_t regNum : modifiedRegisters) {
     ir::ValueId finalValue = cachedRegisterValues[regNum];
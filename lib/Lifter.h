@@ -3,6 +3,7 @@
 #include "Error.h"
 #include "IR/IR.h"
 #include "RISCV/Instruction.h"
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -17,6 +18,12 @@ public:
   ir::BasicBlock
   liftBasicBlock(const std::vector<riscv::Instruction> &instructions);
 
+  // Lift a trace of RISC-V instructions spanning several basic blocks.
+  // Control transfers inside the trace must continue at the next
+  // instruction; conditional branches become side exits to their other
+  // successor.
+  ir::BasicBlock liftTrace(const std::vector<riscv::Instruction> &instructions);
+
   // Get the current IR value for a RISC-V register
   ir::ValueId getRegisterValue(uint32_t regNum);
 
@@ -56,6 +63,11 @@ private:
   void finalizeRegisterWrites();
 
   // Control flow helpers
+  ir::BasicBlock
+  liftInstructions(const std::vector<riscv::Instruction> &instructions,
+                   bool followTrace);
+  void liftTraceTransfer(const riscv::Instruction &inst, uint64_t nextAddress,
+                         uint64_t remainingInstructions);
   ir::Terminator liftTerminator(const riscv::Instruction &inst,
                                 uint64_t fallThroughAddress);
   void liftSingleInstruction(const riscv::Instruction &inst);
@@ -75,6 +87,7 @@ private:
   void liftStoreInstruction(const riscv::Instruction &inst, ir::Type storeType);
 
   // Terminator creation helpers
+  std::optional<ir::Link> createLink(const riscv::Instruction &inst);
   ir::Terminator createConditionalBranch(ir::BinaryOpcode compareOp,
                                          const riscv::Instruction &inst,
                                          uint64_t fallThroughAddress);
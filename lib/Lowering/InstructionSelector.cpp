@@ -8,6 +8,9 @@ namespace lowering {
 
 namespace {
 
+// Largest unshifted ADD/SUB (immediate) operand
+constexpr uint64_t MAX_ARITHMETIC_IMMEDIATE = 0xFFF;
+
 std::optional<arm64::Condition> comparisonCondition(ir::BinaryOpcode opcode) {
   switch (opcode) {
   case ir::BinaryOpcode::Eq:
@@ -37,18 +40,42 @@ std::optional<arm64::Condition> comparisonCondition(ir::BinaryOpcode opcode) {
 
 } // namespace
 
-InstructionSelector::InstructionSelector() : nextVirtualReg(0) {}
+InstructionSelector::InstructionSelector()
+    : nextVirtualReg(0), budgetChecks(false) {}
 
 std::vector<arm64::Instruction>
-InstructionSelector::selectInstructions(const ir::BasicBlock &block) {
+InstructionSelector::selectInstructions(const ir::BasicBlock &block,
+                                        std::optional<TierUpCounter> counter,
+                                        std::optional<BudgetCheck> budget) {
   std::vector<arm64::Instruction> result;
+  blockExits.clear();
+  budgetChecks = budget.has_value();
+
+  if (counter) {
+    result = selectTierUpCounter(*counter);
+  }
+  if (budget) {
+    auto check = selectBudgetCheck(*budget);
+    result.insert(result.end(), check.begin(), check.end());
+  }
 
   for (const auto &inst : block.instructions) {
+    // Side exits are recorded relative to their own sequence too
+    size_t firstExit = blockExits.size();
     auto selected = selectInstruction(inst);
+    for (size_t i = firstExit; i < blockExits.size(); ++i) {
+      blockExits[i].instructionIndex += result.size();
+    }
     result.insert(result.end(), selected.begin(), selected.end());
   }
 
+  // Exit stubs are recorded relative to the terminator's own sequence
+  size_t terminatorStart = result.size();
+  size_t firstTerminatorExit = blockExits.size();
   auto termSelected = selectTerminator(block.terminator);
+  for (size_t i = firstTerminatorExit; i < blockExits.size(); ++i) {
+    blockExits[i].instructionIndex += terminatorStart;
+  }
   result.insert(result.end(), termSelected.begin(), termSelected.end());
 
   return result;
@@ -134,6 +161,9 @@ InstructionSelector::selectInstruction(const ir::Instruction &inst) {
           result.push_back(selectRegRead(instKind, inst.valueId));
         } else if constexpr (std::is_same_v<T, ir::RegWrite>) {
           result.push_back(selectRegWrite(instKind));
+        } else if constexpr (std::is_same_v<T, ir::SideExit>) {
+          auto exitInsts = selectSideExit(instKind);
+          result.insert(result.end(), exitInsts.begin(), exitInsts.end());
         }
       },
       inst.kind);
@@ -150,44 +180,30 @@ InstructionSelector::selectTerminator(const ir::Terminator &term) {
         using T = std::decay_t<decltype(termKind)>;
 
         if constexpr (std::is_same_v<T, ir::Branch>) {
-          ir::Const targetConst{ir::Type::i64,
-                                static_cast<int64_t>(termKind.targetBlock)};
-          auto constInsts =
-              selectConstIntoRegister(targetConst, arm64::Register::X0);
-          result.insert(result.end(), constInsts.begin(), constInsts.end());
-
-          arm64::Instruction ret;
-          ret.kind =
-              arm64::TwoOperandInst{arm64::Opcode::RET, arm64::DataSize::X,
-                                    arm64::Register::X30, // Link register
-                                    arm64::Register::X30};
-          result.push_back(ret);
+          auto continuation = appendLink(result, termKind.link);
+          appendExitStub(result, termKind.targetBlock);
+          appendContinuation(result, termKind.link, continuation);
         } else if constexpr (std::is_same_v<T, ir::CondBranch>) {
           auto condBranchInsts = selectCondBranch(termKind);
           result.insert(result.end(), condBranchInsts.begin(),
                         condBranchInsts.end());
         } else if constexpr (std::is_same_v<T, ir::Return>) {
           if (termKind.value.has_value()) {
-            VirtualRegister srcReg =
+            VirtualRegister targetReg =
                 getVirtualRegisterOrThrow(termKind.value.value());
-            arm64::Instruction moveReturn;
-            moveReturn.kind =
-                arm64::TwoOperandInst{arm64::Opcode::MOV, arm64::DataSize::X,
-                                      arm64::Register::X0, srcReg};
-            result.push_back(moveReturn);
+            auto continuation = appendLink(result, termKind.link);
+            if (termKind.isFunctionReturn) {
+              appendPredictedReturn(result, targetReg);
+            }
+            appendIndirectExit(result, targetReg);
+            appendContinuation(result, termKind.link, continuation);
           } else {
             // next-PC = 0 so the dispatcher stops
             ir::Const zero{ir::Type::i64, 0};
             auto zeroInsts = selectConstIntoRegister(zero, arm64::Register::X0);
             result.insert(result.end(), zeroInsts.begin(), zeroInsts.end());
+            result.push_back(selectReturn());
           }
-
-          arm64::Instruction ret;
-          ret.kind =
-              arm64::TwoOperandInst{arm64::Opcode::RET, arm64::DataSize::X,
-                                    arm64::Register::X30, // Link register
-                                    arm64::Register::X30};
-          result.push_back(ret);
         }
       },
       term.kind);
@@ -199,7 +215,6 @@ std::vector<arm64::Instruction>
 InstructionSelector::selectCondBranch(const ir::CondBranch &condBranch) {
   std::vector<arm64::Instruction> result;
 
-  // Use conditional select to choose target PC
   VirtualRegister condReg = getVirtualRegisterOrThrow(condBranch.condition);
 
   // Compare condition against zero
@@ -208,45 +223,462 @@ InstructionSelector::selectCondBranch(const ir::CondBranch &condBranch) {
                                    condReg, arm64::Immediate{0}};
   result.push_back(cmp);
 
-  // Load true target into temporary register
-  // Create a unique IR value ID for the true target constant
-  ir::ValueId trueValueId = nextVirtualReg++; // Use virtual reg as unique ID
-  VirtualRegister trueTempReg = assignVirtualRegister(trueValueId);
-  ir::Const trueConst{ir::Type::i64,
-                      static_cast<int64_t>(condBranch.trueBlock)};
-  auto trueInsts = selectConst(trueConst, trueValueId);
-  result.insert(result.end(), trueInsts.begin(), trueInsts.end());
-
-  // Load false target into temporary register
-  // Create a unique IR value ID for the false target constant
-  ir::ValueId falseValueId = nextVirtualReg++; // Use virtual reg as unique ID
-  VirtualRegister falseTempReg = assignVirtualRegister(falseValueId);
-  ir::Const falseConst{ir::Type::i64,
-                       static_cast<int64_t>(condBranch.falseBlock)};
-  auto falseInsts = selectConst(falseConst, falseValueId);
-  result.insert(result.end(), falseInsts.begin(), falseInsts.end());
-
-  // Conditional select: choose true target if condition != 0 (NE)
-  VirtualRegister targetReg = nextVirtualReg++;
-  arm64::Instruction csel;
-  csel.kind = arm64::ConditionalSelectInst{
-      arm64::Opcode::CSEL, arm64::DataSize::X, targetReg,
-      trueTempReg,         falseTempReg,       arm64::Condition::NE};
-  result.push_back(csel);
-
-  // Move selected target to X0 for branch
-  arm64::Instruction movTarget;
-  movTarget.kind = arm64::TwoOperandInst{arm64::Opcode::MOV, arm64::DataSize::X,
-                                         arm64::Register::X0, targetReg};
-  result.push_back(movTarget);
+  // B.NE to the taken exit, fall through into the not-taken exit
+  size_t branchIndex = result.size();
+  result.push_back(arm64::Instruction{});
+
+  appendExitStub(result, condBranch.falseBlock);
+
+  uint64_t takenOffset = (result.size() - branchIndex) * 4;
+  result[branchIndex].kind =
+      arm64::BranchInst{arm64::Opcode::B_NE, takenOffset};
+
+  appendExitStub(result, condBranch.trueBlock);
+
+  return result;
+}
+
+std::vector<arm64::Instruction>
+InstructionSelector::selectTierUpCounter(const TierUpCounter &counter) {
+  std::vector<arm64::Instruction> result;
+
+  // Redirected to the optimized translation once it exists
+  arm64::Instruction entry;
+  entry.kind = arm64::BranchInst{arm64::Opcode::B, 4};
+  result.push_back(entry);
+
+  // counterAddr = blockCounters + counterIndex * 8
+  VirtualRegister counterAddrReg = nextVirtualReg++;
+  arm64::Instruction loadCounters;
+  loadCounters.kind = arm64::MemoryInst{
+      arm64::Opcode::LDR, arm64::DataSize::X, counterAddrReg,
+      arm64::Register::X0,
+      static_cast<int32_t>(offsetof(GuestState, blockCounters))};
+  result.push_back(loadCounters);
+
+  VirtualRegister offsetReg = nextVirtualReg++;
+  ir::Const counterOffset{ir::Type::i64,
+                          static_cast<int64_t>(counter.counterIndex * 8)};
+  auto offsetInsts = selectConstIntoRegister(counterOffset, offsetReg);
+  result.insert(result.end(), offsetInsts.begin(), offsetInsts.end());
+
+  arm64::Instruction addOffset;
+  addOffset.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::ADD, arm64::DataSize::X,
+                              counterAddrReg, counterAddrReg, offsetReg};
+  result.push_back(addOffset);
+
+  // --counter
+  VirtualRegister countReg = nextVirtualReg++;
+  arm64::Instruction loadCount;
+  loadCount.kind = arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X,
+                                     countReg, counterAddrReg, 0};
+  result.push_back(loadCount);
+
+  arm64::Instruction decrement;
+  decrement.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::SUB, arm64::DataSize::X,
+                              countReg, countReg, arm64::Immediate{1}};
+  result.push_back(decrement);
+
+  arm64::Instruction storeCount;
+  storeCount.kind = arm64::MemoryInst{arm64::Opcode::STR, arm64::DataSize::X,
+                                      countReg, counterAddrReg, 0};
+  result.push_back(storeCount);
+
+  arm64::Instruction cmp;
+  cmp.kind = arm64::TwoOperandInst{arm64::Opcode::CMP, arm64::DataSize::X,
+                                   countReg, arm64::Immediate{0}};
+  result.push_back(cmp);
+
+  // B.NE over the runtime exit into the block body
+  size_t branchIndex = result.size();
+  result.push_back(arm64::Instruction{});
+  appendRuntimeExit(result, GuestState::EXIT_TIER_UP, counter.guestAddress);
+
+  uint64_t bodyOffset = (result.size() - branchIndex) * 4;
+  result[branchIndex].kind =
+      arm64::BranchInst{arm64::Opcode::B_NE, bodyOffset};
+
+  return result;
+}
+
+std::vector<arm64::Instruction>
+InstructionSelector::selectBudgetCheck(const BudgetCheck &budget) {
+  std::vector<arm64::Instruction> result;
+
+  // remaining = instructionBudget - guestInstructions
+  VirtualRegister remainingReg = nextVirtualReg++;
+  arm64::Instruction loadBudget;
+  loadBudget.kind = arm64::MemoryInst{
+      arm64::Opcode::LDR, arm64::DataSize::X, remainingReg,
+      arm64::Register::X0,
+      static_cast<int32_t>(offsetof(GuestState, instructionBudget))};
+  result.push_back(loadBudget);
+
+  appendBudgetAdjustment(result, arm64::Opcode::SUB, remainingReg,
+                         budget.guestInstructions);
+
+  arm64::Instruction cmp;
+  cmp.kind = arm64::TwoOperandInst{arm64::Opcode::CMP, arm64::DataSize::X,
+                                   remainingReg, arm64::Immediate{0}};
+  result.push_back(cmp);
+
+  // B.GE over the runtime exit to where the charge is stored
+  size_t branchIndex = result.size();
+  result.push_back(arm64::Instruction{});
+  appendRuntimeExit(result, GuestState::EXIT_BUDGET, budget.guestAddress);
+
+  uint64_t storeOffset = (result.size() - branchIndex) * 4;
+  result[branchIndex].kind =
+      arm64::BranchInst{arm64::Opcode::B_GE, storeOffset};
+
+  arm64::Instruction storeBudget;
+  storeBudget.kind = arm64::MemoryInst{
+      arm64::Opcode::STR, arm64::DataSize::X, remainingReg,
+      arm64::Register::X0,
+      static_cast<int32_t>(offsetof(GuestState, instructionBudget))};
+  result.push_back(storeBudget);
+
+  return result;
+}
+
+void InstructionSelector::appendBudgetAdjustment(
+    std::vector<arm64::Instruction> &result, arm64::Opcode opcode,
+    VirtualRegister budgetReg, uint64_t instructions) {
+  arm64::Instruction adjust;
+  if (instructions <= MAX_ARITHMETIC_IMMEDIATE) {
+    adjust.kind =
+        arm64::ThreeOperandInst{opcode, arm64::DataSize::X, budgetReg,
+                                budgetReg, arm64::Immediate{instructions}};
+  } else {
+    VirtualRegister countReg = nextVirtualReg++;
+    ir::Const count{ir::Type::i64, static_cast<int64_t>(instructions)};
+    auto countInsts = selectConstIntoRegister(count, countReg);
+    result.insert(result.end(), countInsts.begin(), countInsts.end());
+    adjust.kind = arm64::ThreeOperandInst{opcode, arm64::DataSize::X,
+                                          budgetReg, budgetReg, countReg};
+  }
+  result.push_back(adjust);
+}
+
+std::vector<arm64::Instruction>
+InstructionSelector::selectBudgetRefund(uint64_t instructions) {
+  std::vector<arm64::Instruction> result;
+  constexpr int32_t budgetOffset = offsetof(GuestState, instructionBudget);
+
+  VirtualRegister budgetReg = nextVirtualReg++;
+  arm64::Instruction loadBudget;
+  loadBudget.kind =
+      arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X, budgetReg,
+                        arm64::Register::X0, budgetOffset};
+  result.push_back(loadBudget);
+
+  appendBudgetAdjustment(result, arm64::Opcode::ADD, budgetReg, instructions);
+
+  arm64::Instruction storeBudget;
+  storeBudget.kind =
+      arm64::MemoryInst{arm64::Opcode::STR, arm64::DataSize::X, budgetReg,
+                        arm64::Register::X0, budgetOffset};
+  result.push_back(storeBudget);
+
+  return result;
+}
+
+void InstructionSelector::appendRuntimeExit(
+    std::vector<arm64::Instruction> &result, uint64_t reason,
+    uint64_t guestAddress) {
+  VirtualRegister reasonReg = nextVirtualReg++;
+  ir::Const reasonValue{ir::Type::i64, static_cast<int64_t>(reason)};
+  auto reasonInsts = selectConstIntoRegister(reasonValue, reasonReg);
+  result.insert(result.end(), reasonInsts.begin(), reasonInsts.end());
+
+  arm64::Instruction storeReason;
+  storeReason.kind = arm64::MemoryInst{
+      arm64::Opcode::STR, arm64::DataSize::X, reasonReg, arm64::Register::X0,
+      static_cast<int32_t>(offsetof(GuestState, exitReason))};
+  result.push_back(storeReason);
+
+  ir::Const exitPC{ir::Type::i64,
+                   static_cast<int64_t>(guestAddress |
+                                        GuestState::RUNTIME_EXIT_FLAG)};
+  auto exitInsts = selectConstIntoRegister(exitPC, arm64::Register::X0);
+  result.insert(result.end(), exitInsts.begin(), exitInsts.end());
+  result.push_back(selectReturn());
+}
+
+std::vector<arm64::Instruction>
+InstructionSelector::selectSideExit(const ir::SideExit &sideExit) {
+  std::vector<arm64::Instruction> result;
+
+  VirtualRegister condReg = getVirtualRegisterOrThrow(sideExit.condition);
+
+  arm64::Instruction cmp;
+  cmp.kind = arm64::TwoOperandInst{arm64::Opcode::CMP, arm64::DataSize::X,
+                                   condReg, arm64::Immediate{0}};
+  result.push_back(cmp);
+
+  // B.EQ over the exit while staying on the trace
+  size_t branchIndex = result.size();
+  result.push_back(arm64::Instruction{});
+
+  for (const auto &write : sideExit.writes) {
+    result.push_back(selectRegWrite(write));
+  }
+  if (budgetChecks && sideExit.skippedInstructions > 0) {
+    auto refund = selectBudgetRefund(sideExit.skippedInstructions);
+    result.insert(result.end(), refund.begin(), refund.end());
+  }
+  appendExitStub(result, sideExit.target);
+
+  uint64_t skipOffset = (result.size() - branchIndex) * 4;
+  result[branchIndex].kind =
+      arm64::BranchInst{arm64::Opcode::B_EQ, skipOffset};
+
+  return result;
+}
+
+void InstructionSelector::appendExitStub(
+    std::vector<arm64::Instruction> &result, uint64_t targetAddress) {
+  blockExits.push_back({result.size(), targetAddress});
+
+  // Falls through to the next instruction until the exit is chained
+  arm64::Instruction link;
+  link.kind = arm64::BranchInst{arm64::Opcode::B, 4};
+  result.push_back(link);
+
+  ir::Const targetConst{ir::Type::i64, static_cast<int64_t>(targetAddress)};
+  auto constInsts = selectConstIntoRegister(targetConst, arm64::Register::X0);
+  result.insert(result.end(), constInsts.begin(), constInsts.end());
+
+  result.push_back(selectReturn());
+}
+
+std::optional<size_t>
+InstructionSelector::appendLink(std::vector<arm64::Instruction> &result,
+                                const std::optional<ir::Link> &link) {
+  if (!link) {
+    return std::nullopt;
+  }
+
+  result.push_back(selectRegWrite(ir::RegWrite{link->regNum, link->value}));
+  if (!link->isCall) {
+    return std::nullopt;
+  }
+
+  constexpr int32_t rasTopOffset = offsetof(GuestState, rasTop);
+  constexpr int32_t rasOffset = offsetof(GuestState, ras);
+
+  // ++rasTop
+  VirtualRegister topReg = nextVirtualReg++;
+  arm64::Instruction loadTop;
+  loadTop.kind = arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X,
+                                   topReg, arm64::Register::X0, rasTopOffset};
+  result.push_back(loadTop);
+
+  arm64::Instruction increment;
+  increment.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::ADD, arm64::DataSize::X, topReg,
+                              topReg, arm64::Immediate{1}};
+  result.push_back(increment);
+
+  arm64::Instruction storeTop;
+  storeTop.kind = arm64::MemoryInst{arm64::Opcode::STR, arm64::DataSize::X,
+                                    topReg, arm64::Register::X0, rasTopOffset};
+  result.push_back(storeTop);
+
+  VirtualRegister entryReg = nextVirtualReg++;
+  auto entryInsts = selectRingEntry(topReg, entryReg, GuestState::RAS_BITS);
+  result.insert(result.end(), entryInsts.begin(), entryInsts.end());
+
+  // Predict the return address together with the continuation exit
+  // appended after this block's own exits
+  arm64::Instruction storePC;
+  storePC.kind = arm64::MemoryInst{
+      arm64::Opcode::STR, arm64::DataSize::X,
+      getVirtualRegisterOrThrow(link->value), entryReg, rasOffset};
+  result.push_back(storePC);
+
+  VirtualRegister hostCodeReg = nextVirtualReg++;
+  size_t adrIndex = result.size();
+  arm64::Instruction adr;
+  adr.kind = arm64::TwoOperandInst{arm64::Opcode::ADR, arm64::DataSize::X,
+                                   hostCodeReg, arm64::Immediate{0}};
+  result.push_back(adr);
+
+  arm64::Instruction storeHost;
+  storeHost.kind = arm64::MemoryInst{
+      arm64::Opcode::STR, arm64::DataSize::X, hostCodeReg, entryReg,
+      rasOffset + static_cast<int32_t>(offsetof(IndirectTarget, hostCode))};
+  result.push_back(storeHost);
+
+  return adrIndex;
+}
+
+void InstructionSelector::appendContinuation(
+    std::vector<arm64::Instruction> &result,
+    const std::optional<ir::Link> &link, std::optional<size_t> adrIndex) {
+  if (!adrIndex) {
+    return;
+  }
+
+  // Point the pushed prediction at the continuation exit
+  auto &adr = std::get<arm64::TwoOperandInst>(result[*adrIndex].kind);
+  adr.src = arm64::Immediate{(result.size() - *adrIndex) * 4};
+
+  appendExitStub(result, link->returnAddress);
+}
+
+void InstructionSelector::appendPredictedReturn(
+    std::vector<arm64::Instruction> &result, VirtualRegister targetReg) {
+  constexpr int32_t rasTopOffset = offsetof(GuestState, rasTop);
+  constexpr int32_t rasOffset = offsetof(GuestState, ras);
+
+  // Pop the top prediction: entry = &ras[rasTop % RAS_SIZE], --rasTop
+  VirtualRegister topReg = nextVirtualReg++;
+  arm64::Instruction loadTop;
+  loadTop.kind = arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X,
+                                   topReg, arm64::Register::X0, rasTopOffset};
+  result.push_back(loadTop);
+
+  VirtualRegister entryReg = nextVirtualReg++;
+  auto entryInsts = selectRingEntry(topReg, entryReg, GuestState::RAS_BITS);
+  result.insert(result.end(), entryInsts.begin(), entryInsts.end());
+
+  arm64::Instruction decrement;
+  decrement.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::SUB, arm64::DataSize::X, topReg,
+                              topReg, arm64::Immediate{1}};
+  result.push_back(decrement);
+
+  arm64::Instruction storeTop;
+  storeTop.kind = arm64::MemoryInst{arm64::Opcode::STR, arm64::DataSize::X,
+                                    topReg, arm64::Register::X0, rasTopOffset};
+  result.push_back(storeTop);
+
+  VirtualRegister predictedReg = nextVirtualReg++;
+  arm64::Instruction loadPC;
+  loadPC.kind =
+      arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X, predictedReg,
+                        entryReg, rasOffset};
+  result.push_back(loadPC);
+
+  arm64::Instruction cmp;
+  cmp.kind = arm64::TwoOperandInst{arm64::Opcode::CMP, arm64::DataSize::X,
+                                   predictedReg, targetReg};
+  result.push_back(cmp);
+
+  // On a misprediction fall back to the indirect exit that follows
+  arm64::Instruction branchMiss;
+  branchMiss.kind = arm64::BranchInst{arm64::Opcode::B_NE, 12};
+  result.push_back(branchMiss);
+
+  // Hit: resume at the caller's continuation exit
+  VirtualRegister hostCodeReg = nextVirtualReg++;
+  arm64::Instruction loadHost;
+  loadHost.kind = arm64::MemoryInst{
+      arm64::Opcode::LDR, arm64::DataSize::X, hostCodeReg, entryReg,
+      rasOffset + static_cast<int32_t>(offsetof(IndirectTarget, hostCode))};
+  result.push_back(loadHost);
+
+  arm64::Instruction branchHost;
+  branchHost.kind = arm64::TwoOperandInst{
+      arm64::Opcode::BR, arm64::DataSize::X, hostCodeReg, hostCodeReg};
+  result.push_back(branchHost);
+}
+
+std::vector<arm64::Instruction>
+InstructionSelector::selectRingEntry(VirtualRegister indexReg,
+                                     VirtualRegister entryReg, size_t bits) {
+  static_assert(sizeof(IndirectTarget) == 16,
+                "Ring index is scaled by the entry size");
+  std::vector<arm64::Instruction> result;
+
+  // entryReg = X0 + (index & ((1 << bits) - 1)) * 16
+  arm64::Instruction keepIndexBits;
+  keepIndexBits.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::LSL, arm64::DataSize::X, entryReg,
+                              indexReg, arm64::Immediate{64 - bits}};
+  result.push_back(keepIndexBits);
+
+  arm64::Instruction scaleIndex;
+  scaleIndex.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::LSR, arm64::DataSize::X, entryReg,
+                              entryReg, arm64::Immediate{60 - bits}};
+  result.push_back(scaleIndex);
+
+  arm64::Instruction addBase;
+  addBase.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::ADD, arm64::DataSize::X, entryReg,
+                              arm64::Register::X0, entryReg};
+  result.push_back(addBase);
+
+  return result;
+}
+
+void InstructionSelector::appendIndirectExit(
+    std::vector<arm64::Instruction> &result, VirtualRegister targetReg) {
+  constexpr int32_t ibtcOffset = offsetof(GuestState, ibtc);
+
+  // entry = &ibtc[(target >> 2) % IBTC_SIZE]
+  VirtualRegister indexReg = nextVirtualReg++;
+  arm64::Instruction dropAlignment;
+  dropAlignment.kind =
+      arm64::ThreeOperandInst{arm64::Opcode::LSR, arm64::DataSize::X, indexReg,
+                              targetReg, arm64::Immediate{2}};
+  result.push_back(dropAlignment);
+
+  VirtualRegister entryReg = nextVirtualReg++;
+  auto entryInsts = selectRingEntry(indexReg, entryReg, GuestState::IBTC_BITS);
+  result.insert(result.end(), entryInsts.begin(), entryInsts.end());
+
+  // LDR cachedPC, [entry, #ibtc.guestPC]
+  VirtualRegister cachedPCReg = nextVirtualReg++;
+  arm64::Instruction loadPC;
+  loadPC.kind =
+      arm64::MemoryInst{arm64::Opcode::LDR, arm64::DataSize::X, cachedPCReg,
+                        entryReg, ibtcOffset};
+  result.push_back(loadPC);
+
+  arm64::Instruction cmp;
+  cmp.kind = arm64::TwoOperandInst{arm64::Opcode::CMP, arm64::DataSize::X,
+                                   cachedPCReg, targetReg};
+  result.push_back(cmp);
+
+  // On a miss skip the LDR and BR below
+  arm64::Instruction branchMiss;
+  branchMiss.kind = arm64::BranchInst{arm64::Opcode::B_NE, 12};
+  result.push_back(branchMiss);
+
+  // Hit: jump straight into the target's translation. X0 still holds the
+  // GuestState pointer and X30 still returns to the dispatcher.
+  VirtualRegister hostCodeReg = nextVirtualReg++;
+  arm64::Instruction loadHost;
+  loadHost.kind = arm64::MemoryInst{
+      arm64::Opcode::LDR, arm64::DataSize::X, hostCodeReg, entryReg,
+      ibtcOffset + static_cast<int32_t>(offsetof(IndirectTarget, hostCode))};
+  result.push_back(loadHost);
+
+  arm64::Instruction branchHost;
+  branchHost.kind = arm64::TwoOperandInst{
+      arm64::Opcode::BR, arm64::DataSize::X, hostCodeReg, hostCodeReg};
+  result.push_back(branchHost);
+
+  // Miss: let the dispatcher resolve the target
+  arm64::Instruction moveTarget;
+  moveTarget.kind = arm64::TwoOperandInst{
+      arm64::Opcode::MOV, arm64::DataSize::X, arm64::Register::X0, targetReg};
+  result.push_back(moveTarget);
+
+  result.push_back(selectReturn());
+}
 
+arm64::Instruction InstructionSelector::selectReturn() const {
   arm64::Instruction ret;
   ret.kind = arm64::TwoOperandInst{arm64::Opcode::RET, arm64::DataSize::X,
                                    arm64::Register::X30, // Link register
                                    arm64::Register::X30};
-  result.push_back(ret);
-
-  return result;
+  return ret;
 }
 
 std::vector<arm64::Instruction>
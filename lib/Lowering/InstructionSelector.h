@@ -11,13 +11,43 @@ namespace lowering {
 
 using VirtualRegister = arm64::VirtualRegister;
 
+// A direct exit to a guest address known at translation time. The
+// instruction at instructionIndex is a "B #4" that falls through to
+// "MOV X0, target; RET" and can later be patched to branch straight to the
+// target's translation.
+struct BlockExit {
+  size_t instructionIndex;
+  uint64_t targetAddress;
+};
+
+// Baseline tier instrumentation. The block starts with a patchable "B #4"
+// entry branch followed by a countdown of
+// GuestState::blockCounters[counterIndex]. When the counter reaches zero the
+// block exits to the runtime with EXIT_TIER_UP before doing anything else.
+struct TierUpCounter {
+  size_t counterIndex;
+  uint64_t guestAddress;
+};
+
+// Instruction budget check at the start of a block or trace (after the
+// tier-up countdown, if any). GuestState::instructionBudget is charged
+// guestInstructions up front; if that would make it negative the block
+// exits to the runtime with EXIT_BUDGET instead, leaving the budget as is.
+// Side exits give back the instructions of the trace they skip.
+struct BudgetCheck {
+  uint64_t guestInstructions;
+  uint64_t guestAddress;
+};
+
 class InstructionSelector {
 public:
   explicit InstructionSelector();
 
   // Select ARM64 instructions for an IR basic block
   std::vector<arm64::Instruction>
-  selectInstructions(const ir::BasicBlock &block);
+  selectInstructions(const ir::BasicBlock &block,
+                     std::optional<TierUpCounter> counter = std::nullopt,
+                     std::optional<BudgetCheck> budget = std::nullopt);
 
   // Get the virtual register assigned to an IR value
   std::optional<VirtualRegister> getVirtualRegister(ir::ValueId valueId) const;
@@ -25,12 +55,19 @@ public:
   // Get the virtual register assigned to an IR value (throws if not found)
   VirtualRegister getVirtualRegisterOrThrow(ir::ValueId valueId) const;
 
+  // Patchable exits of the last selected block
+  const std::vector<BlockExit> &getBlockExits() const { return blockExits; }
+
 private:
   static constexpr size_t REGISTER_SIZE_BYTES = 8;
 
   VirtualRegister nextVirtualReg;
   std::unordered_map<ir::ValueId, VirtualRegister> irToVReg;
   std::unordered_map<ir::ValueId, ir::Type> valueTypes;
+  std::vector<BlockExit> blockExits;
+
+  // Whether the block being selected charges the instruction budget
+  bool budgetChecks;
 
   // Assign a virtual register to an IR value
   VirtualRegister assignVirtualRegister(ir::ValueId valueId);
@@ -50,6 +87,62 @@ private:
   std::vector<arm64::Instruction>
   selectCondBranch(const ir::CondBranch &condBranch);
 
+  // Entry branch and hotness countdown of a baseline tier block
+  std::vector<arm64::Instruction>
+  selectTierUpCounter(const TierUpCounter &counter);
+
+  // Charge the instruction budget or exit if it's used up
+  std::vector<arm64::Instruction> selectBudgetCheck(const BudgetCheck &budget);
+
+  // budgetReg = budgetReg +/- instructions, with opcode ADD or SUB
+  void appendBudgetAdjustment(std::vector<arm64::Instruction> &result,
+                              arm64::Opcode opcode, VirtualRegister budgetReg,
+                              uint64_t instructions);
+
+  // Give back the budget charged for guest instructions a side exit skips
+  std::vector<arm64::Instruction> selectBudgetRefund(uint64_t instructions);
+
+  // Store reason in GuestState::exitReason and return guestAddress with
+  // RUNTIME_EXIT_FLAG to the dispatcher
+  void appendRuntimeExit(std::vector<arm64::Instruction> &result,
+                         uint64_t reason, uint64_t guestAddress);
+
+  // Helper for trace side exits
+  std::vector<arm64::Instruction> selectSideExit(const ir::SideExit &sideExit);
+
+  // Append a patchable exit to a known guest address
+  void appendExitStub(std::vector<arm64::Instruction> &result,
+                      uint64_t targetAddress);
+
+  // Append an exit to a guest address computed at run time. Probes the
+  // indirect branch target cache in GuestState and branches to the cached
+  // translation on a hit, otherwise returns the target to the dispatcher.
+  void appendIndirectExit(std::vector<arm64::Instruction> &result,
+                          VirtualRegister targetReg);
+
+  // Write the link register of a jump-and-link. For calls this also pushes
+  // a return prediction and returns the index of the ADR that must be
+  // pointed at the continuation exit by appendContinuation.
+  std::optional<size_t> appendLink(std::vector<arm64::Instruction> &result,
+                                   const std::optional<ir::Link> &link);
+  void appendContinuation(std::vector<arm64::Instruction> &result,
+                          const std::optional<ir::Link> &link,
+                          std::optional<size_t> adrIndex);
+
+  // Pop the shadow return stack and branch to the predicted continuation if
+  // it matches the target, otherwise fall through
+  void appendPredictedReturn(std::vector<arm64::Instruction> &result,
+                             VirtualRegister targetReg);
+
+  // entryReg = X0 + (index % 2^bits) * 16, i.e. the GuestState-relative
+  // address of a ring entry without the ring's own offset
+  std::vector<arm64::Instruction> selectRingEntry(VirtualRegister indexReg,
+                                                  VirtualRegister entryReg,
+                                                  size_t bits);
+
+  // Return to the dispatcher with the next PC in X0
+  arm64::Instruction selectReturn() const;
+
   // Helper functions for specific instruction types
   std::vector<arm64::Instruction> selectBinaryOp(const ir::BinaryOp &binOp,
                                                  ir::ValueId resultId);
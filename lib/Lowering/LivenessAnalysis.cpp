@@ -126,8 +126,12 @@ std::set<uint32_t> LivenessAnalysis::getDefinedVirtualRegisters(
           }
         } else if constexpr (std::is_same_v<T, arm64::TwoOperandInst>) {
           // The destination is *defined* only when the opcode produces a value
-          // Comparison ops (CMP) do not write their first operand
-          if (instKind.opcode != arm64::Opcode::CMP) {
+          // Comparison ops (CMP) and register branches (RET, BR, BLR) do
+          // not write their first operand
+          if (instKind.opcode != arm64::Opcode::CMP &&
+              instKind.opcode != arm64::Opcode::RET &&
+              instKind.opcode != arm64::Opcode::BR &&
+              instKind.opcode != arm64::Opcode::BLR) {
             if (auto vreg = getVirtualRegisterFromOperand(instKind.dest)) {
               definedVRegs.insert(*vreg);
             }
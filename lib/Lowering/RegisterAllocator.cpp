@@ -13,12 +13,12 @@ const std::vector<arm64::Register> RegisterAllocator::availableRegisters = {
     arm64::Register::X10, arm64::Register::X11, arm64::Register::X12,
     arm64::Register::X13, arm64::Register::X14, arm64::Register::X15,
     arm64::Register::X16, arm64::Register::X17, arm64::Register::X18,
-    arm64::Register::X19, arm64::Register::X20, arm64::Register::X21,
-    arm64::Register::X22, arm64::Register::X23, arm64::Register::X24,
-    arm64::Register::X25, arm64::Register::X26, arm64::Register::X27,
-    arm64::Register::X28
-    // Note: X0 (GuestState pointer), X29 (frame pointer), X30 (link register),
-    // and SP are reserved
+    arm64::Register::X20, arm64::Register::X21, arm64::Register::X22,
+    arm64::Register::X23, arm64::Register::X24, arm64::Register::X25,
+    arm64::Register::X26, arm64::Register::X27, arm64::Register::X28
+    // Note: X0 (GuestState pointer), X19 (GuestState pointer pinned by the
+    // dispatch trampoline), X29 (frame pointer), X30 (link register), and SP
+    // are reserved. X20-X28 are saved once by the trampoline.
 };
 
 RegisterAllocator::RegisterAllocator() {}
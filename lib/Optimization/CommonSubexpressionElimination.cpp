@@ -0,0 +1,139 @@
+#include "Optimization/CommonSubexpressionElimination.h"
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+
+namespace dinorisc {
+namespace optimization {
+
+namespace {
+
+// What an instruction computes, without the value it computes it into
+struct Expression {
+  uint8_t kind;
+  uint8_t opcode;
+  uint8_t type;
+  uint64_t lhs;
+  uint64_t rhs;
+
+  bool operator==(const Expression &other) const {
+    return kind == other.kind && opcode == other.opcode &&
+           type == other.type && lhs == other.lhs && rhs == other.rhs;
+  }
+};
+
+struct ExpressionHash {
+  size_t operator()(const Expression &expression) const {
+    uint64_t hash = expression.kind;
+    hash = hash * 31 + expression.opcode;
+    hash = hash * 31 + expression.type;
+    hash ^= expression.lhs + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    hash ^= expression.rhs + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    return static_cast<size_t>(hash);
+  }
+};
+
+bool isCommutative(ir::BinaryOpcode opcode) {
+  switch (opcode) {
+  case ir::BinaryOpcode::Add:
+  case ir::BinaryOpcode::Mul:
+  case ir::BinaryOpcode::And:
+  case ir::BinaryOpcode::Or:
+  case ir::BinaryOpcode::Xor:
+  case ir::BinaryOpcode::Eq:
+  case ir::BinaryOpcode::Ne:
+    return true;
+  default:
+    return false;
+  }
+}
+
+std::optional<Expression> expressionOf(const ir::InstructionKind &kind) {
+  uint8_t index = static_cast<uint8_t>(kind.index());
+  if (auto constant = std::get_if<ir::Const>(&kind)) {
+    return Expression{index, 0, static_cast<uint8_t>(constant->type),
+                      static_cast<uint64_t>(constant->value), 0};
+  }
+  if (auto binOp = std::get_if<ir::BinaryOp>(&kind)) {
+    uint64_t lhs = binOp->lhs;
+    uint64_t rhs = binOp->rhs;
+    if (isCommutative(binOp->opcode) && rhs < lhs) {
+      std::swap(lhs, rhs);
+    }
+    return Expression{index, static_cast<uint8_t>(binOp->opcode),
+                      static_cast<uint8_t>(binOp->type), lhs, rhs};
+  }
+  if (auto sext = std::get_if<ir::Sext>(&kind)) {
+    return Expression{index, 0, static_cast<uint8_t>(sext->toType),
+                      sext->operand, 0};
+  }
+  if (auto zext = std::get_if<ir::Zext>(&kind)) {
+    return Expression{index, 0, static_cast<uint8_t>(zext->toType),
+                      zext->operand, 0};
+  }
+  if (auto trunc = std::get_if<ir::Trunc>(&kind)) {
+    return Expression{index, 0, static_cast<uint8_t>(trunc->toType),
+                      trunc->operand, 0};
+  }
+  return std::nullopt;
+}
+
+class ValueNumbering {
+public:
+  void numberBlock(std::vector<ir::Instruction> &instructions);
+
+  // Point the remaining uses at the surviving values and drop the
+  // duplicates
+  void rewrite(std::vector<ir::Instruction> &instructions,
+               ir::Terminator &terminator) const;
+
+private:
+  std::unordered_map<Expression, ir::ValueId, ExpressionHash> available;
+  std::unordered_map<ir::ValueId, ir::ValueId> replacements;
+
+  void replace(ir::ValueId &value) const {
+    auto it = replacements.find(value);
+    if (it != replacements.end()) {
+      value = it->second;
+    }
+  }
+};
+
+void ValueNumbering::numberBlock(std::vector<ir::Instruction> &instructions) {
+  for (auto &inst : instructions) {
+    ir::forEachOperand(inst, [&](ir::ValueId &value) { replace(value); });
+
+    auto expression = expressionOf(inst.kind);
+    if (!expression) {
+      continue;
+    }
+    auto [it, inserted] = available.emplace(*expression, inst.valueId);
+    if (!inserted) {
+      replacements[inst.valueId] = it->second;
+    }
+  }
+}
+
+void ValueNumbering::rewrite(std::vector<ir::Instruction> &instructions,
+                             ir::Terminator &terminator) const {
+  instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                    [&](const ir::Instruction &inst) {
+                                      return replacements.count(inst.valueId);
+                                    }),
+                     instructions.end());
+  for (auto &inst : instructions) {
+    ir::forEachOperand(inst, [&](ir::ValueId &value) { replace(value); });
+  }
+  ir::forEachOperand(terminator, [&](ir::ValueId &value) { replace(value); });
+}
+
+} // namespace
+
+void CommonSubexpressionElimination::run(ir::BasicBlock &block) const {
+  ValueNumbering numbering;
+  numbering.numberBlock(block.instructions);
+  numbering.rewrite(block.instructions, block.terminator);
+}
+
+} // namespace optimization
+} // namespace dinorisc
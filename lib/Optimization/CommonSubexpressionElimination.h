@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Optimization/PassManager.h"
+
+namespace dinorisc {
+namespace optimization {
+
+// Value numbering over consts, BinaryOps and extensions: an instruction
+// computing the same operation on the same operands as an earlier one is
+// replaced by it, so recomputed addresses like sp + 8 and repeated
+// constants get a single virtual register. Operands of commutative
+// operations are ordered first.
+class CommonSubexpressionElimination : public Pass {
+public:
+  const char *getName() const override {
+    return "common-subexpression-elimination";
+  }
+
+  void run(ir::BasicBlock &block) const override;
+};
+
+} // namespace optimization
+} // namespace dinorisc
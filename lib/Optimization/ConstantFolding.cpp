@@ -0,0 +1,279 @@
+#include "Optimization/ConstantFolding.h"
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dinorisc {
+namespace optimization {
+
+namespace {
+
+unsigned bitWidth(ir::Type type) {
+  switch (type) {
+  case ir::Type::i1:
+    return 1;
+  case ir::Type::i8:
+    return 8;
+  case ir::Type::i16:
+    return 16;
+  case ir::Type::i32:
+    return 32;
+  case ir::Type::i64:
+    return 64;
+  }
+  return 64;
+}
+
+// Low bits of value that a value of type keeps
+uint64_t truncateTo(ir::Type type, uint64_t value) {
+  unsigned width = bitWidth(type);
+  return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+int64_t signExtendFrom(ir::Type type, uint64_t value) {
+  unsigned shift = 64 - bitWidth(type);
+  return static_cast<int64_t>(value << shift) >> shift;
+}
+
+// Constants narrower than 64 bits are emitted zero-extended, so they can be
+// materialized with 32-bit moves
+ir::Const makeConst(ir::Type type, uint64_t value) {
+  return ir::Const{type, static_cast<int64_t>(truncateTo(type, value))};
+}
+
+std::optional<uint64_t> evaluate(ir::BinaryOpcode opcode, ir::Type type,
+                                 ir::Type operandType, uint64_t lhs,
+                                 uint64_t rhs) {
+  unsigned width = bitWidth(type);
+  int64_t signedLhs = signExtendFrom(operandType, lhs);
+  int64_t signedRhs = signExtendFrom(operandType, rhs);
+  uint64_t unsignedLhs = truncateTo(operandType, lhs);
+  uint64_t unsignedRhs = truncateTo(operandType, rhs);
+
+  // Shift amounts are taken modulo the width, like RISC-V and ARM64 do
+  uint64_t shift = rhs & (width - 1);
+
+  switch (opcode) {
+  case ir::BinaryOpcode::Add:
+    return lhs + rhs;
+  case ir::BinaryOpcode::Sub:
+    return lhs - rhs;
+  case ir::BinaryOpcode::Mul:
+    return lhs * rhs;
+  case ir::BinaryOpcode::And:
+    return lhs & rhs;
+  case ir::BinaryOpcode::Or:
+    return lhs | rhs;
+  case ir::BinaryOpcode::Xor:
+    return lhs ^ rhs;
+  case ir::BinaryOpcode::Shl:
+    return lhs << shift;
+  case ir::BinaryOpcode::Shr:
+    return truncateTo(type, lhs) >> shift;
+  case ir::BinaryOpcode::Sar:
+    return static_cast<uint64_t>(signExtendFrom(type, lhs) >> shift);
+  case ir::BinaryOpcode::Eq:
+    return unsignedLhs == unsignedRhs;
+  case ir::BinaryOpcode::Ne:
+    return unsignedLhs != unsignedRhs;
+  case ir::BinaryOpcode::Lt:
+    return signedLhs < signedRhs;
+  case ir::BinaryOpcode::Le:
+    return signedLhs <= signedRhs;
+  case ir::BinaryOpcode::Gt:
+    return signedLhs > signedRhs;
+  case ir::BinaryOpcode::Ge:
+    return signedLhs >= signedRhs;
+  case ir::BinaryOpcode::LtU:
+    return unsignedLhs < unsignedRhs;
+  case ir::BinaryOpcode::LeU:
+    return unsignedLhs <= unsignedRhs;
+  case ir::BinaryOpcode::GtU:
+    return unsignedLhs > unsignedRhs;
+  case ir::BinaryOpcode::GeU:
+    return unsignedLhs >= unsignedRhs;
+  default:
+    // Division isn't folded; its corner cases differ between guest and host
+    return std::nullopt;
+  }
+}
+
+// Whether x op 0 is x, and whether 0 op x is x
+bool isRightIdentityZero(ir::BinaryOpcode opcode) {
+  switch (opcode) {
+  case ir::BinaryOpcode::Add:
+  case ir::BinaryOpcode::Sub:
+  case ir::BinaryOpcode::Or:
+  case ir::BinaryOpcode::Xor:
+  case ir::BinaryOpcode::Shl:
+  case ir::BinaryOpcode::Shr:
+  case ir::BinaryOpcode::Sar:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isLeftIdentityZero(ir::BinaryOpcode opcode) {
+  return opcode == ir::BinaryOpcode::Add || opcode == ir::BinaryOpcode::Or ||
+         opcode == ir::BinaryOpcode::Xor;
+}
+
+class Folder {
+public:
+  // Fold a block in order
+  void foldBlock(std::vector<ir::Instruction> &instructions,
+                 ir::Terminator &terminator);
+
+  // Point every use of a replaced value at its replacement and drop the
+  // replaced instructions and constants nobody uses
+  void cleanUp(std::vector<ir::Instruction> &instructions,
+               ir::Terminator &terminator);
+
+private:
+  std::unordered_map<ir::ValueId, ir::Const> constants;
+  std::unordered_map<ir::ValueId, ir::ValueId> replacements;
+  std::unordered_set<ir::ValueId> removed;
+
+  const ir::Const *findConstant(ir::ValueId value) const {
+    auto it = constants.find(value);
+    return it != constants.end() ? &it->second : nullptr;
+  }
+
+  void rewrite(ir::ValueId &value) const {
+    for (auto it = replacements.find(value); it != replacements.end();
+         it = replacements.find(value)) {
+      value = it->second;
+    }
+  }
+
+  bool foldInstruction(ir::Instruction &inst);
+  bool foldTerminator(ir::Terminator &terminator);
+};
+
+void Folder::foldBlock(std::vector<ir::Instruction> &instructions,
+                       ir::Terminator &terminator) {
+  for (auto &inst : instructions) {
+    if (removed.count(inst.valueId)) {
+      continue;
+    }
+    ir::forEachOperand(inst, [&](ir::ValueId &value) { rewrite(value); });
+    foldInstruction(inst);
+  }
+  ir::forEachOperand(terminator, [&](ir::ValueId &value) { rewrite(value); });
+  foldTerminator(terminator);
+}
+
+bool Folder::foldInstruction(ir::Instruction &inst) {
+  std::optional<ir::Const> folded;
+  if (auto constant = std::get_if<ir::Const>(&inst.kind)) {
+    constants.emplace(inst.valueId, *constant);
+    return false;
+  } else if (auto binOp = std::get_if<ir::BinaryOp>(&inst.kind)) {
+    const ir::Const *lhs = findConstant(binOp->lhs);
+    const ir::Const *rhs = findConstant(binOp->rhs);
+    if (lhs && rhs) {
+      auto value = evaluate(binOp->opcode, binOp->type, lhs->type,
+                            static_cast<uint64_t>(lhs->value),
+                            static_cast<uint64_t>(rhs->value));
+      if (value) {
+        folded = makeConst(binOp->type, *value);
+      }
+    } else if (rhs && truncateTo(rhs->type, rhs->value) == 0 &&
+               isRightIdentityZero(binOp->opcode)) {
+      replacements[inst.valueId] = binOp->lhs;
+    } else if (lhs && truncateTo(lhs->type, lhs->value) == 0 &&
+               isLeftIdentityZero(binOp->opcode)) {
+      replacements[inst.valueId] = binOp->rhs;
+    }
+  } else if (auto sext = std::get_if<ir::Sext>(&inst.kind)) {
+    if (const ir::Const *operand = findConstant(sext->operand)) {
+      folded = makeConst(sext->toType,
+                         signExtendFrom(operand->type, operand->value));
+    }
+  } else if (auto zext = std::get_if<ir::Zext>(&inst.kind)) {
+    if (const ir::Const *operand = findConstant(zext->operand)) {
+      folded = makeConst(zext->toType,
+                         truncateTo(operand->type, operand->value));
+    }
+  } else if (auto trunc = std::get_if<ir::Trunc>(&inst.kind)) {
+    if (const ir::Const *operand = findConstant(trunc->operand)) {
+      folded = makeConst(trunc->toType, operand->value);
+    }
+  } else if (auto sideExit = std::get_if<ir::SideExit>(&inst.kind)) {
+    // A side exit that is never taken
+    const ir::Const *condition = findConstant(sideExit->condition);
+    if (condition && truncateTo(condition->type, condition->value) == 0) {
+      removed.insert(inst.valueId);
+      return true;
+    }
+  }
+
+  if (replacements.count(inst.valueId)) {
+    removed.insert(inst.valueId);
+    return true;
+  }
+  if (folded) {
+    inst.kind = *folded;
+    constants.emplace(inst.valueId, *folded);
+    return true;
+  }
+  return false;
+}
+
+bool Folder::foldTerminator(ir::Terminator &terminator) {
+  if (auto condBranch = std::get_if<ir::CondBranch>(&terminator.kind)) {
+    if (const ir::Const *condition = findConstant(condBranch->condition)) {
+      bool taken = truncateTo(condition->type, condition->value) != 0;
+      terminator.kind =
+          ir::Branch{taken ? condBranch->trueBlock : condBranch->falseBlock};
+      return true;
+    }
+  } else if (auto ret = std::get_if<ir::Return>(&terminator.kind)) {
+    // Returns keep popping the predicted return address
+    if (ret->value && !ret->isFunctionReturn) {
+      if (const ir::Const *target = findConstant(*ret->value)) {
+        terminator.kind = ir::Branch{static_cast<uint64_t>(target->value),
+                                     ret->link};
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Folder::cleanUp(std::vector<ir::Instruction> &instructions,
+                     ir::Terminator &terminator) {
+  std::unordered_map<ir::ValueId, size_t> uses;
+  auto countUse = [&](ir::ValueId &value) {
+    rewrite(value);
+    ++uses[value];
+  };
+  for (auto &inst : instructions) {
+    if (!removed.count(inst.valueId)) {
+      ir::forEachOperand(inst, countUse);
+    }
+  }
+  ir::forEachOperand(terminator, countUse);
+
+  instructions.erase(
+      std::remove_if(instructions.begin(), instructions.end(),
+                     [&](const ir::Instruction &inst) {
+                       return removed.count(inst.valueId) ||
+                              (std::holds_alternative<ir::Const>(inst.kind) &&
+                               !uses.count(inst.valueId));
+                     }),
+      instructions.end());
+}
+
+} // namespace
+
+void ConstantFolding::run(ir::BasicBlock &block) const {
+  Folder folder;
+  folder.foldBlock(block.instructions, block.terminator);
+  folder.cleanUp(block.instructions, block.terminator);
+}
+
+} // namespace optimization
+} // namespace dinorisc
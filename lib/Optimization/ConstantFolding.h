@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Optimization/PassManager.h"
+
+namespace dinorisc {
+namespace optimization {
+
+// Evaluates BinaryOp, Sext, Zext and Trunc instructions whose operands are
+// constants, and propagates the results: LUI/AUIPC + ADDI pairs, effective
+// addresses built from them and reads of x0 become single constants. Adds,
+// shifts and the like by zero are replaced by their other operand.
+// Side exits that are never taken are dropped, and conditional branches on
+// a constant and indirect jumps to a constant target become direct
+// branches. Constants left without uses are removed.
+class ConstantFolding : public Pass {
+public:
+  const char *getName() const override { return "constant-folding"; }
+
+  void run(ir::BasicBlock &block) const override;
+};
+
+} // namespace optimization
+} // namespace dinorisc
@@ -0,0 +1,192 @@
+#include "Optimization/DeadCodeElimination.h"
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dinorisc {
+namespace optimization {
+
+namespace {
+
+// Instructions without effects besides their value. Loads stay, since a
+// guest load outside shadow memory faults.
+bool isPure(const ir::InstructionKind &kind) {
+  return std::holds_alternative<ir::Const>(kind) ||
+         std::holds_alternative<ir::BinaryOp>(kind) ||
+         std::holds_alternative<ir::Sext>(kind) ||
+         std::holds_alternative<ir::Zext>(kind) ||
+         std::holds_alternative<ir::Trunc>(kind) ||
+         std::holds_alternative<ir::RegRead>(kind);
+}
+
+class Eliminator {
+public:
+  explicit Eliminator(ir::BasicBlock &block) : block(block) {}
+
+  void run() {
+    forwardRegisterValues(block.instructions);
+    rewriteReplacedValues();
+    dropSupersededWrites(block.instructions, block.terminator);
+    removeUnused();
+
+    auto &instructions = block.instructions;
+    instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                      [&](const ir::Instruction &inst) {
+                                        return removed.count(inst.valueId);
+                                      }),
+                       instructions.end());
+  }
+
+private:
+  ir::BasicBlock &block;
+  std::unordered_map<ir::ValueId, ir::ValueId> replacements;
+  std::unordered_set<ir::ValueId> removed;
+
+  void forwardRegisterValues(std::vector<ir::Instruction> &instructions);
+  void rewriteReplacedValues();
+  void dropSupersededWrites(std::vector<ir::Instruction> &instructions,
+                            const ir::Terminator &terminator);
+  void removeUnused();
+};
+
+// Track the value each guest register holds in GuestState through the block
+void Eliminator::forwardRegisterValues(
+    std::vector<ir::Instruction> &instructions) {
+  std::unordered_map<uint32_t, ir::ValueId> known;
+  auto resolve = [&](ir::ValueId value) {
+    for (auto it = replacements.find(value); it != replacements.end();
+         it = replacements.find(value)) {
+      value = it->second;
+    }
+    return value;
+  };
+  auto holds = [&](uint32_t regNumber, ir::ValueId value) {
+    auto it = known.find(regNumber);
+    return it != known.end() && it->second == resolve(value);
+  };
+
+  for (auto &inst : instructions) {
+    if (auto regRead = std::get_if<ir::RegRead>(&inst.kind)) {
+      auto it = known.find(regRead->regNumber);
+      if (it != known.end()) {
+        replacements[inst.valueId] = it->second;
+        removed.insert(inst.valueId);
+      } else {
+        known[regRead->regNumber] = inst.valueId;
+      }
+    } else if (auto regWrite = std::get_if<ir::RegWrite>(&inst.kind)) {
+      if (holds(regWrite->regNumber, regWrite->value)) {
+        removed.insert(inst.valueId);
+      } else {
+        known[regWrite->regNumber] = resolve(regWrite->value);
+      }
+    } else if (auto sideExit = std::get_if<ir::SideExit>(&inst.kind)) {
+      // Its writes only happen when the exit is taken
+      auto &writes = sideExit->writes;
+      writes.erase(std::remove_if(writes.begin(), writes.end(),
+                                  [&](const ir::RegWrite &write) {
+                                    return holds(write.regNumber, write.value);
+                                  }),
+                   writes.end());
+    }
+  }
+}
+
+void Eliminator::rewriteReplacedValues() {
+  auto rewrite = [&](ir::ValueId &value) {
+    for (auto it = replacements.find(value); it != replacements.end();
+         it = replacements.find(value)) {
+      value = it->second;
+    }
+  };
+  for (auto &inst : block.instructions) {
+    ir::forEachOperand(inst, rewrite);
+  }
+  ir::forEachOperand(block.terminator, rewrite);
+}
+
+// Walk the block backwards collecting the registers that are written again
+// before control can leave with the earlier value
+void Eliminator::dropSupersededWrites(
+    std::vector<ir::Instruction> &instructions,
+    const ir::Terminator &terminator) {
+  std::unordered_set<uint32_t> overwritten;
+  std::visit(
+      [&](const auto &kind) {
+        using T = std::decay_t<decltype(kind)>;
+        if constexpr (!std::is_same_v<T, ir::CondBranch>) {
+          if (kind.link) {
+            overwritten.insert(kind.link->regNum);
+          }
+        }
+      },
+      terminator.kind);
+
+  for (auto it = instructions.rbegin(); it != instructions.rend(); ++it) {
+    if (removed.count(it->valueId)) {
+      continue;
+    }
+    if (auto regWrite = std::get_if<ir::RegWrite>(&it->kind)) {
+      if (!overwritten.insert(regWrite->regNumber).second) {
+        removed.insert(it->valueId);
+      }
+    } else if (auto regRead = std::get_if<ir::RegRead>(&it->kind)) {
+      overwritten.erase(regRead->regNumber);
+    } else if (auto sideExit = std::get_if<ir::SideExit>(&it->kind)) {
+      // Leaving here keeps earlier writes unless the exit writes them too
+      std::unordered_set<uint32_t> writtenOnExit;
+      for (const auto &write : sideExit->writes) {
+        if (overwritten.count(write.regNumber)) {
+          writtenOnExit.insert(write.regNumber);
+        }
+      }
+      overwritten = std::move(writtenOnExit);
+    }
+  }
+}
+
+void Eliminator::removeUnused() {
+  std::unordered_map<ir::ValueId, size_t> uses;
+  std::unordered_map<ir::ValueId, ir::Instruction *> definitions;
+  for (auto &inst : block.instructions) {
+    if (removed.count(inst.valueId)) {
+      continue;
+    }
+    definitions[inst.valueId] = &inst;
+    ir::forEachOperand(inst, [&](ir::ValueId value) { ++uses[value]; });
+  }
+  ir::forEachOperand(block.terminator,
+                     [&](ir::ValueId value) { ++uses[value]; });
+
+  std::vector<ir::Instruction *> worklist;
+  for (const auto &[value, inst] : definitions) {
+    if (isPure(inst->kind) && !uses.count(value)) {
+      worklist.push_back(inst);
+    }
+  }
+
+  // Removing an instruction may leave its operands unused in turn
+  while (!worklist.empty()) {
+    ir::Instruction *inst = worklist.back();
+    worklist.pop_back();
+    if (!removed.insert(inst->valueId).second) {
+      continue;
+    }
+    ir::forEachOperand(*inst, [&](ir::ValueId value) {
+      auto definition = definitions.find(value);
+      if (--uses[value] == 0 && definition != definitions.end() &&
+          isPure(definition->second->kind)) {
+        worklist.push_back(definition->second);
+      }
+    });
+  }
+}
+
+} // namespace
+
+void DeadCodeElimination::run(ir::BasicBlock &block) const {
+  Eliminator(block).run();
+}
+
+} // namespace optimization
+} // namespace dinorisc
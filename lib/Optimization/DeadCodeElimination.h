@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Optimization/PassManager.h"
+
+namespace dinorisc {
+namespace optimization {
+
+// Removes pure instructions nobody uses, by use counts, together with
+// redundant guest register traffic: reads of a register whose value is
+// already known in the block reuse that value, and write-backs are dropped
+// when the register already holds the value or when a later write in the
+// same block (including the link write of its jump) replaces it before
+// anything can see it.
+class DeadCodeElimination : public Pass {
+public:
+  const char *getName() const override { return "dead-code-elimination"; }
+
+  void run(ir::BasicBlock &block) const override;
+};
+
+} // namespace optimization
+} // namespace dinorisc
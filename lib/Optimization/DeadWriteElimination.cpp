@@ -0,0 +1,11 @@
+#include "Optimization/DeadWriteElimination.h"
+
+namespace dinorisc {
+namespace optimization {
+
+void DeadWriteElimination::run(ir::BasicBlock &block) const {
+  liveness.removeDeadWrites(block);
+}
+
+} // namespace optimization
+} // namespace dinorisc
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Optimization/PassManager.h"
+#include "RegisterLiveness.h"
+
+namespace dinorisc {
+namespace optimization {
+
+// Drops guest register write-backs that no code after the block or trace
+// reads, as decided by the RegisterLiveness of the whole binary. Runs first,
+// so the passes after it see fewer uses of the values written back.
+class DeadWriteElimination : public Pass {
+public:
+  explicit DeadWriteElimination(const RegisterLiveness &liveness)
+      : liveness(liveness) {}
+
+  const char *getName() const override { return "dead-write-elimination"; }
+
+  void run(ir::BasicBlock &block) const override;
+
+private:
+  const RegisterLiveness &liveness;
+};
+
+} // namespace optimization
+} // namespace dinorisc
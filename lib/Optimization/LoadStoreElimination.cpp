@@ -0,0 +1,274 @@
+#include "Optimization/LoadStoreElimination.h"
+#include <algorithm>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dinorisc {
+namespace optimization {
+
+namespace {
+
+constexpr uint32_t REG_SP = 2;
+
+// Bytes [base + offset, base + offset + size); no base means an absolute
+// address
+struct Location {
+  std::optional<ir::ValueId> base;
+  int64_t offset;
+  int64_t size;
+};
+
+int64_t sizeOf(ir::Type type) {
+  switch (type) {
+  case ir::Type::i1:
+  case ir::Type::i8:
+    return 1;
+  case ir::Type::i16:
+    return 2;
+  case ir::Type::i32:
+    return 4;
+  case ir::Type::i64:
+    return 8;
+  }
+  return 8;
+}
+
+class Eliminator {
+public:
+  explicit Eliminator(ir::BasicBlock &block);
+
+  void run();
+
+private:
+  // What a location is known to hold: the value stored to it or loaded
+  // from it
+  struct Available {
+    Location location;
+    ir::Type type;
+    ir::ValueId value;
+  };
+
+  // A store nothing has read yet
+  struct PendingStore {
+    Location location;
+    ir::ValueId store;
+  };
+
+  ir::BasicBlock &block;
+  std::unordered_map<ir::ValueId, const ir::Instruction *> definitions;
+  std::unordered_map<ir::ValueId, ir::ValueId> replacements;
+  std::unordered_set<ir::ValueId> removed;
+
+  void runBlock(std::vector<ir::Instruction> &instructions);
+  Location locate(ir::ValueId address, ir::Type type) const;
+  ir::Type typeOf(ir::ValueId value) const;
+  bool isStack(const std::optional<ir::ValueId> &base) const;
+  bool mayAlias(const Location &a, const Location &b) const;
+
+  static bool isSame(const Location &a, const Location &b) {
+    return a.base == b.base && a.offset == b.offset && a.size == b.size;
+  }
+
+  static bool covers(const Location &a, const Location &b) {
+    return a.base == b.base && a.offset <= b.offset &&
+           a.offset + a.size >= b.offset + b.size;
+  }
+};
+
+Eliminator::Eliminator(ir::BasicBlock &block) : block(block) {
+  for (const auto &inst : block.instructions) {
+    definitions[inst.valueId] = &inst;
+  }
+}
+
+void Eliminator::run() {
+  runBlock(block.instructions);
+
+  auto replace = [&](ir::ValueId &value) {
+    auto it = replacements.find(value);
+    if (it != replacements.end()) {
+      value = it->second;
+    }
+  };
+  auto &instructions = block.instructions;
+  instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                    [&](const ir::Instruction &inst) {
+                                      return removed.count(inst.valueId);
+                                    }),
+                     instructions.end());
+  for (auto &inst : instructions) {
+    ir::forEachOperand(inst, replace);
+  }
+  ir::forEachOperand(block.terminator, replace);
+}
+
+void Eliminator::runBlock(std::vector<ir::Instruction> &instructions) {
+  std::vector<Available> available;
+  std::vector<PendingStore> pending;
+
+  for (auto &inst : instructions) {
+    // Loads replaced earlier in the block are never chained, since their
+    // replacement is a value that is never replaced itself
+    ir::forEachOperand(inst, [&](ir::ValueId &value) {
+      auto it = replacements.find(value);
+      if (it != replacements.end()) {
+        value = it->second;
+      }
+    });
+
+    if (auto load = std::get_if<ir::Load>(&inst.kind)) {
+      Location location = locate(load->address, load->type);
+      auto known = std::find_if(
+          available.begin(), available.end(), [&](const Available &entry) {
+            return isSame(entry.location, location) && entry.type == load->type;
+          });
+      if (known != available.end()) {
+        replacements[inst.valueId] = known->value;
+        removed.insert(inst.valueId);
+        continue;
+      }
+
+      pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                   [&](const PendingStore &store) {
+                                     return mayAlias(store.location, location);
+                                   }),
+                    pending.end());
+      available.push_back({location, load->type, inst.valueId});
+    } else if (auto store = std::get_if<ir::Store>(&inst.kind)) {
+      ir::Type type = typeOf(store->value);
+      Location location = locate(store->address, type);
+
+      // Storing what is already there
+      bool unchanged = std::any_of(
+          available.begin(), available.end(), [&](const Available &entry) {
+            return isSame(entry.location, location) && entry.type == type &&
+                   entry.value == store->value;
+          });
+      if (unchanged) {
+        removed.insert(inst.valueId);
+        continue;
+      }
+
+      // Earlier stores nothing read that this one overwrites are dead
+      pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                   [&](const PendingStore &earlier) {
+                                     if (!covers(location, earlier.location)) {
+                                       return false;
+                                     }
+                                     removed.insert(earlier.store);
+                                     return true;
+                                   }),
+                    pending.end());
+
+      available.erase(std::remove_if(available.begin(), available.end(),
+                                     [&](const Available &entry) {
+                                       return mayAlias(entry.location,
+                                                       location);
+                                     }),
+                      available.end());
+      available.push_back({location, type, store->value});
+      pending.push_back({location, inst.valueId});
+    } else if (std::holds_alternative<ir::SideExit>(inst.kind)) {
+      // Memory is seen by whatever runs after leaving here
+      pending.clear();
+    }
+  }
+}
+
+// Split an address into a base and the constant added to it
+Location Eliminator::locate(ir::ValueId address, ir::Type type) const {
+  int64_t offset = 0;
+  while (true) {
+    auto it = definitions.find(address);
+    if (it == definitions.end()) {
+      break;
+    }
+    const auto &kind = it->second->kind;
+    if (auto constant = std::get_if<ir::Const>(&kind)) {
+      return {std::nullopt, offset + constant->value, sizeOf(type)};
+    }
+
+    auto binOp = std::get_if<ir::BinaryOp>(&kind);
+    if (!binOp || binOp->type != ir::Type::i64) {
+      break;
+    }
+    auto lhs = definitions.find(binOp->lhs);
+    auto rhs = definitions.find(binOp->rhs);
+    auto constantOf = [&](auto definition) -> const ir::Const * {
+      return definition != definitions.end()
+                 ? std::get_if<ir::Const>(&definition->second->kind)
+                 : nullptr;
+    };
+    if (binOp->opcode == ir::BinaryOpcode::Add && constantOf(rhs)) {
+      offset += constantOf(rhs)->value;
+      address = binOp->lhs;
+    } else if (binOp->opcode == ir::BinaryOpcode::Add && constantOf(lhs)) {
+      offset += constantOf(lhs)->value;
+      address = binOp->rhs;
+    } else if (binOp->opcode == ir::BinaryOpcode::Sub && constantOf(rhs)) {
+      offset -= constantOf(rhs)->value;
+      address = binOp->lhs;
+    } else {
+      break;
+    }
+  }
+  return {address, offset, sizeOf(type)};
+}
+
+ir::Type Eliminator::typeOf(ir::ValueId value) const {
+  auto it = definitions.find(value);
+  if (it == definitions.end()) {
+    return ir::Type::i64;
+  }
+  return std::visit(
+      [](const auto &kind) {
+        using T = std::decay_t<decltype(kind)>;
+        if constexpr (std::is_same_v<T, ir::Const> ||
+                      std::is_same_v<T, ir::BinaryOp> ||
+                      std::is_same_v<T, ir::Load>) {
+          return kind.type;
+        } else if constexpr (std::is_same_v<T, ir::Sext> ||
+                             std::is_same_v<T, ir::Zext> ||
+                             std::is_same_v<T, ir::Trunc>) {
+          return kind.toType;
+        } else {
+          return ir::Type::i64;
+        }
+      },
+      it->second->kind);
+}
+
+bool Eliminator::isStack(const std::optional<ir::ValueId> &base) const {
+  if (!base) {
+    return false;
+  }
+  auto it = definitions.find(*base);
+  if (it == definitions.end()) {
+    return false;
+  }
+  // Only sp is known to point into the stack. A frame pointer set up from
+  // sp in the same block has sp as its base already; one coming from
+  // elsewhere may hold any address.
+  auto regRead = std::get_if<ir::RegRead>(&it->second->kind);
+  return regRead && regRead->regNumber == REG_SP;
+}
+
+bool Eliminator::mayAlias(const Location &a, const Location &b) const {
+  if (a.base == b.base) {
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+  }
+  if ((!a.base && isStack(b.base)) || (!b.base && isStack(a.base))) {
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+void LoadStoreElimination::run(ir::BasicBlock &block) const {
+  Eliminator(block).run();
+}
+
+} // namespace optimization
+} // namespace dinorisc
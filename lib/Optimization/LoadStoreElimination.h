@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Optimization/PassManager.h"
+
+namespace dinorisc {
+namespace optimization {
+
+// Removes guest memory accesses whose effect is already known within a
+// block: loads of a location stored to or loaded before get that value,
+// stores of the value a location already holds are dropped, and so are
+// stores overwritten before anything reads them. Addresses are split into
+// a base value and a constant offset, so accesses relative to the same base
+// are told apart by their offsets. Accesses relative to sp, directly or
+// through a frame pointer computed from it in the same block, are stack
+// slots and never alias constant addresses, which is where globals live.
+// Any other pair of bases may alias, including s0 read from the guest
+// state, which optimized code uses like any callee-saved register.
+class LoadStoreElimination : public Pass {
+public:
+  const char *getName() const override { return "load-store-elimination"; }
+
+  void run(ir::BasicBlock &block) const override;
+};
+
+} // namespace optimization
+} // namespace dinorisc
@@ -0,0 +1,78 @@
+#include "Optimization/PassManager.h"
+#include "Error.h"
+#include "Optimization/CommonSubexpressionElimination.h"
+#include "Optimization/ConstantFolding.h"
+#include "Optimization/DeadCodeElimination.h"
+#include "Optimization/DeadWriteElimination.h"
+#include "Optimization/LoadStoreElimination.h"
+#include <chrono>
+
+namespace dinorisc {
+namespace optimization {
+
+PassManager::PassManager(unsigned level, const RegisterLiveness *liveness)
+    : level(level) {
+  if (level > MAX_LEVEL) {
+    throw RuntimeError("Unknown optimization level -O" +
+                       std::to_string(level));
+  }
+
+  // Write-backs only matter if the code after the block reads them
+  if (level >= 1 && liveness) {
+    addPass(std::make_unique<DeadWriteElimination>(*liveness));
+  }
+  if (level >= 1) {
+    addPass(std::make_unique<ConstantFolding>());
+  }
+  if (level >= 2) {
+    addPass(std::make_unique<CommonSubexpressionElimination>());
+    addPass(std::make_unique<LoadStoreElimination>());
+  }
+  // Cleans up after the passes before it
+  if (level >= 1) {
+    addPass(std::make_unique<DeadCodeElimination>());
+  }
+}
+
+void PassManager::addPass(std::unique_ptr<Pass> pass) {
+  PassStatistics passStatistics;
+  passStatistics.name = pass->getName();
+  statistics.push_back(passStatistics);
+  passes.push_back(std::move(pass));
+}
+
+void PassManager::run(ir::BasicBlock &block) {
+  for (size_t i = 0; i < passes.size(); ++i) {
+    size_t before = block.instructions.size();
+    auto start = std::chrono::steady_clock::now();
+    passes[i]->run(block);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    size_t after = block.instructions.size();
+
+    std::lock_guard<std::mutex> lock(statisticsMutex);
+    PassStatistics &passStatistics = statistics[i];
+    ++passStatistics.runs;
+    passStatistics.nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    passStatistics.instructionsBefore += before;
+    passStatistics.instructionsAfter += after;
+  }
+}
+
+std::vector<PassStatistics> PassManager::getStatistics() const {
+  std::lock_guard<std::mutex> lock(statisticsMutex);
+  return statistics;
+}
+
+void PassManager::printStatistics(std::ostream &os) const {
+  os << "Optimization: -O" << level << ", " << passes.size() << " passes"
+     << std::endl;
+  for (const auto &pass : getStatistics()) {
+    os << "  " << pass.name << ": " << pass.runs << " runs, "
+       << pass.nanoseconds / 1000 << " us, " << pass.instructionsBefore
+       << " -> " << pass.instructionsAfter << " IR instructions" << std::endl;
+  }
+}
+
+} // namespace optimization
+} // namespace dinorisc
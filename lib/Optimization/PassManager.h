@@ -0,0 +1,75 @@
+#pragma once
+
+#include "IR/IR.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dinorisc {
+
+class RegisterLiveness;
+
+namespace optimization {
+
+// A transformation of lifted IR. Passes keep no state between runs, so one
+// pipeline can optimize translations on several threads at once.
+class Pass {
+public:
+  virtual ~Pass() = default;
+
+  virtual const char *getName() const = 0;
+
+  virtual void run(ir::BasicBlock &block) const = 0;
+};
+
+// What a pass cost and did to the IR, summed over all its runs
+struct PassStatistics {
+  std::string name;
+  uint64_t runs = 0;
+  uint64_t nanoseconds = 0;
+  uint64_t instructionsBefore = 0;
+  uint64_t instructionsAfter = 0;
+};
+
+// Runs an ordered pipeline of passes between lifting and instruction
+// selection, timing each pass and counting IR instructions before and after
+// it. Safe to run from several threads.
+class PassManager {
+public:
+  // -O levels: 0 runs no passes, each level up adds more
+  static constexpr unsigned MAX_LEVEL = 2;
+  static constexpr unsigned DEFAULT_LEVEL = 1;
+
+  // The standard pipeline of an -O level. Write-backs of dead guest
+  // registers are only dropped if the liveness of the binary is given.
+  explicit PassManager(unsigned level = 0,
+                       const RegisterLiveness *liveness = nullptr);
+
+  PassManager(const PassManager &) = delete;
+  PassManager &operator=(const PassManager &) = delete;
+
+  // Append a pass to the end of the pipeline
+  void addPass(std::unique_ptr<Pass> pass);
+
+  unsigned getLevel() const { return level; }
+  size_t getPassCount() const { return passes.size(); }
+
+  void run(ir::BasicBlock &block);
+
+  // One entry per pass, in pipeline order
+  std::vector<PassStatistics> getStatistics() const;
+  void printStatistics(std::ostream &os) const;
+
+private:
+  unsigned level;
+  std::vector<std::unique_ptr<Pass>> passes;
+
+  mutable std::mutex statisticsMutex;
+  std::vector<PassStatistics> statistics;
+};
+
+} // namespace optimization
+} // namespace dinorisc
@@ -0,0 +1,244 @@
+#include "RegisterLiveness.h"
+#include "Error.h"
+#include <algorithm>
+
+namespace dinorisc {
+
+namespace {
+
+using Opcode = riscv::Instruction::Opcode;
+
+constexpr uint64_t INSTRUCTION_SIZE = 4;
+constexpr uint32_t REG_ZERO = 0;
+constexpr uint32_t REG_RA = 1;
+
+RegisterSet bit(uint32_t regNum) { return RegisterSet(1) << regNum; }
+
+struct Access {
+  RegisterSet reads = 0;
+  RegisterSet writes = 0;
+};
+
+Access accessOf(const riscv::Instruction &inst) {
+  Access access;
+  switch (inst.opcode) {
+  case Opcode::ECALL:
+  case Opcode::EBREAK:
+  case Opcode::INVALID:
+    // Nothing after these is known
+    access.reads = RegisterLiveness::ALL_REGISTERS;
+    return access;
+  default:
+    break;
+  }
+
+  // Stores and branches only read their registers; everything else writes
+  // its first operand
+  bool hasDestination = true;
+  switch (inst.opcode) {
+  case Opcode::SB:
+  case Opcode::SH:
+  case Opcode::SW:
+  case Opcode::SD:
+  case Opcode::BEQ:
+  case Opcode::BNE:
+  case Opcode::BLT:
+  case Opcode::BGE:
+  case Opcode::BLTU:
+  case Opcode::BGEU:
+    hasDestination = false;
+    break;
+  default:
+    break;
+  }
+
+  for (size_t i = 0; i < inst.operands.size(); ++i) {
+    auto reg = std::get_if<riscv::Instruction::Register>(&inst.operands[i]);
+    if (!reg) {
+      continue;
+    }
+    if (i == 0 && hasDestination) {
+      access.writes |= bit(reg->value);
+    } else {
+      access.reads |= bit(reg->value);
+    }
+  }
+  access.reads &= ~bit(REG_ZERO);
+  access.writes &= ~bit(REG_ZERO);
+  return access;
+}
+
+// Registers live after a block ending in inst that don't come from its
+// edges, given how many of them the graph kept
+RegisterSet exitRegisters(const riscv::Instruction &inst, uint32_t edgeCount) {
+  size_t expectedEdges = 1;
+  switch (inst.opcode) {
+  case Opcode::JALR:
+    if (inst.getRegister(0) == REG_ZERO && inst.getRegister(1) == REG_RA &&
+        inst.getImmediate(2) == 0) {
+      return RegisterLiveness::RETURN_REGISTERS;
+    }
+    return RegisterLiveness::ALL_REGISTERS;
+  case Opcode::JAL:
+    expectedEdges = inst.getRegister(0) == REG_ZERO ? 1 : 2;
+    break;
+  case Opcode::BEQ:
+  case Opcode::BNE:
+  case Opcode::BLT:
+  case Opcode::BGE:
+  case Opcode::BLTU:
+  case Opcode::BGEU:
+    expectedEdges = 2;
+    break;
+  default:
+    break;
+  }
+  return edgeCount < expectedEdges ? RegisterLiveness::ALL_REGISTERS : 0;
+}
+
+} // namespace
+
+RegisterLiveness::RegisterLiveness(const ControlFlowGraph &cfg,
+                                   const riscv::Decoder &decoder,
+                                   const std::vector<uint8_t> &textSection,
+                                   uint64_t textBaseAddress)
+    : textBaseAddress(textBaseAddress),
+      liveIn(textSection.size() / INSTRUCTION_SIZE, ALL_REGISTERS) {
+  const auto &blocks = cfg.getBlocks();
+  const auto &edges = cfg.getEdges();
+
+  std::vector<Access> accesses(liveIn.size());
+  std::vector<RegisterSet> exits(blocks.size());
+  for (size_t b = 0; b < blocks.size(); ++b) {
+    const CFGBlock &block = blocks[b];
+    size_t first = (block.address - textBaseAddress) / INSTRUCTION_SIZE;
+    riscv::Instruction inst;
+    for (size_t i = first; i < first + block.instructionCount; ++i) {
+      try {
+        inst = decoder.decode(textSection.data(), i * INSTRUCTION_SIZE,
+                              textBaseAddress + i * INSTRUCTION_SIZE);
+      } catch (const DecodingError &) {
+        inst = riscv::Instruction();
+      }
+      accesses[i] = accessOf(inst);
+    }
+    exits[b] = exitRegisters(inst, block.edgeCount);
+  }
+
+  // Live-in of a block from its live-out, filling in its instructions
+  auto transfer = [&](size_t b, RegisterSet live) {
+    const CFGBlock &block = blocks[b];
+    size_t first = (block.address - textBaseAddress) / INSTRUCTION_SIZE;
+    for (size_t i = first + block.instructionCount; i-- > first;) {
+      live = (live & ~accesses[i].writes) | accesses[i].reads;
+      liveIn[i] = live;
+    }
+    return live;
+  };
+
+  // Blocks start out with nothing live and only grow; going backwards over
+  // the blocks gets most edges right in the first round
+  std::vector<RegisterSet> blockLiveIn(blocks.size(), 0);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = blocks.size(); b-- > 0;) {
+      const CFGBlock &block = blocks[b];
+      RegisterSet live = exits[b];
+      for (uint32_t e = 0; e < block.edgeCount; ++e) {
+        live |= blockLiveIn[edges[block.firstEdge + e].target];
+      }
+      live = transfer(b, live);
+      if (live != blockLiveIn[b]) {
+        blockLiveIn[b] = live;
+        changed = true;
+      }
+    }
+  }
+}
+
+RegisterSet RegisterLiveness::getLiveIn(uint64_t pc) const {
+  if (pc < textBaseAddress || (pc - textBaseAddress) % INSTRUCTION_SIZE != 0) {
+    return ALL_REGISTERS;
+  }
+  uint64_t index = (pc - textBaseAddress) / INSTRUCTION_SIZE;
+  return index < liveIn.size() ? liveIn[index] : ALL_REGISTERS;
+}
+
+RegisterSet
+RegisterLiveness::getLiveOut(const ir::Terminator &terminator) const {
+  return std::visit(
+      [&](const auto &kind) -> RegisterSet {
+        using T = std::decay_t<decltype(kind)>;
+        if constexpr (std::is_same_v<T, ir::Branch>) {
+          // A call's callee reads its arguments and passes on whatever the
+          // code after the call reads
+          RegisterSet live = getLiveIn(kind.targetBlock);
+          if (kind.link) {
+            live |= getLiveIn(kind.link->returnAddress);
+          }
+          return live;
+        } else if constexpr (std::is_same_v<T, ir::CondBranch>) {
+          return getLiveIn(kind.trueBlock) | getLiveIn(kind.falseBlock);
+        } else {
+          return kind.isFunctionReturn ? RETURN_REGISTERS : ALL_REGISTERS;
+        }
+      },
+      terminator.kind);
+}
+
+size_t RegisterLiveness::removeDeadWrites(ir::BasicBlock &block) const {
+  RegisterSet live = getLiveOut(block.terminator);
+  std::visit(
+      [&](const auto &kind) {
+        if constexpr (!std::is_same_v<std::decay_t<decltype(kind)>,
+                                      ir::CondBranch>) {
+          // The link register is written after everything else
+          if (kind.link) {
+            live &= ~bit(kind.link->regNum);
+          }
+        }
+      },
+      block.terminator.kind);
+
+  size_t removed = 0;
+  std::vector<bool> dead(block.instructions.size(), false);
+  for (size_t i = block.instructions.size(); i-- > 0;) {
+    auto &kind = block.instructions[i].kind;
+    if (auto write = std::get_if<ir::RegWrite>(&kind)) {
+      if (!(live & bit(write->regNumber))) {
+        dead[i] = true;
+        ++removed;
+      }
+      live &= ~bit(write->regNumber);
+    } else if (auto read = std::get_if<ir::RegRead>(&kind)) {
+      live |= bit(read->regNumber);
+    } else if (auto sideExit = std::get_if<ir::SideExit>(&kind)) {
+      RegisterSet exitLive = getLiveIn(sideExit->target);
+      auto &writes = sideExit->writes;
+      size_t before = writes.size();
+      writes.erase(std::remove_if(writes.begin(), writes.end(),
+                                  [&](const ir::RegWrite &write) {
+                                    return !(exitLive & bit(write.regNumber));
+                                  }),
+                   writes.end());
+      removed += before - writes.size();
+      for (const auto &write : writes) {
+        exitLive &= ~bit(write.regNumber);
+      }
+      live |= exitLive;
+    }
+  }
+
+  std::vector<ir::Instruction> kept;
+  kept.reserve(block.instructions.size());
+  for (size_t i = 0; i < block.instructions.size(); ++i) {
+    if (!dead[i]) {
+      kept.push_back(std::move(block.instructions[i]));
+    }
+  }
+  block.instructions = std::move(kept);
+  return removed;
+}
+
+} // namespace dinorisc
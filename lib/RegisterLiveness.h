@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ControlFlowGraph.h"
+#include "IR/IR.h"
+#include "RISCV/Decoder.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dinorisc {
+
+// Guest registers as a bit set, bit n standing for xn
+using RegisterSet = uint32_t;
+
+// Which guest registers may still be read at each instruction of a binary,
+// computed once at load time over its ControlFlowGraph. Calls are assumed
+// to read what the callee and the code after the call read. A return is
+// assumed to follow the standard calling convention, so only a0/a1, sp,
+// gp, tp and the callee-saved registers are live after it. Everything is
+// live where the graph doesn't know what runs next: after indirect jumps
+// and calls, at successors it dropped and at code it never found.
+class RegisterLiveness {
+public:
+  // Every register but x0
+  static constexpr RegisterSet ALL_REGISTERS = ~RegisterSet(1);
+
+  // sp, gp, tp, s0-s1, a0-a1 and s2-s11
+  static constexpr RegisterSet RETURN_REGISTERS =
+      (1u << 2) | (1u << 3) | (1u << 4) | (0x3u << 8) | (0x3u << 10) |
+      (0x3ffu << 18);
+
+  RegisterLiveness(const ControlFlowGraph &cfg, const riscv::Decoder &decoder,
+                   const std::vector<uint8_t> &textSection,
+                   uint64_t textBaseAddress);
+
+  // Registers that may be read before they are written from pc on
+  RegisterSet getLiveIn(uint64_t pc) const;
+
+  // Drop the register write-backs of a lifted block or trace that none of
+  // its exits goes on to read. Returns how many were dropped.
+  size_t removeDeadWrites(ir::BasicBlock &block) const;
+
+private:
+  uint64_t textBaseAddress;
+
+  // Live-in set of every instruction of the text section
+  std::vector<RegisterSet> liveIn;
+
+  RegisterSet getLiveOut(const ir::Terminator &terminator) const;
+};
+
+} // namespace dinorisc
@@ -0,0 +1,48 @@
+#include "Session.h"
+#include "Error.h"
+
+namespace dinorisc {
+
+Session::Session(size_t shadowMemorySize)
+    : context(shadowMemorySize), calls(0) {}
+
+void Session::load(const std::string &inputPath) {
+  const GuestState &state = context.getState();
+  translator.getLog() << "Shadow memory allocated: " << state.shadowMemorySize
+                      << " bytes at host " << state.shadowMemory
+                      << ", guest base 0x" << std::hex
+                      << state.guestMemoryBase << ", stack at 0x"
+                      << context.getStackTop() << std::dec << std::endl;
+
+  translator.load(inputPath);
+  calls = 0;
+}
+
+uint64_t Session::resolve(const std::string &functionName) const {
+  auto address = translator.getFunctionAddress(functionName);
+  if (!address.has_value()) {
+    throw ELFError("Function '" + functionName + "' not found in binary");
+  }
+  return address.value();
+}
+
+CallResult Session::call(uint64_t address, const std::vector<uint64_t> &args) {
+  if (args.size() > MAX_ARGUMENTS) {
+    throw RuntimeError("Too many arguments: " + std::to_string(args.size()) +
+                       " (at most " + std::to_string(MAX_ARGUMENTS) + ")");
+  }
+
+  // Nothing the previous call left in registers or the stack pointer
+  // leaks into this one
+  context.reset();
+  GuestState &state = context.getState();
+  for (size_t i = 0; i < args.size(); ++i) {
+    state.x[10 + i] = args[i];
+  }
+
+  translator.run(context, address);
+  ++calls;
+  return {state.x[10], state.x[11]};
+}
+
+} // namespace dinorisc
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "BinaryTranslator.h"
+#include "GuestContext.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dinorisc {
+
+// Both integer return registers of a guest call
+struct CallResult {
+  uint64_t a0;
+  uint64_t a1;
+};
+
+// A binary loaded once and called any number of times. Every call starts
+// from reset registers and stack in the same context, while the code cache
+// and the tier-up state carry over, so repeated calls run warm.
+//
+// A session is used from one thread at a time; concurrent callers each need
+// a GuestContext of their own (see BinaryTranslator::run).
+class Session {
+public:
+  // Integer arguments are passed in a0-a7
+  static constexpr size_t MAX_ARGUMENTS = 8;
+
+  explicit Session(
+      size_t shadowMemorySize = GuestContext::DEFAULT_SHADOW_MEMORY_SIZE);
+
+  // Configure the translator before load()
+  BinaryTranslator &getTranslator() { return translator; }
+  const BinaryTranslator &getTranslator() const { return translator; }
+
+  GuestContext &getContext() { return context; }
+
+  void load(const std::string &inputPath);
+
+  // Guest address of a function, throwing ELFError if there is none
+  uint64_t resolve(const std::string &functionName) const;
+
+  CallResult call(uint64_t address, const std::vector<uint64_t> &args);
+  CallResult call(const std::string &functionName,
+                  const std::vector<uint64_t> &args) {
+    return call(resolve(functionName), args);
+  }
+
+  template <typename... Args>
+  CallResult call(const std::string &functionName, Args... args) {
+    return call(resolve(functionName),
+                std::vector<uint64_t>{static_cast<uint64_t>(args)...});
+  }
+
+  // Calls made since load()
+  uint64_t getCalls() const { return calls; }
+
+private:
+  BinaryTranslator translator;
+  GuestContext context;
+  uint64_t calls;
+};
+
+} // namespace dinorisc
@@ -0,0 +1,97 @@
+#include "TraceBuilder.h"
+#include "Error.h"
+#include "Lifter.h"
+#include <sstream>
+#include <unordered_set>
+
+namespace dinorisc {
+
+TraceBuilder::TraceBuilder(const riscv::Decoder &decoder,
+                           const std::vector<uint8_t> &textSection,
+                           uint64_t textBaseAddress)
+    : decoder(decoder), textSection(textSection),
+      textBaseAddress(textBaseAddress) {}
+
+Trace TraceBuilder::buildTrace(uint64_t pc, size_t maxBlocks) const {
+  if (!isInText(pc)) {
+    std::ostringstream oss;
+    oss << "PC out of bounds: 0x" << std::hex << pc;
+    throw RuntimeError(oss.str());
+  }
+
+  Lifter lifter;
+  Trace trace{{}, 1};
+  std::unordered_set<uint64_t> visited;
+  uint64_t currentPC = pc;
+
+  while (true) {
+    riscv::Instruction inst = decodeAt(currentPC);
+    trace.instructions.push_back(inst);
+    visited.insert(currentPC);
+
+    if (trace.instructions.size() >= MAX_TRACE_INSTRUCTIONS) {
+      break;
+    }
+
+    uint64_t nextPC = currentPC + 4;
+    if (lifter.isTerminator(inst)) {
+      if (trace.blockCount >= maxBlocks) {
+        break;
+      }
+
+      auto successor = likelySuccessor(inst);
+      if (!successor || visited.count(*successor)) {
+        break;
+      }
+      nextPC = *successor;
+      ++trace.blockCount;
+    }
+
+    if (!isInText(nextPC)) {
+      break;
+    }
+    currentPC = nextPC;
+  }
+
+  return trace;
+}
+
+std::optional<uint64_t>
+TraceBuilder::likelySuccessor(const riscv::Instruction &inst) {
+  switch (inst.opcode) {
+  case riscv::Instruction::Opcode::JAL:
+    // Calls end the trace so the return can be predicted
+    if (inst.getRegister(0) != 0) {
+      return std::nullopt;
+    }
+    return inst.address + inst.getImmediate(1);
+  case riscv::Instruction::Opcode::BEQ:
+  case riscv::Instruction::Opcode::BNE:
+  case riscv::Instruction::Opcode::BLT:
+  case riscv::Instruction::Opcode::BGE:
+  case riscv::Instruction::Opcode::BLTU:
+  case riscv::Instruction::Opcode::BGEU: {
+    int64_t offset = inst.getImmediate(2);
+    return offset < 0 ? inst.address + offset : inst.address + 4;
+  }
+  default:
+    return std::nullopt;
+  }
+}
+
+bool TraceBuilder::isInText(uint64_t pc) const {
+  return pc >= textBaseAddress && pc < textBaseAddress + textSection.size();
+}
+
+riscv::Instruction TraceBuilder::decodeAt(uint64_t pc) const {
+  riscv::Instruction inst =
+      decoder.decode(textSection.data(), pc - textBaseAddress, pc);
+  if (!inst.isValid()) {
+    std::ostringstream oss;
+    oss << "Invalid instruction at PC=0x" << std::hex << pc;
+    throw DecodingError(oss.str());
+  }
+  return inst;
+}
+
+} // namespace dinorisc
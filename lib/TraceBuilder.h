@@ -0,0 +1,52 @@
+#pragma once
+
+#include "RISCV/Decoder.h"
+#include "RISCV/Instruction.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace dinorisc {
+
+// A straight-line path of guest instructions that may span several basic
+// blocks. Every control transfer but the last continues at the next
+// instruction of the trace.
+struct Trace {
+  std::vector<riscv::Instruction> instructions;
+  size_t blockCount;
+};
+
+// Decodes traces from the text section. A trace continues through direct
+// jumps (JAL x0) and along the likely side of conditional branches, and
+// ends at calls, indirect jumps, branches back into the trace, or when it
+// gets too long.
+class TraceBuilder {
+public:
+  static constexpr size_t MAX_TRACE_BLOCKS = 8;
+  static constexpr size_t MAX_TRACE_INSTRUCTIONS = 128;
+
+  TraceBuilder(const riscv::Decoder &decoder,
+               const std::vector<uint8_t> &textSection,
+               uint64_t textBaseAddress);
+
+  // Decode the trace starting at pc. With maxBlocks = 1 this is the plain
+  // basic block at pc.
+  Trace buildTrace(uint64_t pc, size_t maxBlocks = MAX_TRACE_BLOCKS) const;
+
+  // The successor a trace should follow after a control transfer, or
+  // nullopt if the trace must end there. Backward conditional branches are
+  // assumed taken (loops) and forward ones not taken.
+  static std::optional<uint64_t>
+  likelySuccessor(const riscv::Instruction &inst);
+
+private:
+  const riscv::Decoder &decoder;
+  const std::vector<uint8_t> &textSection;
+  uint64_t textBaseAddress;
+
+  bool isInText(uint64_t pc) const;
+  riscv::Instruction decodeAt(uint64_t pc) const;
+};
+
+} // namespace dinorisc
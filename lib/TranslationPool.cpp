@@ -0,0 +1,147 @@
+#include "TranslationPool.h"
+#include "Error.h"
+#include <algorithm>
+
+namespace dinorisc {
+
+static constexpr size_t MAX_DEFAULT_THREADS = 2;
+
+TranslationPool::TranslationPool(size_t threadCount, CompileFunction compile)
+    : compile(std::move(compile)), busyWorkers(0), stopping(false), queued(0),
+      completedCount(0), taken(0), cancelled(0), failures(0) {
+  for (size_t i = 0; i < threadCount; ++i) {
+    workers.emplace_back(&TranslationPool::workerLoop, this);
+  }
+}
+
+TranslationPool::~TranslationPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  workAvailable.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+size_t TranslationPool::defaultThreadCount() {
+  size_t cores = std::thread::hardware_concurrency();
+  return cores > 1 ? std::min(cores - 1, MAX_DEFAULT_THREADS) : 0;
+}
+
+bool TranslationPool::enqueue(const TranslationRequest &request) {
+  if (workers.empty()) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending.count(request.pc) || completed.count(request.pc)) {
+      return false;
+    }
+    pending.insert(request.pc);
+    queue.push_back(request);
+    ++queued;
+  }
+  workAvailable.notify_one();
+  return true;
+}
+
+bool TranslationPool::contains(uint64_t pc) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending.count(pc) || completed.count(pc);
+}
+
+std::optional<Translation> TranslationPool::take(uint64_t pc) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = completed.find(pc);
+  if (it != completed.end()) {
+    Translation translation = std::move(it->second);
+    completed.erase(it);
+    ++taken;
+    return translation;
+  }
+
+  auto queuedRequest =
+      std::find_if(queue.begin(), queue.end(),
+                   [pc](const TranslationRequest &r) { return r.pc == pc; });
+  if (queuedRequest != queue.end()) {
+    queue.erase(queuedRequest);
+    pending.erase(pc);
+    ++cancelled;
+  }
+  return std::nullopt;
+}
+
+void TranslationPool::reset() {
+  std::unique_lock<std::mutex> lock(mutex);
+  queue.clear();
+  workersIdle.wait(lock, [this] { return busyWorkers == 0; });
+  completed.clear();
+  pending.clear();
+}
+
+uint64_t TranslationPool::getQueued() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return queued;
+}
+
+uint64_t TranslationPool::getCompleted() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return completedCount;
+}
+
+uint64_t TranslationPool::getTaken() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return taken;
+}
+
+uint64_t TranslationPool::getCancelled() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return cancelled;
+}
+
+uint64_t TranslationPool::getFailures() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return failures;
+}
+
+void TranslationPool::workerLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    workAvailable.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+
+    TranslationRequest request = queue.front();
+    queue.pop_front();
+    ++busyWorkers;
+    lock.unlock();
+
+    // Blocks that fail to translate are left for the dispatcher, which
+    // falls back to the interpreter for them
+    std::optional<Translation> translation;
+    try {
+      translation = compile(request);
+    } catch (const Error &) {
+    }
+
+    lock.lock();
+    --busyWorkers;
+    pending.erase(request.pc);
+    if (translation) {
+      completed.emplace(request.pc, std::move(*translation));
+      ++completedCount;
+    } else {
+      ++failures;
+    }
+    if (busyWorkers == 0) {
+      workersIdle.notify_all();
+    }
+  }
+}
+
+} // namespace dinorisc
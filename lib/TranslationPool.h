@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Lowering/InstructionSelector.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace dinorisc {
+
+// A block to translate off the dispatcher thread
+struct TranslationRequest {
+  uint64_t pc;
+  unsigned tier;
+  // Tier-up counter slot reserved for a baseline translation
+  std::optional<size_t> counterIndex;
+};
+
+// Machine code for a block that hasn't been installed in code memory yet
+struct Translation {
+  uint64_t guestAddress = 0;
+  unsigned tier = 0;
+  std::optional<size_t> counterIndex;
+  size_t guestInstructionCount = 0;
+  size_t blockCount = 0;
+  // Whether a trace had to be retried as a single block
+  bool fellBack = false;
+  std::vector<uint8_t> machineCode;
+  std::vector<lowering::BlockExit> exits;
+};
+
+// Worker threads that translate blocks ahead of the dispatcher needing
+// them. Workers only produce machine code; installing it in the code
+// arena and cache is left to the dispatcher thread, which picks up
+// finished translations with take().
+class TranslationPool {
+public:
+  // Must be safe to call from several threads at once
+  using CompileFunction =
+      std::function<Translation(const TranslationRequest &)>;
+
+  // 0 threads gives a pool that never queues anything
+  TranslationPool(size_t threadCount, CompileFunction compile);
+  ~TranslationPool();
+
+  TranslationPool(const TranslationPool &) = delete;
+  TranslationPool &operator=(const TranslationPool &) = delete;
+
+  // Leave one core for the dispatcher and don't take more than two
+  static size_t defaultThreadCount();
+
+  // Queue a block unless it is already queued, being translated or
+  // finished. Returns whether it was queued.
+  bool enqueue(const TranslationRequest &request);
+
+  // Whether pc is queued, being translated or finished
+  bool contains(uint64_t pc) const;
+
+  // Hand over the finished translation of pc. A request that no worker
+  // has started yet is cancelled, since the caller is about to translate
+  // the block itself.
+  std::optional<Translation> take(uint64_t pc);
+
+  // Drop all queued and finished work and wait for running translations,
+  // so the inputs of the compile function can be changed afterwards
+  void reset();
+
+  size_t getThreadCount() const { return workers.size(); }
+  uint64_t getQueued() const;
+  uint64_t getCompleted() const;
+  uint64_t getTaken() const;
+  uint64_t getCancelled() const;
+  uint64_t getFailures() const;
+
+private:
+  CompileFunction compile;
+  std::vector<std::thread> workers;
+
+  mutable std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workersIdle;
+  std::deque<TranslationRequest> queue;
+  std::unordered_map<uint64_t, Translation> completed;
+  // Blocks that are queued or being translated
+  std::unordered_set<uint64_t> pending;
+  size_t busyWorkers;
+  bool stopping;
+
+  uint64_t queued;
+  uint64_t completedCount;
+  uint64_t taken;
+  uint64_t cancelled;
+  uint64_t failures;
+
+  void workerLoop();
+};
+
+} // namespace dinorisc
@@ -0,0 +1,14 @@
+// Loop whose body branches both ways on alternate iterations, so traces
+// through it leave early through a side exit every other time
+
+int alternating_sum(int n) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    if (i & 1) {
+      sum += i;
+    } else {
+      sum -= 1;
+    }
+  }
+  return sum;
+}
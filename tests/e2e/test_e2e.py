@@ -69,6 +69,9 @@ TEST_CASES = [
     ("fibonacci.c", "fibonacci", [5], 5),  # F(5) = 5
     ("fibonacci.c", "fibonacci", [10], 55),  # F(10) = 55
     ("fibonacci.c", "fibonacci", [15], 610),  # F(15) = 610
+    # Loop leaving its trace early every other iteration
+    ("side_exit.c", "alternating_sum", [10], 20),  # 1+3+5+7+9 - 5 = 20
+    ("side_exit.c", "alternating_sum", [1000], 249500),
 ]
 
 
@@ -124,5 +127,69 @@ def test_dinorisc_execution(
     assert int(match.group(1)) == expected_return
 
 
+def run_with_limit(elf_path, function_name, args, limit, extra=()):
+    cmd = (
+        [str(DINORISC_BIN), f"--instruction-limit={limit}"]
+        + list(extra)
+        + [elf_path, function_name]
+        + [str(a) for a in args]
+    )
+    return subprocess.run(cmd, capture_output=True, text=True, timeout=30)
+
+
+def test_exact_instruction_limit(compiled_elfs):
+    """A limit of exactly the instructions a call runs is enough, even when
+    translated traces take side exits on most iterations."""
+    if not DINORISC_BIN.exists():
+        pytest.skip("dinorisc binary not found")
+
+    elf_path = compiled_elfs["side_exit.c"]
+    args = [1000]
+
+    # The interpreter counts every instruction it runs
+    result = run_with_limit(
+        elf_path, "alternating_sum", args, 10**9, ["--interpret-only"]
+    )
+    assert result.returncode == 0, result.stderr
+    match = re.search(
+        r"Interpreter: \d+ blocks, (\d+) instructions", result.stdout
+    )
+    assert match, f"Could not parse instruction count: {result.stdout}"
+    executed = int(match.group(1))
+
+    # Hot blocks become traces right away
+    translated = ["--tier-up-threshold=0", "--interpret-threshold=0"]
+    result = run_with_limit(
+        elf_path, "alternating_sum", args, executed, translated
+    )
+    assert result.returncode == 0, result.stderr
+    assert "returned: 249500" in result.stdout
+
+    result = run_with_limit(
+        elf_path, "alternating_sum", args, executed - 1, translated
+    )
+    assert result.returncode != 0
+    assert "Instruction limit" in result.stderr
+
+
+def test_code_cache_size_minimum(compiled_elfs):
+    """A code cache too small for a single translation is refused up front
+    instead of being flushed over and over."""
+    if not DINORISC_BIN.exists():
+        pytest.skip("dinorisc binary not found")
+
+    elf_path = compiled_elfs["side_exit.c"]
+    cmd = [
+        str(DINORISC_BIN),
+        "--code-cache-size=4096",
+        elf_path,
+        "alternating_sum",
+        "10",
+    ]
+    result = subprocess.run(cmd, capture_output=True, text=True, timeout=30)
+    assert result.returncode != 0
+    assert "below the minimum" in result.stderr
+
+
 if __name__ == "__main__":
     pytest.main([__file__, "-v"])
@@ -0,0 +1,129 @@
+#include "AotCache.h"
+#include "Error.h"
+#include "TestHelpers.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace dinorisc;
+using namespace dinorisc::test;
+
+namespace {
+
+void writeFile(const std::string &path, const std::string &contents) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << contents;
+}
+
+uint32_t readWord(const void *address) {
+  uint32_t word;
+  std::memcpy(&word, address, sizeof(word));
+  return word;
+}
+
+} // namespace
+
+TEST_CASE("AotCache - Content hash", "[aot]") {
+  std::string path = tempPath("hash-input");
+
+  // Known FNV-1a values
+  writeFile(path, "");
+  REQUIRE(AotCache::hashFile(path) == 0xcbf29ce484222325ULL);
+  writeFile(path, "a");
+  REQUIRE(AotCache::hashFile(path) == 0xaf63dc4c8601ec8cULL);
+
+  std::remove(path.c_str());
+  REQUIRE_THROWS_AS(AotCache::hashFile(path), RuntimeError);
+}
+
+TEST_CASE("AotCache - Save and map", "[aot]") {
+  std::string path = tempPath("cache.aot");
+  std::remove(path.c_str());
+
+  // Two blocks of "b #4; mov x0, #target; ret" style code in one image
+  std::vector<uint32_t> image = {0x14000001, 0xD2820000, 0xD65F03C0,
+                                 0x14000001, 0xD2840000, 0xD65F03C0};
+  const uint8_t *code = reinterpret_cast<const uint8_t *>(image.data());
+
+  TranslatedBlock first;
+  first.guestAddress = 0x1000;
+  first.guestInstructionCount = 3;
+  first.hostCode = code;
+  first.hostCodeSize = 12;
+  first.exits = {{code, 0x2000, true}};
+  first.tier = 1;
+
+  TranslatedBlock second;
+  second.guestAddress = 0x2000;
+  second.guestInstructionCount = 1;
+  second.hostCode = code + 12;
+  second.hostCodeSize = 12;
+  second.exits = {{code + 12, 0x1000, false}};
+  second.tier = 1;
+
+  AotConfig config{false, 1};
+  AotCache::write(path, 42, config, code, image.size() * 4,
+                  {first, second});
+
+  SECTION("Maps the translations back") {
+    AotCache cache;
+    REQUIRE(cache.load(path, 42, config) == AotCache::Status::Loaded);
+    REQUIRE(cache.getCodeSize() == 24);
+
+    const auto &blocks = cache.getBlocks();
+    REQUIRE(blocks.size() == 2);
+    REQUIRE(blocks[0].guestAddress == 0x1000);
+    REQUIRE(blocks[0].guestInstructionCount == 3);
+    REQUIRE(blocks[0].tier == 1);
+    REQUIRE(blocks[1].hostCode ==
+            static_cast<const uint8_t *>(blocks[0].hostCode) + 12);
+    REQUIRE(readWord(blocks[1].hostCode) == 0x14000001);
+    REQUIRE(readWord(static_cast<const uint8_t *>(blocks[1].hostCode) + 4) ==
+            0xD2840000);
+
+    // Exits come back as fixups that still need chaining
+    REQUIRE(blocks[0].exits.size() == 1);
+    REQUIRE(blocks[0].exits[0].branchAddress == blocks[0].hostCode);
+    REQUIRE(blocks[0].exits[0].targetAddress == 0x2000);
+    REQUIRE_FALSE(blocks[0].exits[0].linked);
+  }
+
+  SECTION("A different binary makes the cache stale") {
+    AotCache cache;
+    REQUIRE(cache.load(path, 43, config) == AotCache::Status::Stale);
+    REQUIRE(cache.getBlocks().empty());
+  }
+
+  SECTION("Other translation settings make the cache stale") {
+    AotCache cache;
+    REQUIRE(cache.load(path, 42, AotConfig{true, 1}) ==
+            AotCache::Status::Stale);
+    REQUIRE(cache.load(path, 42, AotConfig{false, 2}) ==
+            AotCache::Status::Stale);
+    REQUIRE(cache.getBlocks().empty());
+  }
+
+  SECTION("Missing and damaged files") {
+    AotCache cache;
+    std::string missing = tempPath("missing.aot");
+    REQUIRE(cache.load(missing, 42, config) == AotCache::Status::Missing);
+
+    std::string damaged = tempPath("damaged.aot");
+    writeFile(damaged, "DINOAOT");
+    REQUIRE_THROWS_AS(cache.load(damaged, 42, config), RuntimeError);
+    writeFile(damaged, std::string(64, 'x'));
+    REQUIRE_THROWS_AS(cache.load(damaged, 42, config), RuntimeError);
+    std::remove(damaged.c_str());
+  }
+
+  SECTION("Code outside the image is rejected") {
+    REQUIRE_THROWS_AS(
+        AotCache::write(path, 42, config, code, 12, {first, second}),
+        RuntimeError);
+  }
+
+  std::remove(path.c_str());
+}
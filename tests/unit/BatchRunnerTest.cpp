@@ -0,0 +1,112 @@
+#include "BatchRunner.h"
+#include "Error.h"
+#include <catch2/catch_test_macros.hpp>
+#include <sstream>
+
+using namespace dinorisc;
+
+TEST_CASE("BatchRunner - CSV input", "[batch]") {
+  std::vector<uint64_t> args;
+
+  SECTION("Tuples are read one line at a time") {
+    std::istringstream input("# a, b\n1,2\n\n 0x10 , -1\n7\n");
+    BatchReader reader(input, BatchFormat::CSV, 0);
+
+    REQUIRE(reader.next(args));
+    REQUIRE(args == std::vector<uint64_t>{1, 2});
+    REQUIRE(reader.next(args));
+    REQUIRE(args == std::vector<uint64_t>{0x10, ~0ULL});
+    REQUIRE(reader.next(args));
+    REQUIRE(args == std::vector<uint64_t>{7});
+    REQUIRE_FALSE(reader.next(args));
+    REQUIRE(reader.getRecords() == 3);
+  }
+
+  SECTION("A fixed arity is enforced") {
+    std::istringstream input("1,2\n3\n");
+    BatchReader reader(input, BatchFormat::CSV, 2);
+    REQUIRE(reader.next(args));
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+  }
+
+  SECTION("Fields must be integers") {
+    std::istringstream input("1,two\n");
+    BatchReader reader(input, BatchFormat::CSV, 0);
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+  }
+
+  SECTION("Empty fields are rejected") {
+    std::istringstream input("1,,2\n1,2,\n");
+    BatchReader reader(input, BatchFormat::CSV, 0);
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+  }
+
+  SECTION("At most eight arguments") {
+    std::istringstream input("1,2,3,4,5,6,7,8,9\n");
+    BatchReader reader(input, BatchFormat::CSV, 0);
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+  }
+}
+
+TEST_CASE("BatchRunner - Binary input", "[batch]") {
+  std::vector<uint64_t> words = {1, 2, 3, 4, 5};
+  std::string bytes(reinterpret_cast<const char *>(words.data()),
+                    words.size() * sizeof(uint64_t));
+  std::vector<uint64_t> args;
+
+  SECTION("Records have a fixed size") {
+    std::istringstream input(bytes.substr(0, 4 * sizeof(uint64_t)));
+    BatchReader reader(input, BatchFormat::Binary, 2);
+    REQUIRE(reader.next(args));
+    REQUIRE(args == std::vector<uint64_t>{1, 2});
+    REQUIRE(reader.next(args));
+    REQUIRE(args == std::vector<uint64_t>{3, 4});
+    REQUIRE_FALSE(reader.next(args));
+  }
+
+  SECTION("A truncated record is an error") {
+    std::istringstream input(bytes);
+    BatchReader reader(input, BatchFormat::Binary, 2);
+    REQUIRE(reader.next(args));
+    REQUIRE(reader.next(args));
+    REQUIRE_THROWS_AS(reader.next(args), RuntimeError);
+  }
+
+  SECTION("The arity is required") {
+    std::istringstream input(bytes);
+    REQUIRE_THROWS_AS(BatchReader(input, BatchFormat::Binary, 0),
+                      RuntimeError);
+  }
+}
+
+TEST_CASE("BatchRunner - Output", "[batch]") {
+  std::ostringstream csv;
+  BatchWriter csvWriter(csv, BatchFormat::CSV);
+  csvWriter.write({42, 0});
+  csvWriter.write({~0ULL, 1});
+  REQUIRE(csv.str() == "42,0\n-1,1\n");
+
+  std::ostringstream binary;
+  BatchWriter binaryWriter(binary, BatchFormat::Binary);
+  binaryWriter.write({42, 7});
+  std::string bytes = binary.str();
+  REQUIRE(bytes.size() == 2 * sizeof(uint64_t));
+  uint64_t words[2];
+  bytes.copy(reinterpret_cast<char *>(words), bytes.size());
+  REQUIRE(words[0] == 42);
+  REQUIRE(words[1] == 7);
+}
+
+TEST_CASE("BatchRunner - Percentiles", "[batch]") {
+  std::vector<uint64_t> samples;
+  REQUIRE(BatchRunner::percentile(samples, 50) == 0);
+
+  for (uint64_t i = 100; i >= 1; --i) {
+    samples.push_back(i);
+  }
+  REQUIRE(BatchRunner::percentile(samples, 50) == 50);
+  REQUIRE(BatchRunner::percentile(samples, 99) == 99);
+  REQUIRE(BatchRunner::percentile(samples, 100) == 100);
+  REQUIRE(BatchRunner::percentile(samples, 0) == 1);
+}
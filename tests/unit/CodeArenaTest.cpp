@@ -0,0 +1,131 @@
+#include "CodeArena.h"
+#include "Error.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+using namespace dinorisc;
+
+static uint32_t readWord(const void *address) {
+  uint32_t word;
+  std::memcpy(&word, address, sizeof(word));
+  return word;
+}
+
+TEST_CASE("CodeArena - Bump allocation", "[codearena]") {
+  CodeArena arena(1024 * 1024, CodeArena::Mapping::Single);
+  std::vector<uint8_t> code = {0xC0, 0x03, 0x5F, 0xD6}; // ret
+
+  SECTION("Blocks are placed back to back") {
+    const void *first = arena.emit(code.data(), code.size());
+    const void *second = arena.emit(code.data(), code.size());
+
+    REQUIRE(static_cast<const uint8_t *>(second) ==
+            static_cast<const uint8_t *>(first) + code.size());
+    REQUIRE(arena.getUsed() == 2 * code.size());
+    REQUIRE(arena.contains(first));
+    REQUIRE(arena.contains(second));
+  }
+
+  SECTION("Commit batches protection changes and flushes") {
+    for (int i = 0; i < 100; ++i) {
+      arena.emit(code.data(), code.size());
+    }
+    REQUIRE(arena.hasPendingCode());
+
+    arena.commit();
+    REQUIRE_FALSE(arena.hasPendingCode());
+    REQUIRE(arena.getProtectionChanges() == 1);
+    REQUIRE(arena.getCacheFlushes() == 1);
+
+    // Nothing new to commit
+    arena.commit();
+    REQUIRE(arena.getProtectionChanges() == 1);
+  }
+
+  SECTION("Emitting after commit reuses the partially filled page") {
+    const void *first = arena.emit(code.data(), code.size());
+    arena.commit();
+    arena.emit(code.data(), code.size());
+    arena.commit();
+
+    REQUIRE(readWord(first) == 0xD65F03C0);
+    REQUIRE(arena.getUsed() == 2 * code.size());
+  }
+
+  SECTION("Committed code can be patched") {
+    const void *block = arena.emit(code.data(), code.size());
+    arena.commit();
+
+    arena.patch(block, 0x14000001); // b #4
+    REQUIRE(readWord(block) == 0x14000001);
+  }
+
+  SECTION("Rewinding reuses committed code memory") {
+    const void *first = arena.emit(code.data(), code.size());
+    arena.emit(code.data(), code.size());
+    arena.commit();
+
+    arena.rewind(code.size());
+    REQUIRE(arena.getUsed() == code.size());
+    REQUIRE_FALSE(arena.hasPendingCode());
+
+    // The second slot is handed out again and can be overwritten
+    std::vector<uint8_t> branch = {0x01, 0x00, 0x00, 0x14}; // b #4
+    const void *second = arena.emit(branch.data(), branch.size());
+    REQUIRE(static_cast<const uint8_t *>(second) ==
+            static_cast<const uint8_t *>(first) + code.size());
+    REQUIRE(arena.hasPendingCode());
+    arena.commit();
+    REQUIRE(readWord(first) == 0xD65F03C0);
+    REQUIRE(readWord(second) == 0x14000001);
+
+    REQUIRE_THROWS_AS(arena.rewind(arena.getUsed() + 4), RuntimeError);
+  }
+
+  SECTION("Invalid requests throw") {
+    REQUIRE_THROWS_AS(arena.emit(code.data(), 0), RuntimeError);
+    REQUIRE_THROWS_AS(arena.patch(&code, 0), RuntimeError);
+
+    std::vector<uint8_t> huge(2 * 1024 * 1024);
+    REQUIRE_THROWS_AS(arena.emit(huge.data(), huge.size()), RuntimeError);
+  }
+}
+
+TEST_CASE("CodeArena - Dual mapping", "[codearena]") {
+  CodeArena arena(1024 * 1024);
+  std::vector<uint8_t> code = {0xC0, 0x03, 0x5F, 0xD6}; // ret
+
+  // Non-Linux hosts and kernels that refuse executable memfd mappings fall
+  // back to mprotect
+  if (arena.getMapping() == CodeArena::Mapping::Single) {
+    WARN("Dual mapping unavailable on this host");
+    return;
+  }
+
+  SECTION("Code is visible at the executable address") {
+    const void *block = arena.emit(code.data(), code.size());
+    arena.commit();
+    REQUIRE(arena.contains(block));
+    REQUIRE(readWord(block) == 0xD65F03C0);
+    REQUIRE(arena.getCacheFlushes() == 1);
+  }
+
+  SECTION("Patching and reusing pages never calls mprotect") {
+    const void *block = arena.emit(code.data(), code.size());
+    arena.commit();
+    arena.patch(block, 0x14000001); // b #4
+    REQUIRE(readWord(block) == 0x14000001);
+
+    arena.emit(code.data(), code.size());
+    arena.commit();
+    arena.rewind(0);
+    arena.emit(code.data(), code.size());
+    arena.commit();
+    REQUIRE(readWord(block) == 0xD65F03C0);
+
+    REQUIRE(arena.getProtectionChanges() == 0);
+    REQUIRE(arena.getProtectionChangesAvoided() > 0);
+  }
+}
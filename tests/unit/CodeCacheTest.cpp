@@ -0,0 +1,134 @@
+#include "CodeCache.h"
+#include "CodeArena.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <vector>
+
+using namespace dinorisc;
+
+static TranslatedBlock makeBlock(uint64_t guestAddress) {
+  static const uint8_t code[4] = {};
+  return TranslatedBlock{guestAddress, 1, code, sizeof(code), {}};
+}
+
+// Emit a block consisting of one unlinked exit stub: b #4; ret
+static TranslatedBlock emitStubBlock(CodeArena &arena, uint64_t guestAddress,
+                                     uint64_t targetAddress) {
+  std::vector<uint8_t> code = {0x01, 0x00, 0x00, 0x14, 0xC0, 0x03, 0x5F, 0xD6};
+  const void *host = arena.emit(code.data(), code.size());
+  return TranslatedBlock{
+      guestAddress, 1, host, code.size(), {{host, targetAddress, false}}};
+}
+
+static uint32_t readWord(const void *address) {
+  uint32_t word;
+  std::memcpy(&word, address, sizeof(word));
+  return word;
+}
+
+TEST_CASE("CodeCache - Lookup and insertion", "[codecache]") {
+  CodeCache cache;
+
+  SECTION("Empty cache misses") {
+    REQUIRE(cache.lookup(0x10000) == nullptr);
+    REQUIRE(cache.getMisses() == 1);
+    REQUIRE(cache.getHits() == 0);
+  }
+
+  SECTION("Inserted block is found") {
+    cache.insert(makeBlock(0x10000));
+
+    const TranslatedBlock *block = cache.lookup(0x10000);
+    REQUIRE(block != nullptr);
+    REQUIRE(block->guestAddress == 0x10000);
+    REQUIRE(cache.getHits() == 1);
+    REQUIRE(cache.getMisses() == 0);
+    REQUIRE(cache.size() == 1);
+  }
+
+  SECTION("Repeated lookups only translate once") {
+    for (int i = 0; i < 1000; ++i) {
+      if (!cache.lookup(0x10010)) {
+        cache.insert(makeBlock(0x10010));
+      }
+    }
+
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.getMisses() == 1);
+    REQUIRE(cache.getHits() == 999);
+  }
+
+  SECTION("Clear drops all translations") {
+    cache.insert(makeBlock(0x10000));
+    cache.insert(makeBlock(0x10004));
+    cache.clear();
+
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.lookup(0x10000) == nullptr);
+  }
+}
+
+TEST_CASE("CodeCache - Block chaining", "[codecache]") {
+  CodeArena arena(1024 * 1024);
+  CodeCache cache(&arena);
+  constexpr uint32_t UNLINKED = 0x14000001; // b #4
+
+  SECTION("Exit to a translated block is linked on insertion") {
+    const auto &target = cache.insert(emitStubBlock(arena, 0x2000, 0x3000));
+    const auto &source = cache.insert(emitStubBlock(arena, 0x1000, 0x2000));
+
+    REQUIRE(source.exits[0].linked);
+    // b -8: from the second block back to the first
+    REQUIRE(readWord(source.exits[0].branchAddress) == 0x17FFFFFE);
+    REQUIRE_FALSE(target.exits[0].linked);
+    REQUIRE(cache.getChainsLinked() == 1);
+  }
+
+  SECTION("Pending exits are linked when their target appears") {
+    const auto &source = cache.insert(emitStubBlock(arena, 0x1000, 0x2000));
+    REQUIRE(readWord(source.exits[0].branchAddress) == UNLINKED);
+
+    cache.insert(emitStubBlock(arena, 0x2000, 0x1000));
+    REQUIRE(source.exits[0].linked);
+    REQUIRE(readWord(source.exits[0].branchAddress) == 0x14000002);
+    REQUIRE(cache.getChainsLinked() == 2);
+  }
+
+  SECTION("Self loops are linked") {
+    const auto &loop = cache.insert(emitStubBlock(arena, 0x1000, 0x1000));
+    REQUIRE(loop.exits[0].linked);
+    REQUIRE(readWord(loop.exits[0].branchAddress) == 0x14000000);
+  }
+
+  SECTION("Invalidation unlinks incoming chains") {
+    const auto &source = cache.insert(emitStubBlock(arena, 0x1000, 0x2000));
+    cache.insert(emitStubBlock(arena, 0x2000, 0x3000));
+    REQUIRE(source.exits[0].linked);
+
+    cache.invalidate(0x2000);
+    REQUIRE_FALSE(source.exits[0].linked);
+    REQUIRE(readWord(source.exits[0].branchAddress) == UNLINKED);
+    REQUIRE(cache.getChainsUnlinked() == 1);
+    REQUIRE(cache.lookup(0x2000) == nullptr);
+
+    // A new translation of the target is chained again
+    cache.insert(emitStubBlock(arena, 0x2000, 0x3000));
+    REQUIRE(source.exits[0].linked);
+  }
+
+  SECTION("Replaced translations with a patchable entry are redirected") {
+    TranslatedBlock cold = emitStubBlock(arena, 0x1000, 0x2000);
+    cold.patchableEntry = true;
+    const void *coldEntry = cache.insert(cold).hostCode;
+
+    TranslatedBlock hot = emitStubBlock(arena, 0x1000, 0x2000);
+    hot.tier = 1;
+    const auto &cached = cache.insert(hot);
+
+    REQUIRE(cache.lookup(0x1000)->tier == 1);
+    REQUIRE(cached.hostCode != coldEntry);
+    // b +8: from the old entry to the replacement emitted right after it
+    REQUIRE(readWord(coldEntry) == 0x14000002);
+    REQUIRE(cache.getEntriesRedirected() == 1);
+  }
+}
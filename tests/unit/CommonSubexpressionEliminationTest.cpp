@@ -0,0 +1,83 @@
+#include "IR/IR.h"
+#include "Lifter.h"
+#include "Optimization/CommonSubexpressionElimination.h"
+#include "RISCV/Instruction.h"
+#include "TestHelpers.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace dinorisc;
+using namespace dinorisc::optimization;
+using namespace dinorisc::test;
+using Opcode = riscv::Instruction::Opcode;
+
+namespace {
+
+size_t countBinaryOps(const std::vector<ir::Instruction> &instructions,
+                      ir::BinaryOpcode opcode) {
+  return std::count_if(instructions.begin(), instructions.end(),
+                       [&](const ir::Instruction &inst) {
+                         auto binOp = std::get_if<ir::BinaryOp>(&inst.kind);
+                         return binOp && binOp->opcode == opcode;
+                       });
+}
+
+} // namespace
+
+TEST_CASE("CommonSubexpressionElimination - Blocks", "[optimization]") {
+  CommonSubexpressionElimination pass;
+
+  SECTION("Recomputed addresses share one value") {
+    // addi t0, sp, 8; addi t1, sp, 8
+    Lifter lifter;
+    ir::BasicBlock block =
+        lifter.liftBasicBlock({createIType(Opcode::ADDI, 5, 2, 8, 0x1000),
+                               createIType(Opcode::ADDI, 6, 2, 8, 0x1004)});
+    pass.run(block);
+
+    // RegRead sp, Const 8, Add and the two writes
+    REQUIRE(block.instructions.size() == 5);
+    REQUIRE(countBinaryOps(block.instructions, ir::BinaryOpcode::Add) == 1);
+    std::vector<ir::ValueId> written;
+    for (const auto &inst : block.instructions) {
+      if (auto regWrite = std::get_if<ir::RegWrite>(&inst.kind)) {
+        written.push_back(regWrite->value);
+      }
+    }
+    REQUIRE(written.size() == 2);
+    REQUIRE(written[0] == written[1]);
+  }
+
+  SECTION("Commutative operands are ordered") {
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::RegRead{10}},
+        {2, ir::RegRead{11}},
+        {3, ir::BinaryOp{ir::BinaryOpcode::Add, ir::Type::i64, 1, 2}},
+        {4, ir::BinaryOp{ir::BinaryOpcode::Add, ir::Type::i64, 2, 1}},
+        {5, ir::BinaryOp{ir::BinaryOpcode::Sub, ir::Type::i64, 1, 2}},
+        {6, ir::BinaryOp{ir::BinaryOpcode::Sub, ir::Type::i64, 2, 1}},
+        {7, ir::Store{4, 6}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    REQUIRE(countBinaryOps(block.instructions, ir::BinaryOpcode::Add) == 1);
+    REQUIRE(countBinaryOps(block.instructions, ir::BinaryOpcode::Sub) == 2);
+    REQUIRE(std::get<ir::Store>(block.instructions.back().kind).value == 3);
+  }
+
+  SECTION("Types are part of the expression") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::Const{ir::Type::i64, 1}},
+                          {2, ir::Const{ir::Type::i32, 1}},
+                          {3, ir::Const{ir::Type::i64, 1}},
+                          {4, ir::Sext{ir::Type::i64, 2}},
+                          {5, ir::Zext{ir::Type::i64, 2}},
+                          {6, ir::Sext{ir::Type::i64, 2}}};
+    block.terminator = ir::Terminator{ir::Return{3}};
+    pass.run(block);
+
+    REQUIRE(block.instructions.size() == 4);
+    REQUIRE(std::get<ir::Return>(block.terminator.kind).value == 1);
+  }
+}
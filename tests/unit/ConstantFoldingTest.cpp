@@ -0,0 +1,178 @@
+#include "IR/IR.h"
+#include "Lifter.h"
+#include "Optimization/ConstantFolding.h"
+#include "RISCV/Instruction.h"
+#include "TestHelpers.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <optional>
+
+using namespace dinorisc;
+using namespace dinorisc::optimization;
+using namespace dinorisc::test;
+using Opcode = riscv::Instruction::Opcode;
+
+namespace {
+
+// The value a guest register is written back with, if it's a constant
+std::optional<int64_t> writtenConstant(const ir::BasicBlock &block,
+                                       uint32_t regNumber) {
+  for (const auto &inst : block.instructions) {
+    auto regWrite = std::get_if<ir::RegWrite>(&inst.kind);
+    if (!regWrite || regWrite->regNumber != regNumber) {
+      continue;
+    }
+    for (const auto &def : block.instructions) {
+      if (def.valueId == regWrite->value) {
+        if (auto constant = std::get_if<ir::Const>(&def.kind)) {
+          return constant->value;
+        }
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+TEST_CASE("ConstantFolding - Lifted code", "[optimization]") {
+  Lifter lifter;
+  ConstantFolding pass;
+
+  SECTION("LUI + ADDI becomes one constant") {
+    // lui a0, 0x12345; addi a0, a0, -1
+    ir::BasicBlock block = lifter.liftBasicBlock(
+        {createUType(Opcode::LUI, 10, 0x12345, 0x1000),
+         createIType(Opcode::ADDI, 10, 10, -1, 0x1004)});
+    pass.run(block);
+
+    REQUIRE(writtenConstant(block, 10) == 0x12344fff);
+    REQUIRE(count<ir::Const>(block) == 1);
+    REQUIRE(count<ir::BinaryOp>(block) == 0);
+  }
+
+  SECTION("Reads of x0 fold away") {
+    // li a0, 5; mv a1, a2
+    ir::BasicBlock block =
+        lifter.liftBasicBlock({createIType(Opcode::ADDI, 10, 0, 5, 0x1000),
+                               createIType(Opcode::ADDI, 11, 12, 0, 0x1004)});
+    pass.run(block);
+
+    REQUIRE(writtenConstant(block, 10) == 5);
+    REQUIRE(count<ir::BinaryOp>(block) == 0);
+
+    // a1 is written with a2's value directly
+    for (const auto &inst : block.instructions) {
+      if (auto regWrite = std::get_if<ir::RegWrite>(&inst.kind)) {
+        if (regWrite->regNumber == 11) {
+          const auto &read = *std::find_if(
+              block.instructions.begin(), block.instructions.end(),
+              [&](const ir::Instruction &def) {
+                return def.valueId == regWrite->value;
+              });
+          REQUIRE(std::get<ir::RegRead>(read.kind).regNumber == 12);
+        }
+      }
+    }
+  }
+
+  SECTION("32-bit operations wrap and sign-extend") {
+    // li a0, 0x7fffffff (lui + addiw); addiw a0, a0, 1
+    ir::BasicBlock block =
+        lifter.liftBasicBlock({createUType(Opcode::LUI, 10, -0x80000, 0x1000),
+                               createIType(Opcode::ADDIW, 10, 10, -1, 0x1004),
+                               createIType(Opcode::ADDIW, 10, 10, 1, 0x1008)});
+    pass.run(block);
+
+    REQUIRE(writtenConstant(block, 10) == INT32_MIN);
+  }
+
+  SECTION("Constant loads and stores get a constant address") {
+    // lui a0, 0x10; ld a1, 8(a0)
+    ir::BasicBlock block =
+        lifter.liftBasicBlock({createUType(Opcode::LUI, 10, 0x10, 0x1000),
+                               createIType(Opcode::LD, 11, 10, 8, 0x1004)});
+    pass.run(block);
+
+    for (const auto &inst : block.instructions) {
+      if (auto load = std::get_if<ir::Load>(&inst.kind)) {
+        REQUIRE(std::holds_alternative<ir::Const>(
+            std::find_if(block.instructions.begin(), block.instructions.end(),
+                         [&](const ir::Instruction &def) {
+                           return def.valueId == load->address;
+                         })
+                ->kind));
+      }
+    }
+    REQUIRE(writtenConstant(block, 10) == 0x10000);
+  }
+}
+
+TEST_CASE("ConstantFolding - Control flow", "[optimization]") {
+  ConstantFolding pass;
+
+  SECTION("Branches on constants become direct") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::Const{ir::Type::i64, 3}},
+                          {2, ir::Const{ir::Type::i64, 4}},
+                          {3, ir::BinaryOp{ir::BinaryOpcode::LtU,
+                                           ir::Type::i1, 1, 2}}};
+    block.terminator = ir::Terminator{ir::CondBranch{3, 0x2000, 0x1004}};
+    pass.run(block);
+
+    REQUIRE(block.instructions.empty());
+    REQUIRE(std::get<ir::Branch>(block.terminator.kind).targetBlock == 0x2000);
+  }
+
+  SECTION("Signed and unsigned comparisons differ") {
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::Const{ir::Type::i64, -1}},
+        {2, ir::Const{ir::Type::i64, 1}},
+        {3, ir::BinaryOp{ir::BinaryOpcode::Lt, ir::Type::i1, 1, 2}},
+        {4, ir::BinaryOp{ir::BinaryOpcode::LtU, ir::Type::i1, 1, 2}},
+        {5, ir::RegWrite{5, 3}},
+        {6, ir::RegWrite{6, 4}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    REQUIRE(writtenConstant(block, 5) == 1);
+    REQUIRE(writtenConstant(block, 6) == 0);
+  }
+
+  SECTION("Jumps to constant targets become direct, returns don't") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::Const{ir::Type::i64, 0x3000}},
+                          {2, ir::Const{ir::Type::i64, 0x1008}}};
+    ir::Link link{1, 2, 0x1008, true};
+    block.terminator = ir::Terminator{ir::Return{1, link, false}};
+    pass.run(block);
+
+    auto &branch = std::get<ir::Branch>(block.terminator.kind);
+    REQUIRE(branch.targetBlock == 0x3000);
+    REQUIRE(branch.link.has_value());
+    REQUIRE(block.instructions.size() == 1);
+
+    ir::BasicBlock ret;
+    ret.instructions = {{1, ir::Const{ir::Type::i64, 0x3000}}};
+    ret.terminator = ir::Terminator{ir::Return{1, std::nullopt, true}};
+    pass.run(ret);
+    REQUIRE(std::holds_alternative<ir::Return>(ret.terminator.kind));
+  }
+
+  SECTION("Side exits that are never taken are dropped") {
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::Const{ir::Type::i64, 7}},
+        {2, ir::BinaryOp{ir::BinaryOpcode::Eq, ir::Type::i1, 1, 1}},
+        {3, ir::BinaryOp{ir::BinaryOpcode::Ne, ir::Type::i1, 1, 1}},
+        {4, ir::SideExit{2, 0x2000, {}}},
+        {5, ir::SideExit{3, 0x3000, {}}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    REQUIRE(block.instructions.size() == 2);
+    REQUIRE(std::get<ir::SideExit>(block.instructions[1].kind).target ==
+            0x2000);
+  }
+}
@@ -0,0 +1,118 @@
+#include "ControlFlowGraph.h"
+#include "RISCV/Decoder.h"
+#include <catch2/catch_test_macros.hpp>
+#include <sstream>
+#include <vector>
+
+using namespace dinorisc;
+
+namespace {
+
+constexpr uint64_t TEXT_BASE = 0x1000;
+
+// 0x1000 sum_to_n:  li a1, 0; li a2, 0
+// 0x1008 loop:      bge a2, a0, done; add a1, a1, a2; addi a2, a2, 1; j loop
+// 0x1018 done:      mv a0, a1; ret
+// 0x1020 call_sum:  addi sp, sp, -16; sd ra, 8(sp); jal sum_to_n
+//                   addi a0, a0, 100; ld ra, 8(sp); addi sp, sp, 16; ret
+// 0x103c memory:    li t0, -1; sb t0, 0(sp); lb a0, 0(sp); lbu a1, 0(sp)
+//                   li t1, 1; slli t1, t1, 31; sw t1, 4(sp); lw a2, 4(sp)
+//                   lwu a3, 4(sp); li zero, 5; negw a4, t1
+//                   sraiw a5, a2, 4; lui a6, 0x12345; auipc a7, 1; ret
+// 0x1078:           .word 0
+const std::vector<uint8_t> TEXT = {
+    0x93, 0x05, 0x00, 0x00, 0x13, 0x06, 0x00, 0x00, 0x63, 0x58, 0xa6, 0x00,
+    0xb3, 0x85, 0xc5, 0x00, 0x13, 0x06, 0x16, 0x00, 0x6f, 0xf0, 0x5f, 0xff,
+    0x13, 0x85, 0x05, 0x00, 0x67, 0x80, 0x00, 0x00, 0x13, 0x01, 0x01, 0xff,
+    0x23, 0x34, 0x11, 0x00, 0xef, 0xf0, 0x9f, 0xfd, 0x13, 0x05, 0x45, 0x06,
+    0x83, 0x30, 0x81, 0x00, 0x13, 0x01, 0x01, 0x01, 0x67, 0x80, 0x00, 0x00,
+    0x93, 0x02, 0xf0, 0xff, 0x23, 0x00, 0x51, 0x00, 0x03, 0x05, 0x01, 0x00,
+    0x83, 0x45, 0x01, 0x00, 0x13, 0x03, 0x10, 0x00, 0x13, 0x13, 0xf3, 0x01,
+    0x23, 0x22, 0x61, 0x00, 0x03, 0x26, 0x41, 0x00, 0x83, 0x66, 0x41, 0x00,
+    0x13, 0x00, 0x50, 0x00, 0x3b, 0x07, 0x60, 0x40, 0x9b, 0x57, 0x46, 0x40,
+    0x37, 0x58, 0x34, 0x12, 0x97, 0x18, 0x00, 0x00, 0x67, 0x80, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00};
+
+} // namespace
+
+TEST_CASE("ControlFlowGraph - Recovery", "[cfg]") {
+  riscv::Decoder decoder;
+
+  // Entry at call_sum; sum_to_n is only found through the call
+  ControlFlowGraph cfg(decoder, TEXT, TEXT_BASE, 0x1020,
+                       {{"memory", 0x103c, 0x3c}});
+
+  SECTION("Blocks are split at every leader") {
+    const auto &blocks = cfg.getBlocks();
+    REQUIRE(blocks.size() == 7);
+    std::vector<uint64_t> addresses;
+    std::vector<uint32_t> sizes;
+    for (const auto &block : blocks) {
+      addresses.push_back(block.address);
+      sizes.push_back(block.instructionCount);
+    }
+    REQUIRE(addresses == std::vector<uint64_t>{0x1000, 0x1008, 0x100c, 0x1018,
+                                               0x1020, 0x102c, 0x103c});
+    REQUIRE(sizes == std::vector<uint32_t>{2, 1, 3, 2, 3, 4, 15});
+    REQUIRE(cfg.getInstructionCount() == 30);
+
+    REQUIRE(cfg.isLeader(0x1008));
+    REQUIRE_FALSE(cfg.isLeader(0x1004));
+    REQUIRE_FALSE(cfg.isLeader(0x1078));
+  }
+
+  SECTION("Successor edges") {
+    REQUIRE(cfg.getEdges().size() == 6);
+    REQUIRE(cfg.getSuccessors(0x1000) == std::vector<uint64_t>{0x1008});
+    REQUIRE(cfg.getSuccessors(0x1008) ==
+            std::vector<uint64_t>{0x1018, 0x100c});
+    REQUIRE(cfg.getSuccessors(0x100c) == std::vector<uint64_t>{0x1008});
+    REQUIRE(cfg.getSuccessors(0x1020) ==
+            std::vector<uint64_t>{0x1000, 0x102c});
+    REQUIRE(cfg.getSuccessors(0x1018).empty());
+
+    const CFGBlock &call = cfg.getBlocks()[*cfg.findBlock(0x1020)];
+    REQUIRE(cfg.getEdges()[call.firstEdge].kind == EdgeKind::Call);
+    REQUIRE(cfg.getEdges()[call.firstEdge + 1].kind == EdgeKind::CallReturn);
+    REQUIRE_FALSE(call.indirectExit);
+    REQUIRE(cfg.getBlocks()[*cfg.findBlock(0x102c)].indirectExit);
+  }
+
+  SECTION("Function boundaries") {
+    const auto &functions = cfg.getFunctions();
+    REQUIRE(functions.size() == 3);
+
+    // Call target without a symbol ends where the next function starts
+    REQUIRE(functions[0].name == "0x1000");
+    REQUIRE(functions[0].end == 0x1020);
+    REQUIRE(functions[0].firstBlock == 0);
+    REQUIRE(functions[0].blockCount == 4);
+
+    REQUIRE(functions[1].address == 0x1020);
+    REQUIRE(functions[1].blockCount == 2);
+
+    REQUIRE(functions[2].name == "memory");
+    REQUIRE(functions[2].end == 0x1078);
+    REQUIRE(functions[2].blockCount == 1);
+  }
+
+  SECTION("Dump") {
+    std::ostringstream os;
+    cfg.dump(os);
+    REQUIRE(os.str().find("3 functions, 7 blocks, 6 edges") !=
+            std::string::npos);
+    REQUIRE(os.str().find("0x1020: 3 instructions -> 0x1000 (call) 0x102c "
+                          "(call-return)") != std::string::npos);
+  }
+}
+
+TEST_CASE("ControlFlowGraph - Undecodable and missing code", "[cfg]") {
+  riscv::Decoder decoder;
+
+  // A symbol on the data word and an entry point outside the text section
+  ControlFlowGraph cfg(decoder, TEXT, TEXT_BASE, 0x9000,
+                       {{"data", 0x1078, 4}});
+  REQUIRE(cfg.getBlocks().empty());
+  REQUIRE(cfg.getFunctions().size() == 1);
+  REQUIRE(cfg.getFunctions()[0].blockCount == 0);
+}
@@ -0,0 +1,129 @@
+#include "IR/IR.h"
+#include "Lifter.h"
+#include "Optimization/ConstantFolding.h"
+#include "Optimization/DeadCodeElimination.h"
+#include "RISCV/Instruction.h"
+#include "TestHelpers.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace dinorisc;
+using namespace dinorisc::optimization;
+using namespace dinorisc::test;
+using Opcode = riscv::Instruction::Opcode;
+
+TEST_CASE("DeadCodeElimination - Unused values", "[optimization]") {
+  DeadCodeElimination pass;
+
+  SECTION("Chains of unused pure instructions go, effects stay") {
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::RegRead{10}},
+        {2, ir::Const{ir::Type::i64, 8}},
+        {3, ir::BinaryOp{ir::BinaryOpcode::Add, ir::Type::i64, 1, 2}},
+        {4, ir::Trunc{ir::Type::i32, 3}},
+        {5, ir::Load{ir::Type::i64, 1}},
+        {6, ir::Store{1, 1}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    REQUIRE(block.instructions.size() == 3);
+    REQUIRE(count<ir::RegRead>(block) == 1);
+    REQUIRE(count<ir::Load>(block) == 1);
+    REQUIRE(count<ir::Store>(block) == 1);
+  }
+
+  SECTION("Values used by the terminator stay") {
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::RegRead{10}},
+        {2, ir::RegRead{11}},
+        {3, ir::BinaryOp{ir::BinaryOpcode::Eq, ir::Type::i1, 1, 2}}};
+    block.terminator = ir::Terminator{ir::CondBranch{3, 0x2000, 0x1004}};
+    pass.run(block);
+
+    REQUIRE(block.instructions.size() == 3);
+  }
+}
+
+TEST_CASE("DeadCodeElimination - Guest registers", "[optimization]") {
+  DeadCodeElimination pass;
+
+  SECTION("The link write supersedes an earlier write") {
+    // li ra, 5; jal ra, 0x100
+    Lifter lifter;
+    ir::BasicBlock block = lifter.liftBasicBlock(
+        {createIType(Opcode::ADDI, 1, 0, 5, 0x1000),
+         createInstruction(Opcode::JAL,
+                           {riscv::Instruction::Register(1),
+                            riscv::Instruction::Immediate(0x100)},
+                           0x1004)});
+    pass.run(block);
+
+    REQUIRE(count<ir::RegWrite>(block) == 0);
+    REQUIRE(count<ir::BinaryOp>(block) == 0);
+    REQUIRE(std::get<ir::Branch>(block.terminator.kind).link.has_value());
+    REQUIRE(block.instructions.size() == 1);
+  }
+
+  SECTION("Writing back an unchanged register is dropped") {
+    // addi a1, a1, 0, which constant folding turns into a plain copy
+    Lifter lifter;
+    ir::BasicBlock block =
+        lifter.liftBasicBlock({createIType(Opcode::ADDI, 11, 11, 0, 0x1000)});
+    ConstantFolding().run(block);
+    pass.run(block);
+
+    REQUIRE(block.instructions.empty());
+  }
+
+  SECTION("Reads after a write reuse the written value") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{10}},
+                          {2, ir::RegWrite{5, 1}},
+                          {3, ir::RegRead{5}},
+                          {4, ir::RegRead{10}},
+                          {5, ir::Store{3, 4}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    REQUIRE(count<ir::RegRead>(block) == 1);
+    const auto &store = std::get<ir::Store>(block.instructions.back().kind);
+    REQUIRE(store.value == 1);
+    REQUIRE(store.address == 1);
+  }
+
+  SECTION("Writes are kept for side exits that don't repeat them") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{10}},
+                          {2, ir::RegRead{11}},
+                          {3, ir::RegWrite{5, 1}},
+                          {4, ir::RegWrite{6, 1}},
+                          {5, ir::SideExit{1, 0x2000, {{6, 2}}}},
+                          {6, ir::RegWrite{5, 2}},
+                          {7, ir::RegWrite{6, 2}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    // x5 = %1 is visible at the side exit, x6 = %1 is not
+    REQUIRE(count<ir::RegWrite>(block) == 3);
+    for (const auto &inst : block.instructions) {
+      if (auto regWrite = std::get_if<ir::RegWrite>(&inst.kind)) {
+        REQUIRE_FALSE((regWrite->regNumber == 6 && regWrite->value == 1));
+      }
+    }
+  }
+
+  SECTION("Side exits don't write back values the register holds") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{10}},
+                          {2, ir::RegRead{11}},
+                          {3, ir::SideExit{2, 0x2000, {{10, 1}, {11, 1}}}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+
+    const auto &sideExit = std::get<ir::SideExit>(block.instructions[2].kind);
+    REQUIRE(sideExit.writes.size() == 1);
+    REQUIRE(sideExit.writes[0].regNumber == 11);
+  }
+}
@@ -63,6 +63,24 @@ TEST_CASE("Encoder - Two operand instructions", "[encoder]") {
     REQUIRE(encode({TwoOperandInst{Opcode::RET, DataSize::X, Register::X0,
                                    Register::X30}}) == 0xD65F03C0);
   }
+
+  SECTION("BR") {
+    REQUIRE(encode({TwoOperandInst{Opcode::BR, DataSize::X, Register::X9,
+                                   Register::X9}}) == 0xD61F0120);
+  }
+
+  SECTION("BLR") {
+    REQUIRE(encode({TwoOperandInst{Opcode::BLR, DataSize::X, Register::X1,
+                                   Register::X1}}) == 0xD63F0020);
+  }
+
+  SECTION("ADR") {
+    REQUIRE(encode({TwoOperandInst{Opcode::ADR, DataSize::X, Register::X3,
+                                   Immediate{28}}}) == 0x100000E3);
+    REQUIRE(encode({TwoOperandInst{Opcode::ADR, DataSize::X, Register::X3,
+                                   Immediate{static_cast<uint64_t>(-8)}}}) ==
+            0x10FFFFC3);
+  }
 }
 
 TEST_CASE("Encoder - Memory instructions", "[encoder]") {
@@ -30,6 +30,55 @@ static GuestState createInitialState() {
   return state;
 }
 
+#if defined(__aarch64__)
+#if defined(__APPLE__)
+#define HOST_SYMBOL(name) "_" #name
+#else
+#define HOST_SYMBOL(name) #name
+#endif
+
+// Calls run(arg) with x19-x28 loaded from values and stores what they hold
+// once it returns back into values. The host registers are kept intact.
+extern "C" void callWithCalleeSaved(void (*run)(void *), void *arg,
+                                    uint64_t *values);
+
+// clang-format off
+asm(".text\n"
+    ".p2align 2\n"
+    ".globl " HOST_SYMBOL(callWithCalleeSaved) "\n"
+    HOST_SYMBOL(callWithCalleeSaved) ":\n"
+    "  stp x29, x30, [sp, #-112]!\n"
+    "  mov x29, sp\n"
+    "  stp x19, x20, [sp, #16]\n"
+    "  stp x21, x22, [sp, #32]\n"
+    "  stp x23, x24, [sp, #48]\n"
+    "  stp x25, x26, [sp, #64]\n"
+    "  stp x27, x28, [sp, #80]\n"
+    "  str x2, [sp, #96]\n"
+    "  ldp x19, x20, [x2]\n"
+    "  ldp x21, x22, [x2, #16]\n"
+    "  ldp x23, x24, [x2, #32]\n"
+    "  ldp x25, x26, [x2, #48]\n"
+    "  ldp x27, x28, [x2, #64]\n"
+    "  mov x16, x0\n"
+    "  mov x0, x1\n"
+    "  blr x16\n"
+    "  ldr x2, [sp, #96]\n"
+    "  stp x19, x20, [x2]\n"
+    "  stp x21, x22, [x2, #16]\n"
+    "  stp x23, x24, [x2, #32]\n"
+    "  stp x25, x26, [x2, #48]\n"
+    "  stp x27, x28, [x2, #64]\n"
+    "  ldp x19, x20, [sp, #16]\n"
+    "  ldp x21, x22, [sp, #32]\n"
+    "  ldp x23, x24, [sp, #48]\n"
+    "  ldp x25, x26, [sp, #64]\n"
+    "  ldp x27, x28, [sp, #80]\n"
+    "  ldp x29, x30, [sp], #112\n"
+    "  ret\n");
+// clang-format on
+#endif
+
 struct ExecResult {
   uint64_t nextPC;
   GuestState state;
@@ -232,3 +281,107 @@ TEST_CASE("ExecutionEngine - Edge cases", "[execution]") {
     REQUIRE(nextPC == 0x102C);
   }
 }
+
+TEST_CASE("ExecutionEngine - Dispatch trampoline", "[execution]") {
+  SECTION("Follows cached targets without leaving generated code") {
+    ExecutionEngine engine;
+    auto state = createInitialState();
+
+    // Block at 0x2000: x5 = 7, then finish
+    const void *second = engine.installCode(createMachineCode({
+        Instruction{TwoOperandInst{Opcode::MOV, DataSize::X, Register::X1,
+                                   Immediate{7}}},
+        Instruction{MemoryInst{Opcode::STR, DataSize::X, Register::X1,
+                               Register::X0, 40}},
+        Instruction{TwoOperandInst{Opcode::MOV, DataSize::X, Register::X0,
+                                   Immediate{0}}},
+        Instruction{TwoOperandInst{Opcode::RET, DataSize::X, Register::X0,
+                                   Register::X30}},
+    }));
+    state.cacheIndirectTarget(0x2000, second);
+
+    // First block: x6 = 1, continue at 0x2000
+    uint64_t nextPC = engine.executeBlock(
+        createMachineCode({
+            Instruction{TwoOperandInst{Opcode::MOV, DataSize::X, Register::X1,
+                                       Immediate{1}}},
+            Instruction{MemoryInst{Opcode::STR, DataSize::X, Register::X1,
+                                   Register::X0, 48}},
+            Instruction{TwoOperandInst{Opcode::MOV, DataSize::X, Register::X0,
+                                       Immediate{0x2000}}},
+            Instruction{TwoOperandInst{Opcode::RET, DataSize::X, Register::X0,
+                                       Register::X30}},
+        }),
+        &state);
+
+    REQUIRE(nextPC == 0);
+    REQUIRE(state.x[5] == 7);
+    REQUIRE(state.x[6] == 1);
+    REQUIRE(engine.getTrampolineEntries() == 1);
+  }
+
+  SECTION("Preserves callee-saved registers") {
+    std::vector<Instruction> clobber;
+    for (Register reg : {Register::X20, Register::X21, Register::X22,
+                         Register::X23, Register::X24, Register::X25,
+                         Register::X26, Register::X27, Register::X28}) {
+      clobber.push_back(Instruction{
+          TwoOperandInst{Opcode::MOV, DataSize::X, reg, Immediate{0}}});
+    }
+    clobber.push_back(Instruction{
+        TwoOperandInst{Opcode::MOV, DataSize::X, Register::X0,
+                       Immediate{0x3000}}});
+    clobber.push_back(Instruction{TwoOperandInst{
+        Opcode::RET, DataSize::X, Register::X0, Register::X30}});
+
+#if defined(__aarch64__)
+    struct Call {
+      const std::vector<Instruction> *instructions;
+      ExecResult result;
+    } call{&clobber, {}};
+    auto run = [](void *arg) {
+      auto *call = static_cast<Call *>(arg);
+      call->result = executeInstructions(*call->instructions);
+    };
+
+    // x19-x28 as the host left them before entering generated code
+    uint64_t values[10];
+    for (size_t i = 0; i < 10; ++i) {
+      values[i] = 0x1900 + i;
+    }
+    callWithCalleeSaved(run, &call, values);
+
+    REQUIRE(call.result.nextPC == 0x3000);
+    for (size_t i = 0; i < 10; ++i) {
+      REQUIRE(values[i] == 0x1900 + i);
+    }
+#endif
+  }
+}
+
+TEST_CASE("ExecutionEngine - Code flush", "[execution]") {
+  SECTION("Flushed code memory is reused and the trampoline survives") {
+    ExecutionEngine engine;
+    auto state = createInitialState();
+    auto returnTo = [](uint64_t pc) {
+      return createMachineCode({
+          Instruction{TwoOperandInst{Opcode::MOV, DataSize::X, Register::X0,
+                                     Immediate{pc}}},
+          Instruction{TwoOperandInst{Opcode::RET, DataSize::X, Register::X0,
+                                     Register::X30}},
+      });
+    };
+
+    const void *first = engine.installCode(returnTo(0x1000));
+    REQUIRE(engine.execute(first, &state) == 0x1000);
+    REQUIRE(engine.getCodeSize() == 8);
+
+    engine.flushCode();
+    REQUIRE(engine.getCodeSize() == 0);
+    REQUIRE(engine.getCodeFlushes() == 1);
+
+    const void *second = engine.installCode(returnTo(0x2000));
+    REQUIRE(second == first);
+    REQUIRE(engine.execute(second, &state) == 0x2000);
+  }
+}
@@ -0,0 +1,112 @@
+#include "BinaryTranslator.h"
+#include "Error.h"
+#include "GuestContext.h"
+#include "TestHelpers.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+using namespace dinorisc;
+using namespace dinorisc::test;
+
+TEST_CASE("GuestContext - Initial state", "[guestcontext]") {
+  GuestContext context(64 * 1024);
+  const GuestState &state = context.getState();
+
+  REQUIRE(state.shadowMemory != nullptr);
+  REQUIRE(state.shadowMemorySize == 64 * 1024);
+  REQUIRE(context.getStackTop() == 64 * 1024 - GuestContext::STACK_RESERVE);
+  REQUIRE(state.x[2] == context.getStackTop());
+  REQUIRE(state.blockCounters == nullptr);
+  REQUIRE(context.getStatistics().hits == 0);
+  REQUIRE(context.getStatistics().misses == 0);
+}
+
+TEST_CASE("GuestContext - Contexts don't share memory", "[guestcontext]") {
+  GuestContext first(64 * 1024);
+  GuestContext second(64 * 1024);
+  REQUIRE(first.getState().shadowMemory != second.getState().shadowMemory);
+
+  // The same guest address in each context holds its own value
+  uint64_t stackTop = first.getStackTop();
+  auto *firstMemory = static_cast<uint8_t *>(first.getState().shadowMemory);
+  auto *secondMemory = static_cast<uint8_t *>(second.getState().shadowMemory);
+  uint64_t value = 42;
+  std::memcpy(firstMemory + stackTop, &value, sizeof(value));
+
+  uint64_t other = 0;
+  std::memcpy(&other, secondMemory + stackTop, sizeof(other));
+  REQUIRE(other == 0);
+}
+
+TEST_CASE("GuestContext - Reset between calls", "[guestcontext]") {
+  GuestContext context(64 * 1024);
+  GuestState &state = context.getState();
+  state.x[2] -= 64;
+  state.x[10] = 7;
+  state.x[31] = 9;
+  state.pc = 0x1000;
+  state.exitReason = GuestState::EXIT_TIER_UP;
+  state.cacheIndirectTarget(0x1000, &state);
+
+  context.reset();
+  REQUIRE(state.x[2] == context.getStackTop());
+  REQUIRE(state.x[10] == 0);
+  REQUIRE(state.x[31] == 0);
+  REQUIRE(state.pc == 0);
+  REQUIRE(state.exitReason == GuestState::EXIT_NONE);
+
+  // Cached host addresses stay valid across calls
+  const IndirectTarget &entry =
+      state.ibtc[GuestState::indirectTargetIndex(0x1000)];
+  REQUIRE(entry.guestPC == 0x1000);
+}
+
+TEST_CASE("GuestContext - Too little memory for a stack", "[guestcontext]") {
+  REQUIRE_THROWS_AS(GuestContext(GuestContext::STACK_RESERVE), RuntimeError);
+}
+
+TEST_CASE("GuestContext - Contexts run on their own threads",
+          "[guestcontext]") {
+  std::string path = tempPath("contexts.elf");
+  REQUIRE(writeSumExecutable(path));
+
+  // Hosts that run generated code translate, tier up and look up each
+  // other's translations while both threads run
+  BinaryTranslator translator;
+  std::ostringstream log;
+  translator.setLog(log);
+  translator.setTierUpThreshold(2);
+  translator.load(path);
+  uint64_t callSum = *translator.getFunctionAddress("call_sum");
+
+  auto callRepeatedly = [&](GuestContext &context, uint64_t n,
+                            uint64_t &result) {
+    for (int i = 0; i < 200; ++i) {
+      context.reset();
+      context.getState().x[10] = n;
+      result = translator.run(context, callSum);
+    }
+  };
+
+  GuestContext first(64 * 1024);
+  GuestContext second(64 * 1024);
+  uint64_t firstResult = 0;
+  uint64_t secondResult = 0;
+  std::thread firstThread(callRepeatedly, std::ref(first), 10,
+                          std::ref(firstResult));
+  std::thread secondThread(callRepeatedly, std::ref(second), 20,
+                           std::ref(secondResult));
+  firstThread.join();
+  secondThread.join();
+
+  REQUIRE(firstResult == 145);
+  REQUIRE(secondResult == 290);
+  REQUIRE(first.getState().x[2] == first.getStackTop());
+  REQUIRE(second.getState().x[2] == second.getStackTop());
+
+  std::remove(path.c_str());
+}
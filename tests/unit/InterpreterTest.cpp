@@ -0,0 +1,148 @@
+#include "Error.h"
+#include "GuestState.h"
+#include "Interpreter.h"
+#include "RISCV/Decoder.h"
+#include <catch2/catch_test_macros.hpp>
+#include <sys/mman.h>
+#include <vector>
+
+using namespace dinorisc;
+
+namespace {
+
+constexpr uint64_t TEXT_BASE = 0x1000;
+constexpr size_t SHADOW_SIZE = 64 * 1024;
+
+// 0x1000 sum_to_n:  li a1, 0; li a2, 0
+// 0x1008 loop:      bge a2, a0, done; add a1, a1, a2; addi a2, a2, 1; j loop
+// 0x1018 done:      mv a0, a1; ret
+// 0x1020 call_sum:  addi sp, sp, -16; sd ra, 8(sp); jal sum_to_n
+//                   addi a0, a0, 100; ld ra, 8(sp); addi sp, sp, 16; ret
+// 0x103c memory:    li t0, -1; sb t0, 0(sp); lb a0, 0(sp); lbu a1, 0(sp)
+//                   li t1, 1; slli t1, t1, 31; sw t1, 4(sp); lw a2, 4(sp)
+//                   lwu a3, 4(sp); li zero, 5; negw a4, t1
+//                   sraiw a5, a2, 4; lui a6, 0x12345; auipc a7, 1; ret
+// 0x1078:           .word 0
+// 0x107c load_zero: lw zero, 0(sp); ret
+const std::vector<uint8_t> TEXT = {
+    0x93, 0x05, 0x00, 0x00, 0x13, 0x06, 0x00, 0x00, 0x63, 0x58, 0xa6, 0x00,
+    0xb3, 0x85, 0xc5, 0x00, 0x13, 0x06, 0x16, 0x00, 0x6f, 0xf0, 0x5f, 0xff,
+    0x13, 0x85, 0x05, 0x00, 0x67, 0x80, 0x00, 0x00, 0x13, 0x01, 0x01, 0xff,
+    0x23, 0x34, 0x11, 0x00, 0xef, 0xf0, 0x9f, 0xfd, 0x13, 0x05, 0x45, 0x06,
+    0x83, 0x30, 0x81, 0x00, 0x13, 0x01, 0x01, 0x01, 0x67, 0x80, 0x00, 0x00,
+    0x93, 0x02, 0xf0, 0xff, 0x23, 0x00, 0x51, 0x00, 0x03, 0x05, 0x01, 0x00,
+    0x83, 0x45, 0x01, 0x00, 0x13, 0x03, 0x10, 0x00, 0x13, 0x13, 0xf3, 0x01,
+    0x23, 0x22, 0x61, 0x00, 0x03, 0x26, 0x41, 0x00, 0x83, 0x66, 0x41, 0x00,
+    0x13, 0x00, 0x50, 0x00, 0x3b, 0x07, 0x60, 0x40, 0x9b, 0x57, 0x46, 0x40,
+    0x37, 0x58, 0x34, 0x12, 0x97, 0x18, 0x00, 0x00, 0x67, 0x80, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x03, 0x20, 0x01, 0x00, 0x67, 0x80, 0x00, 0x00};
+
+// Give the guest a small shadow memory with the stack at the top. The
+// GuestState unmaps it when destroyed.
+void allocateShadowMemory(GuestState &state) {
+  void *memory = mmap(nullptr, SHADOW_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  REQUIRE(memory != MAP_FAILED);
+  state.shadowMemory = memory;
+  state.shadowMemorySize = SHADOW_SIZE;
+  state.guestMemoryBase = 0;
+  state.x[2] = SHADOW_SIZE - 64;
+}
+
+} // namespace
+
+TEST_CASE("Interpreter - Execution", "[interpreter]") {
+  riscv::Decoder decoder;
+  Interpreter interpreter(decoder, TEXT, TEXT_BASE);
+  GuestState state;
+  allocateShadowMemory(state);
+
+  REQUIRE(interpreter.getDecodedInstructions() == TEXT.size() / 4);
+
+  SECTION("Runs a loop until the guest returns") {
+    state.x[10] = 10;
+    state.x[1] = 0;
+    REQUIRE(interpreter.run(state, 0x1000, 0) == 0);
+    REQUIRE(state.x[10] == 45);
+
+    // bge + 10 iterations of the loop body + final bge, then mv/ret
+    REQUIRE(interpreter.getBlocksExecuted() == 22);
+  }
+
+  SECTION("Stops after the requested number of blocks") {
+    state.x[10] = 3;
+    REQUIRE(interpreter.run(state, 0x1000, 1) == 0x100c);
+    REQUIRE(interpreter.getInstructionsExecuted() == 3);
+    REQUIRE(interpreter.run(state, 0x100c, 1) == 0x1008);
+    REQUIRE(state.x[11] == 0);
+    REQUIRE(state.x[12] == 1);
+  }
+
+  SECTION("Stops once the instruction budget is used up") {
+    state.x[10] = 10;
+    state.instructionBudget = 5;
+
+    // li/li/bge fits, the first loop iteration doesn't and still finishes
+    uint64_t next = interpreter.run(state, 0x1000, 0);
+    REQUIRE(next == (0x1008 | GuestState::RUNTIME_EXIT_FLAG));
+    REQUIRE(state.exitReason == GuestState::EXIT_BUDGET);
+    REQUIRE(state.instructionBudget == -1);
+    REQUIRE(state.x[12] == 1);
+  }
+
+  SECTION("Calls and returns through the stack") {
+    state.x[10] = 5;
+    state.x[1] = 0;
+    uint64_t sp = state.x[2];
+    REQUIRE(interpreter.run(state, 0x1020, 0) == 0);
+    REQUIRE(state.x[10] == 110);
+    REQUIRE(state.x[2] == sp);
+  }
+
+  SECTION("Loads, stores and word operations") {
+    state.x[1] = 0;
+    REQUIRE(interpreter.run(state, 0x103c, 0) == 0);
+    REQUIRE(state.x[10] == ~0ULL);
+    REQUIRE(state.x[11] == 0xff);
+    REQUIRE(state.x[12] == 0xffffffff80000000ULL);
+    REQUIRE(state.x[13] == 0x80000000ULL);
+    REQUIRE(state.x[0] == 0);
+    REQUIRE(state.x[14] == 0xffffffff80000000ULL);
+    REQUIRE(state.x[15] == 0xfffffffff8000000ULL);
+    REQUIRE(state.x[16] == 0x12345000);
+    REQUIRE(state.x[17] == 0x1070 + 0x1000);
+  }
+}
+
+TEST_CASE("Interpreter - Errors", "[interpreter]") {
+  riscv::Decoder decoder;
+  Interpreter interpreter(decoder, TEXT, TEXT_BASE);
+  GuestState state;
+  allocateShadowMemory(state);
+
+  SECTION("Undecodable words fail when executed") {
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x1078, 0), DecodingError);
+  }
+
+  SECTION("Jumps outside the text section") {
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x2000, 0), RuntimeError);
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x1002, 0), RuntimeError);
+
+    state.x[1] = 0x2000;
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x1074, 0), RuntimeError);
+  }
+
+  SECTION("Memory accesses outside shadow memory") {
+    state.x[2] = SHADOW_SIZE;
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x103c, 0), RuntimeError);
+  }
+
+  SECTION("Loads into x0 still check the address") {
+    state.x[1] = 0;
+    REQUIRE(interpreter.run(state, 0x107c, 0) == 0);
+    REQUIRE(state.x[0] == 0);
+
+    state.x[2] = SHADOW_SIZE;
+    REQUIRE_THROWS_AS(interpreter.run(state, 0x107c, 0), RuntimeError);
+  }
+}
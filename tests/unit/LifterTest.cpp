@@ -1,69 +1,14 @@
 #include "Lifter.h"
 #include "IR/IR.h"
 #include "RISCV/Instruction.h"
+#include "TestHelpers.h"
 #include <catch2/catch_all.hpp>
 #include <set>
 
 using namespace dinorisc;
 using namespace dinorisc::riscv;
 using namespace dinorisc::ir;
-
-namespace {
-
-riscv::Instruction
-createInstruction(riscv::Instruction::Opcode opcode,
-                  std::vector<riscv::Instruction::Operand> operands,
-                  uint64_t address = 0x1000) {
-  return riscv::Instruction(opcode, std::move(operands), 0, address);
-}
-
-riscv::Instruction createRType(riscv::Instruction::Opcode opcode, uint32_t rd,
-                               uint32_t rs1, uint32_t rs2,
-                               uint64_t address = 0x1000) {
-  return createInstruction(opcode,
-                           {riscv::Instruction::Register(rd),
-                            riscv::Instruction::Register(rs1),
-                            riscv::Instruction::Register(rs2)},
-                           address);
-}
-
-riscv::Instruction createIType(riscv::Instruction::Opcode opcode, uint32_t rd,
-                               uint32_t rs1, int64_t imm,
-                               uint64_t address = 0x1000) {
-  return createInstruction(opcode,
-                           {riscv::Instruction::Register(rd),
-                            riscv::Instruction::Register(rs1),
-                            riscv::Instruction::Immediate(imm)},
-                           address);
-}
-
-riscv::Instruction createUType(riscv::Instruction::Opcode opcode, uint32_t rd,
-                               int64_t imm, uint64_t address = 0x1000) {
-  return createInstruction(
-      opcode,
-      {riscv::Instruction::Register(rd), riscv::Instruction::Immediate(imm)},
-      address);
-}
-
-riscv::Instruction createBType(riscv::Instruction::Opcode opcode, uint32_t rs1,
-                               uint32_t rs2, int64_t imm,
-                               uint64_t address = 0x1000) {
-  return createInstruction(opcode,
-                           {riscv::Instruction::Register(rs1),
-                            riscv::Instruction::Register(rs2),
-                            riscv::Instruction::Immediate(imm)},
-                           address);
-}
-
-riscv::Instruction createJType(riscv::Instruction::Opcode opcode, uint32_t rd,
-                               int64_t imm, uint64_t address = 0x1000) {
-  return createInstruction(
-      opcode,
-      {riscv::Instruction::Register(rd), riscv::Instruction::Immediate(imm)},
-      address);
-}
-
-} // namespace
+using namespace dinorisc::test;
 
 TEST_CASE("Lifter Basic Block Construction", "[lifter][basic-block]") {
   Lifter lifter;
@@ -645,6 +590,25 @@ TEST_CASE("Lifter Control Flow Instructions", "[lifter][control-flow]") {
     REQUIRE(std::holds_alternative<Branch>(block.terminator.kind));
     auto &branch = std::get<Branch>(block.terminator.kind);
     REQUIRE(branch.targetBlock == 0x1018); // PC + offset (0x1000 + 24)
+
+    // Linking to ra is a call whose return is predicted
+    REQUIRE(branch.link.has_value());
+    REQUIRE(branch.link->regNum == 1);
+    REQUIRE(branch.link->value == block.instructions[0].valueId);
+    REQUIRE(branch.link->returnAddress == 0x1004);
+    REQUIRE(branch.link->isCall);
+  }
+
+  SECTION("RET instruction") {
+    auto inst = createIType(riscv::Instruction::Opcode::JALR, 0, 1, 0, 0x1000);
+    auto block = lifter.liftBasicBlock({inst});
+
+    // Returns to the address in ra instead of stopping execution
+    REQUIRE(std::holds_alternative<Return>(block.terminator.kind));
+    auto &ret = std::get<Return>(block.terminator.kind);
+    REQUIRE(ret.value.has_value());
+    REQUIRE(ret.isFunctionReturn);
+    REQUIRE_FALSE(ret.link.has_value());
   }
 
   SECTION("JALR instruction") {
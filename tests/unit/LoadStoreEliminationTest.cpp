@@ -0,0 +1,212 @@
+#include "IR/IR.h"
+#include "Lifter.h"
+#include "Optimization/LoadStoreElimination.h"
+#include "RISCV/Instruction.h"
+#include "TestHelpers.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+
+using namespace dinorisc;
+using namespace dinorisc::optimization;
+using namespace dinorisc::test;
+using Opcode = riscv::Instruction::Opcode;
+
+namespace {
+
+riscv::Instruction createReturn(uint64_t address) {
+  return createInstruction(Opcode::JALR,
+                           {riscv::Instruction::Register(0),
+                            riscv::Instruction::Register(1),
+                            riscv::Instruction::Immediate(0)},
+                           address);
+}
+
+// Lift a block ending in a return and run the pass over it
+ir::BasicBlock optimize(std::vector<riscv::Instruction> instructions) {
+  instructions.push_back(createReturn(0x1000 + 4 * instructions.size()));
+  Lifter lifter;
+  ir::BasicBlock block = lifter.liftBasicBlock(instructions);
+  LoadStoreElimination().run(block);
+  return block;
+}
+
+} // namespace
+
+TEST_CASE("LoadStoreElimination - Forwarding", "[optimization]") {
+  SECTION("Stack slots are reloaded from the stored value") {
+    // sd a0, -24(s0); ld a5, -24(s0)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 8, 10, -24, 0x1000),
+                  createIType(Opcode::LD, 15, 8, -24, 0x1004)});
+    REQUIRE(count<ir::Load>(block.instructions) == 0);
+    REQUIRE(count<ir::Store>(block.instructions) == 1);
+  }
+
+  SECTION("Narrow stores forward to loads of the same width") {
+    // sw a0, 12(sp); lw a5, 12(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SW, 2, 10, 12, 0x1000),
+                  createIType(Opcode::LW, 15, 2, 12, 0x1004)});
+    REQUIRE(count<ir::Load>(block.instructions) == 0);
+  }
+
+  SECTION("Loads of another width or offset read memory") {
+    // sd a0, 8(sp); lw a5, 8(sp); ld a6, 16(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createIType(Opcode::LW, 15, 2, 8, 0x1004),
+                  createIType(Opcode::LD, 16, 2, 16, 0x1008)});
+    REQUIRE(count<ir::Load>(block.instructions) == 2);
+  }
+
+  SECTION("Repeated loads read memory once") {
+    // ld a5, 0(a0); ld a6, 0(a0)
+    ir::BasicBlock block =
+        optimize({createIType(Opcode::LD, 15, 10, 0, 0x1000),
+                  createIType(Opcode::LD, 16, 10, 0, 0x1004)});
+    REQUIRE(count<ir::Load>(block.instructions) == 1);
+  }
+
+  SECTION("Storing a value just loaded from the same slot is dropped") {
+    // ld a5, 8(sp); sd a5, 8(sp)
+    ir::BasicBlock block =
+        optimize({createIType(Opcode::LD, 15, 2, 8, 0x1000),
+                  createBType(Opcode::SD, 2, 15, 8, 0x1004)});
+    REQUIRE(count<ir::Load>(block.instructions) == 1);
+    REQUIRE(count<ir::Store>(block.instructions) == 0);
+  }
+}
+
+TEST_CASE("LoadStoreElimination - Aliasing", "[optimization]") {
+  SECTION("Stores through other pointers may hit a stack slot") {
+    // sd a0, 8(sp); sd a1, 0(a2); ld a5, 8(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createBType(Opcode::SD, 12, 11, 0, 0x1004),
+                  createIType(Opcode::LD, 15, 2, 8, 0x1008)});
+    REQUIRE(count<ir::Load>(block.instructions) == 1);
+  }
+
+  SECTION("Stores to constant addresses never hit a stack slot") {
+    // sd a0, 8(sp); lui a2, 0x10; sd a1, 0(a2); ld a5, 8(sp)
+    ir::BasicBlock block = optimize(
+        {createBType(Opcode::SD, 2, 10, 8, 0x1000),
+         createInstruction(Opcode::LUI,
+                           {riscv::Instruction::Register(12),
+                            riscv::Instruction::Immediate(0x10)},
+                           0x1004),
+         createBType(Opcode::SD, 12, 11, 0, 0x1008),
+         createIType(Opcode::LD, 15, 2, 8, 0x100c)});
+    REQUIRE(count<ir::Load>(block.instructions) == 0);
+  }
+
+  SECTION("Overlapping slots of the same base alias") {
+    // sd a0, 8(sp); sw a1, 12(sp); ld a5, 8(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createBType(Opcode::SW, 2, 11, 12, 0x1004),
+                  createIType(Opcode::LD, 15, 2, 8, 0x1008)});
+    REQUIRE(count<ir::Load>(block.instructions) == 1);
+    REQUIRE(count<ir::Store>(block.instructions) == 2);
+  }
+
+  SECTION("Addresses computed in the block keep their base") {
+    // addi a2, sp, 16; sd a0, 8(sp); sd a1, 0(a2); ld a5, 8(sp)
+    ir::BasicBlock block = optimize(
+        {createInstruction(Opcode::ADDI,
+                           {riscv::Instruction::Register(12),
+                            riscv::Instruction::Register(2),
+                            riscv::Instruction::Immediate(16)},
+                           0x1000),
+         createBType(Opcode::SD, 2, 10, 8, 0x1004),
+         createBType(Opcode::SD, 12, 11, 0, 0x1008),
+         createIType(Opcode::LD, 15, 2, 8, 0x100c)});
+    REQUIRE(count<ir::Load>(block.instructions) == 0);
+  }
+
+  SECTION("s0 from the guest state may hold a global's address") {
+    // lui a5, 0x2; ld a0, 0(a5); sd a1, 0(s0); ld a2, 0(a5)
+    ir::BasicBlock block = optimize(
+        {createInstruction(Opcode::LUI,
+                           {riscv::Instruction::Register(15),
+                            riscv::Instruction::Immediate(0x2)},
+                           0x1000),
+         createIType(Opcode::LD, 10, 15, 0, 0x1004),
+         createBType(Opcode::SD, 8, 11, 0, 0x1008),
+         createIType(Opcode::LD, 12, 15, 0, 0x100c)});
+    REQUIRE(count<ir::Load>(block.instructions) == 2);
+  }
+
+  SECTION("A frame pointer set up from sp is a stack pointer") {
+    // addi s0, sp, 32; lui a5, 0x2; sd a0, -8(s0); sd a1, 0(a5);
+    // ld a2, -8(s0)
+    ir::BasicBlock block = optimize(
+        {createInstruction(Opcode::ADDI,
+                           {riscv::Instruction::Register(8),
+                            riscv::Instruction::Register(2),
+                            riscv::Instruction::Immediate(32)},
+                           0x1000),
+         createInstruction(Opcode::LUI,
+                           {riscv::Instruction::Register(15),
+                            riscv::Instruction::Immediate(0x2)},
+                           0x1004),
+         createBType(Opcode::SD, 8, 10, -8, 0x1008),
+         createBType(Opcode::SD, 15, 11, 0, 0x100c),
+         createIType(Opcode::LD, 12, 8, -8, 0x1010)});
+    REQUIRE(count<ir::Load>(block.instructions) == 0);
+  }
+}
+
+TEST_CASE("LoadStoreElimination - Dead stores", "[optimization]") {
+  LoadStoreElimination pass;
+
+  SECTION("Stores overwritten before any load go") {
+    // sd a0, 8(sp); sd a1, 8(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createBType(Opcode::SD, 2, 11, 8, 0x1004)});
+    REQUIRE(count<ir::Store>(block.instructions) == 1);
+  }
+
+  SECTION("Stores a load may read stay") {
+    // sd a0, 8(sp); ld a5, 0(a2); sd a1, 8(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createIType(Opcode::LD, 15, 12, 0, 0x1004),
+                  createBType(Opcode::SD, 2, 11, 8, 0x1008)});
+    REQUIRE(count<ir::Store>(block.instructions) == 2);
+  }
+
+  SECTION("Loads through s0 may read a global") {
+    // lui a5, 0x2; sd a0, 0(a5); ld a2, 0(s0); sd a1, 0(a5)
+    ir::BasicBlock block = optimize(
+        {createInstruction(Opcode::LUI,
+                           {riscv::Instruction::Register(15),
+                            riscv::Instruction::Immediate(0x2)},
+                           0x1000),
+         createBType(Opcode::SD, 15, 10, 0, 0x1004),
+         createIType(Opcode::LD, 12, 8, 0, 0x1008),
+         createBType(Opcode::SD, 15, 11, 0, 0x100c)});
+    REQUIRE(count<ir::Store>(block.instructions) == 2);
+  }
+
+  SECTION("Narrower stores don't cover wider ones") {
+    // sd a0, 8(sp); sw a1, 8(sp)
+    ir::BasicBlock block =
+        optimize({createBType(Opcode::SD, 2, 10, 8, 0x1000),
+                  createBType(Opcode::SW, 2, 11, 8, 0x1004)});
+    REQUIRE(count<ir::Store>(block.instructions) == 2);
+  }
+
+  SECTION("Stores before a side exit stay") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{2}},
+                          {2, ir::RegRead{10}},
+                          {3, ir::Store{2, 1}},
+                          {4, ir::SideExit{2, 0x2000, {}}},
+                          {5, ir::Store{1, 1}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1000}};
+    pass.run(block);
+    REQUIRE(count<ir::Store>(block.instructions) == 2);
+  }
+}
@@ -1,8 +1,11 @@
 #include "Error.h"
+#include "GuestState.h"
 #include "Lowering/InstructionSelector.h"
 #include "Lowering/LivenessAnalysis.h"
 #include "Lowering/RegisterAllocator.h"
+#include <algorithm>
 #include <catch2/catch_all.hpp>
+#include <cstddef>
 
 using namespace dinorisc;
 using namespace dinorisc::lowering;
@@ -60,6 +63,13 @@ public:
     return valueId;
   }
 
+  void addSideExit(ir::ValueId condition, uint64_t target,
+                   std::vector<ir::RegWrite> writes) {
+    ir::ValueId valueId = nextValueId++;
+    ir::Instruction inst{valueId, ir::SideExit{condition, target, writes}};
+    instructions.push_back(inst);
+  }
+
   void setReturnTerminator(ir::ValueId value) {
     terminator = ir::Terminator{ir::Return{value}};
   }
@@ -287,6 +297,142 @@ TEST_CASE("Lowering pipeline control flow", "[lowering]") {
     REQUIRE(containsOpcode(result, arm64::Opcode::MOV));
     REQUIRE(containsOpcode(result, arm64::Opcode::RET));
   }
+
+  SECTION("Side exit records a patchable exit") {
+    IRBuilder builder;
+    auto v1 = builder.addConst(ir::Type::i64, 10);
+    auto v2 = builder.addConst(ir::Type::i64, 20);
+    auto cmp = builder.addBinaryOp(ir::BinaryOpcode::Lt, ir::Type::i1, v1, v2);
+    builder.addSideExit(cmp, 300, {{10, v1}});
+    builder.setBranchTerminator(100);
+
+    InstructionSelector selector;
+    auto instructions = selector.selectInstructions(builder.build());
+    REQUIRE(containsOpcode(instructions, arm64::Opcode::B_EQ));
+
+    // Both the side exit and the terminator's exit start with a branch
+    const auto &exits = selector.getBlockExits();
+    REQUIRE(exits.size() == 2);
+    REQUIRE(exits[0].targetAddress == 300);
+    REQUIRE(exits[1].targetAddress == 100);
+    for (const auto &exit : exits) {
+      REQUIRE(exit.instructionIndex < instructions.size());
+      auto &branch =
+          std::get<arm64::BranchInst>(instructions[exit.instructionIndex].kind);
+      REQUIRE(branch.opcode == arm64::Opcode::B);
+    }
+  }
+
+  SECTION("Side exits give back the budget they skip") {
+    IRBuilder builder;
+    auto v1 = builder.addConst(ir::Type::i64, 10);
+    auto v2 = builder.addConst(ir::Type::i64, 20);
+    auto cmp = builder.addBinaryOp(ir::BinaryOpcode::Lt, ir::Type::i1, v1, v2);
+    builder.addSideExit(cmp, 300, {});
+    builder.setBranchTerminator(100);
+    ir::BasicBlock block = builder.build();
+    std::get<ir::SideExit>(block.instructions.back().kind)
+        .skippedInstructions = 7;
+
+    auto isRefund = [](const arm64::Instruction &inst) {
+      auto *add = std::get_if<arm64::ThreeOperandInst>(&inst.kind);
+      auto *imm = add ? std::get_if<arm64::Immediate>(&add->src2) : nullptr;
+      return add && add->opcode == arm64::Opcode::ADD && imm &&
+             imm->value == 7;
+    };
+
+    // Only code that charges the budget refunds it, in the exit stub
+    InstructionSelector unchecked;
+    auto plain = unchecked.selectInstructions(block);
+    REQUIRE(std::none_of(plain.begin(), plain.end(), isRefund));
+
+    InstructionSelector selector;
+    auto instructions =
+        selector.selectInstructions(block, std::nullopt, BudgetCheck{9, 0});
+    auto refund = std::find_if(instructions.begin(), instructions.end(),
+                               isRefund);
+    REQUIRE(refund != instructions.end());
+    size_t refundIndex = refund - instructions.begin();
+    auto &store =
+        std::get<arm64::MemoryInst>(instructions[refundIndex + 1].kind);
+    REQUIRE(store.opcode == arm64::Opcode::STR);
+    REQUIRE(store.offset == static_cast<int32_t>(
+                                offsetof(GuestState, instructionBudget)));
+    REQUIRE(refundIndex < selector.getBlockExits()[0].instructionIndex);
+
+    LivenessAnalysis liveness(instructions);
+    auto liveIntervals = liveness.computeLiveIntervals();
+    RegisterAllocator allocator;
+    REQUIRE(allocator.allocateRegisters(instructions, liveIntervals));
+  }
+
+  SECTION("Baseline tier counter precedes the block") {
+    IRBuilder builder;
+    builder.setBranchTerminator(100);
+
+    InstructionSelector selector;
+    auto instructions = selector.selectInstructions(
+        builder.build(), TierUpCounter{3, 0x1000});
+
+    // Patchable entry branch first, then the countdown
+    auto &entry = std::get<arm64::BranchInst>(instructions[0].kind);
+    REQUIRE(entry.opcode == arm64::Opcode::B);
+    REQUIRE(entry.target == 4);
+    REQUIRE(containsOpcode(instructions, arm64::Opcode::SUB));
+
+    // The block's own exit still points at its stub branch
+    const auto &exits = selector.getBlockExits();
+    REQUIRE(exits.size() == 1);
+    REQUIRE(std::holds_alternative<arm64::BranchInst>(
+        instructions[exits[0].instructionIndex].kind));
+    REQUIRE(exits[0].instructionIndex > 0);
+  }
+
+  SECTION("Budget check follows the tier-up counter") {
+    IRBuilder builder;
+    builder.setBranchTerminator(100);
+
+    InstructionSelector selector;
+    auto instructions = selector.selectInstructions(
+        builder.build(), TierUpCounter{3, 0x1000}, BudgetCheck{5000, 0x1000});
+
+    // The entry branch stays patchable and the charge is only stored on the
+    // path into the block
+    auto &entry = std::get<arm64::BranchInst>(instructions[0].kind);
+    REQUIRE(entry.opcode == arm64::Opcode::B);
+    auto check = std::find_if(
+        instructions.begin(), instructions.end(), [](const auto &inst) {
+          auto *branch = std::get_if<arm64::BranchInst>(&inst.kind);
+          return branch && branch->opcode == arm64::Opcode::B_GE;
+        });
+    REQUIRE(check != instructions.end());
+    size_t target =
+        (check - instructions.begin()) +
+        std::get<arm64::BranchInst>(check->kind).target / 4;
+    auto &store = std::get<arm64::MemoryInst>(instructions[target].kind);
+    REQUIRE(store.opcode == arm64::Opcode::STR);
+
+    const auto &exits = selector.getBlockExits();
+    REQUIRE(exits.size() == 1);
+    REQUIRE(exits[0].instructionIndex > target);
+
+    LivenessAnalysis liveness(instructions);
+    auto liveIntervals = liveness.computeLiveIntervals();
+    RegisterAllocator allocator;
+    REQUIRE(allocator.allocateRegisters(instructions, liveIntervals));
+  }
+
+  SECTION("Indirect branch probes target cache") {
+    IRBuilder builder;
+    auto target = builder.addConst(ir::Type::i64, 0x10078);
+    builder.setReturnTerminator(target);
+
+    auto result = lowerAndVerify(builder);
+    REQUIRE(containsOpcode(result, arm64::Opcode::LDR));
+    REQUIRE(containsOpcode(result, arm64::Opcode::B_NE));
+    REQUIRE(containsOpcode(result, arm64::Opcode::BR));
+    REQUIRE(containsOpcode(result, arm64::Opcode::RET));
+  }
 }
 
 TEST_CASE("Lowering pipeline register allocation scenarios", "[lowering]") {
@@ -0,0 +1,116 @@
+#include "ControlFlowGraph.h"
+#include "Error.h"
+#include "Optimization/PassManager.h"
+#include "RISCV/Decoder.h"
+#include "RegisterLiveness.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace dinorisc;
+using namespace dinorisc::optimization;
+
+namespace {
+
+// Removes every instruction of one kind and records when it ran
+template <typename Kind> class RemovePass : public Pass {
+public:
+  RemovePass(const char *name, std::vector<std::string> &order)
+      : name(name), order(order) {}
+
+  const char *getName() const override { return name; }
+
+  void run(ir::BasicBlock &block) const override {
+    order.push_back(name);
+    remove(block.instructions);
+  }
+
+private:
+  const char *name;
+  std::vector<std::string> &order;
+
+  static void remove(std::vector<ir::Instruction> &instructions) {
+    instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                      [](const ir::Instruction &inst) {
+                                        return std::holds_alternative<Kind>(
+                                            inst.kind);
+                                      }),
+                       instructions.end());
+  }
+};
+
+ir::BasicBlock makeBlock() {
+  ir::BasicBlock block;
+  block.instructions = {{1, ir::Const{ir::Type::i64, 1}},
+                        {2, ir::RegRead{10}},
+                        {3, ir::Const{ir::Type::i64, 2}},
+                        {4, ir::RegRead{11}}};
+  block.terminator = ir::Terminator{ir::Branch{0x1000}};
+  return block;
+}
+
+} // namespace
+
+TEST_CASE("PassManager - Pipeline", "[optimization]") {
+  std::vector<std::string> order;
+  PassManager passManager;
+  passManager.addPass(
+      std::make_unique<RemovePass<ir::Const>>("remove-consts", order));
+  passManager.addPass(
+      std::make_unique<RemovePass<ir::RegRead>>("remove-reads", order));
+  REQUIRE(passManager.getPassCount() == 2);
+
+  SECTION("Passes run in order and are counted") {
+    ir::BasicBlock block = makeBlock();
+    passManager.run(block);
+    REQUIRE(block.instructions.empty());
+    REQUIRE(order == std::vector<std::string>{"remove-consts", "remove-reads"});
+
+    ir::BasicBlock second = makeBlock();
+    passManager.run(second);
+
+    auto statistics = passManager.getStatistics();
+    REQUIRE(statistics.size() == 2);
+    REQUIRE(statistics[0].name == "remove-consts");
+    REQUIRE(statistics[0].runs == 2);
+    REQUIRE(statistics[0].instructionsBefore == 8);
+    REQUIRE(statistics[0].instructionsAfter == 4);
+    REQUIRE(statistics[1].name == "remove-reads");
+    REQUIRE(statistics[1].instructionsBefore == 4);
+    REQUIRE(statistics[1].instructionsAfter == 0);
+  }
+}
+
+TEST_CASE("PassManager - Levels", "[optimization]") {
+  REQUIRE(PassManager(0).getPassCount() == 0);
+  REQUIRE(PassManager(PassManager::DEFAULT_LEVEL).getPassCount() > 0);
+  REQUIRE(PassManager(PassManager::MAX_LEVEL).getLevel() ==
+          PassManager::MAX_LEVEL);
+  REQUIRE_THROWS_AS(PassManager(PassManager::MAX_LEVEL + 1), RuntimeError);
+}
+
+TEST_CASE("PassManager - Dead write-backs", "[optimization]") {
+  // 0x1000: ret
+  const std::vector<uint8_t> text = {0x67, 0x80, 0x00, 0x00};
+  riscv::Decoder decoder;
+  ControlFlowGraph cfg(decoder, text, 0x1000, 0x1000, {});
+  RegisterLiveness liveness(cfg, decoder, text, 0x1000);
+
+  REQUIRE(PassManager(0, &liveness).getPassCount() == 0);
+  PassManager passManager(1, &liveness);
+  REQUIRE(passManager.getPassCount() == PassManager(1).getPassCount() + 1);
+
+  // t0 is dead at the ret, so its write-back goes before anything else runs
+  ir::BasicBlock block;
+  block.instructions = {{1, ir::RegRead{10}}, {2, ir::RegWrite{5, 1}}};
+  block.terminator = ir::Terminator{ir::Branch{0x1000}};
+  passManager.run(block);
+  REQUIRE(block.instructions.empty());
+
+  auto statistics = passManager.getStatistics();
+  REQUIRE(statistics[0].name == "dead-write-elimination");
+  REQUIRE(statistics[0].instructionsBefore == 2);
+  REQUIRE(statistics[0].instructionsAfter == 1);
+}
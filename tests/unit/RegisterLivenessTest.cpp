@@ -0,0 +1,166 @@
+#include "ControlFlowGraph.h"
+#include "IR/IR.h"
+#include "Lifter.h"
+#include "RISCV/Decoder.h"
+#include "RISCV/Instruction.h"
+#include "RegisterLiveness.h"
+#include "TestHelpers.h"
+#include <algorithm>
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+
+using namespace dinorisc;
+using namespace dinorisc::test;
+using Opcode = riscv::Instruction::Opcode;
+
+namespace {
+
+constexpr uint64_t TEXT_BASE = 0x1000;
+
+// 0x1000 sum_to_n:  li a1, 0; li a2, 0
+// 0x1008 loop:      bge a2, a0, done; add a1, a1, a2; addi a2, a2, 1; j loop
+// 0x1018 done:      mv a0, a1; ret
+// 0x1020 call_sum:  addi sp, sp, -16; sd ra, 8(sp); jal sum_to_n
+//                   addi a0, a0, 100; ld ra, 8(sp); addi sp, sp, 16; ret
+// 0x103c:           .word 0
+const std::vector<uint8_t> TEXT = {
+    0x93, 0x05, 0x00, 0x00, 0x13, 0x06, 0x00, 0x00, 0x63, 0x58, 0xa6, 0x00,
+    0xb3, 0x85, 0xc5, 0x00, 0x13, 0x06, 0x16, 0x00, 0x6f, 0xf0, 0x5f, 0xff,
+    0x13, 0x85, 0x05, 0x00, 0x67, 0x80, 0x00, 0x00, 0x13, 0x01, 0x01, 0xff,
+    0x23, 0x34, 0x11, 0x00, 0xef, 0xf0, 0x9f, 0xfd, 0x13, 0x05, 0x45, 0x06,
+    0x83, 0x30, 0x81, 0x00, 0x13, 0x01, 0x01, 0x01, 0x67, 0x80, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00};
+
+constexpr uint32_t REG_RA = 1;
+constexpr uint32_t REG_SP = 2;
+constexpr uint32_t REG_T0 = 5;
+constexpr uint32_t REG_S0 = 8;
+constexpr uint32_t REG_A0 = 10;
+constexpr uint32_t REG_A1 = 11;
+constexpr uint32_t REG_A2 = 12;
+constexpr uint32_t REG_A7 = 17;
+constexpr uint32_t REG_T6 = 31;
+
+bool isLive(RegisterSet live, uint32_t regNum) {
+  return (live >> regNum) & 1;
+}
+
+std::vector<uint32_t> writtenRegisters(const ir::BasicBlock &block) {
+  std::vector<uint32_t> registers;
+  for (const auto &inst : block.instructions) {
+    if (auto write = std::get_if<ir::RegWrite>(&inst.kind)) {
+      registers.push_back(write->regNumber);
+    }
+  }
+  std::sort(registers.begin(), registers.end());
+  return registers;
+}
+
+RegisterLiveness analyze() {
+  riscv::Decoder decoder;
+  ControlFlowGraph cfg(decoder, TEXT, TEXT_BASE, 0x1020, {});
+  return RegisterLiveness(cfg, decoder, TEXT, TEXT_BASE);
+}
+
+} // namespace
+
+TEST_CASE("RegisterLiveness - Analysis", "[liveness]") {
+  RegisterLiveness liveness = analyze();
+
+  SECTION("Returns keep only what the calling convention preserves") {
+    RegisterSet live = liveness.getLiveIn(0x101c);
+    REQUIRE(isLive(live, REG_RA));
+    REQUIRE(isLive(live, REG_SP));
+    REQUIRE(isLive(live, REG_S0));
+    REQUIRE(isLive(live, REG_A0));
+    REQUIRE_FALSE(isLive(live, REG_T0));
+    REQUIRE_FALSE(isLive(live, REG_A2));
+    REQUIRE_FALSE(isLive(live, REG_A7));
+    REQUIRE_FALSE(isLive(live, REG_T6));
+  }
+
+  SECTION("Liveness flows around the loop") {
+    RegisterSet loop = liveness.getLiveIn(0x1008);
+    REQUIRE(isLive(loop, REG_A0));
+    REQUIRE(isLive(loop, REG_A1));
+    REQUIRE(isLive(loop, REG_A2));
+
+    // sum_to_n sets a1 and a2 itself
+    RegisterSet entry = liveness.getLiveIn(0x1000);
+    REQUIRE(isLive(entry, REG_A0));
+    REQUIRE_FALSE(isLive(entry, REG_A1));
+    REQUIRE_FALSE(isLive(entry, REG_A2));
+  }
+
+  SECTION("Calls read what the callee and the code after them read") {
+    // The return address is set by the call, but saved before it
+    REQUIRE_FALSE(isLive(liveness.getLiveIn(0x1028), REG_RA));
+    REQUIRE(isLive(liveness.getLiveIn(0x1028), REG_A0));
+    REQUIRE(isLive(liveness.getLiveIn(0x1024), REG_RA));
+
+    // ra is reloaded from the stack after the call
+    REQUIRE_FALSE(isLive(liveness.getLiveIn(0x102c), REG_RA));
+  }
+
+  SECTION("Code the graph doesn't know keeps everything") {
+    REQUIRE(liveness.getLiveIn(0x103c) == RegisterLiveness::ALL_REGISTERS);
+    REQUIRE(liveness.getLiveIn(0x5000) == RegisterLiveness::ALL_REGISTERS);
+    REQUIRE(liveness.getLiveIn(0x1002) == RegisterLiveness::ALL_REGISTERS);
+  }
+}
+
+TEST_CASE("RegisterLiveness - Dead write-backs", "[liveness]") {
+  RegisterLiveness liveness = analyze();
+
+  SECTION("Temporaries are dropped at a return") {
+    // addi t0, a0, 1; add a0, t0, a0; ret
+    Lifter lifter;
+    ir::BasicBlock block = lifter.liftBasicBlock(
+        {createIType(Opcode::ADDI, REG_T0, REG_A0, 1, 0x2000),
+         createRType(Opcode::ADD, REG_A0, REG_T0, REG_A0, 0x2004),
+         createIType(Opcode::JALR, 0, REG_RA, 0, 0x2008)});
+    REQUIRE(liveness.removeDeadWrites(block) == 1);
+    REQUIRE(writtenRegisters(block) == std::vector<uint32_t>{REG_A0});
+  }
+
+  SECTION("Exits keep what their target reads") {
+    // Side exit to sum_to_n, then on to done
+    ir::BasicBlock block;
+    block.instructions = {
+        {1, ir::RegRead{REG_A0}},
+        {2, ir::BinaryOp{ir::BinaryOpcode::Eq, ir::Type::i1, 1, 1}},
+        {3, ir::SideExit{2, 0x1000, {{REG_A0, 1}, {REG_A1, 1}}}},
+        {4, ir::RegWrite{REG_A1, 1}},
+        {5, ir::RegWrite{REG_A2, 1}},
+        {6, ir::RegWrite{REG_T0, 1}}};
+    block.terminator = ir::Terminator{ir::Branch{0x1018}};
+    REQUIRE(liveness.removeDeadWrites(block) == 3);
+
+    const auto &sideExit = std::get<ir::SideExit>(block.instructions[2].kind);
+    REQUIRE(sideExit.writes.size() == 1);
+    REQUIRE(sideExit.writes[0].regNumber == REG_A0);
+    REQUIRE(writtenRegisters(block) == std::vector<uint32_t>{REG_A1});
+  }
+
+  SECTION("Calls overwrite the link register") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{REG_A1}},
+                          {2, ir::RegWrite{REG_RA, 1}},
+                          {3, ir::RegWrite{REG_A0, 1}},
+                          {4, ir::RegWrite{REG_T0, 1}},
+                          {5, ir::Const{ir::Type::i64, 0x102c}}};
+    block.terminator = ir::Terminator{
+        ir::Branch{0x1000, ir::Link{REG_RA, 5, 0x102c, true}}};
+    REQUIRE(liveness.removeDeadWrites(block) == 2);
+    REQUIRE(writtenRegisters(block) == std::vector<uint32_t>{REG_A0});
+  }
+
+  SECTION("Indirect jumps keep everything") {
+    ir::BasicBlock block;
+    block.instructions = {{1, ir::RegRead{REG_A1}},
+                          {2, ir::RegWrite{REG_T0, 1}},
+                          {3, ir::RegWrite{REG_A7, 1}}};
+    block.terminator = ir::Terminator{ir::Return{1}};
+    REQUIRE(liveness.removeDeadWrites(block) == 0);
+  }
+}
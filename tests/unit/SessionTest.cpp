@@ -0,0 +1,69 @@
+#include "Error.h"
+#include "Session.h"
+#include "TestHelpers.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+using namespace dinorisc;
+using namespace dinorisc::test;
+
+TEST_CASE("Session - Repeated calls", "[session]") {
+  std::string path = tempPath("session.elf");
+  REQUIRE(writeSumExecutable(path));
+
+  Session session(64 * 1024);
+  std::ostringstream log;
+  session.getTranslator().setLog(log);
+  session.getTranslator().setInterpretThreshold(
+      BinaryTranslator::INTERPRET_ONLY);
+  session.load(path);
+  REQUIRE(session.resolve("call_sum") == SUM_TEXT_BASE + 0x20);
+
+  GuestState &state = session.getContext().getState();
+  uint64_t stackTop = session.getContext().getStackTop();
+
+  SECTION("Both return registers come back") {
+    CallResult first = session.call("call_sum", 10);
+    REQUIRE(first.a0 == 145);
+    REQUIRE(first.a1 == 45);
+
+    CallResult second = session.call("call_sum", 4);
+    REQUIRE(second.a0 == 106);
+    REQUIRE(second.a1 == 6);
+    REQUIRE(session.getCalls() == 2);
+  }
+
+  SECTION("Every call starts from reset registers") {
+    session.call("sum_to_n", 10);
+    REQUIRE(state.x[12] == 10);
+
+    // Left over from an earlier call or set by the host in between
+    state.x[2] -= 64;
+    state.x[5] = 99;
+    state.x[13] = 7;
+
+    CallResult result = session.call("sum_to_n", 3);
+    REQUIRE(result.a0 == 3);
+    REQUIRE(state.x[2] == stackTop);
+    REQUIRE(state.x[5] == 0);
+    REQUIRE(state.x[12] == 3);
+    REQUIRE(state.x[13] == 0);
+  }
+
+  SECTION("The optimization level is fixed once loaded") {
+    REQUIRE_THROWS_AS(session.getTranslator().setOptimizationLevel(2),
+                      RuntimeError);
+    REQUIRE(session.call("call_sum", 10).a0 == 145);
+  }
+
+  SECTION("Unknown functions and too many arguments") {
+    REQUIRE_THROWS_AS(session.call("missing", 1), ELFError);
+    REQUIRE_THROWS_AS(session.call("sum_to_n", 1, 2, 3, 4, 5, 6, 7, 8, 9),
+                      RuntimeError);
+    REQUIRE(session.getCalls() == 0);
+  }
+
+  std::remove(path.c_str());
+}
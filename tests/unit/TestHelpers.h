@@ -0,0 +1,163 @@
+#pragma once
+
+#include "ELFReader.h"
+#include "IR/IR.h"
+#include "RISCV/Instruction.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <elfio/elfio.hpp>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace dinorisc {
+namespace test {
+
+// Decoded RISC-V instructions in the operand order of each format
+
+inline riscv::Instruction
+createInstruction(riscv::Instruction::Opcode opcode,
+                  std::vector<riscv::Instruction::Operand> operands,
+                  uint64_t address = 0x1000) {
+  return riscv::Instruction(opcode, std::move(operands), 0, address);
+}
+
+inline riscv::Instruction createRType(riscv::Instruction::Opcode opcode,
+                                      uint32_t rd, uint32_t rs1, uint32_t rs2,
+                                      uint64_t address = 0x1000) {
+  return createInstruction(opcode,
+                           {riscv::Instruction::Register(rd),
+                            riscv::Instruction::Register(rs1),
+                            riscv::Instruction::Register(rs2)},
+                           address);
+}
+
+// Also loads, as rd, rs1 (base), offset
+inline riscv::Instruction createIType(riscv::Instruction::Opcode opcode,
+                                      uint32_t rd, uint32_t rs1, int64_t imm,
+                                      uint64_t address = 0x1000) {
+  return createInstruction(opcode,
+                           {riscv::Instruction::Register(rd),
+                            riscv::Instruction::Register(rs1),
+                            riscv::Instruction::Immediate(imm)},
+                           address);
+}
+
+inline riscv::Instruction createUType(riscv::Instruction::Opcode opcode,
+                                      uint32_t rd, int64_t imm,
+                                      uint64_t address = 0x1000) {
+  return createInstruction(
+      opcode,
+      {riscv::Instruction::Register(rd), riscv::Instruction::Immediate(imm)},
+      address);
+}
+
+// Also stores, as rs1 (base), rs2 (value), offset
+inline riscv::Instruction createBType(riscv::Instruction::Opcode opcode,
+                                      uint32_t rs1, uint32_t rs2, int64_t imm,
+                                      uint64_t address = 0x1000) {
+  return createInstruction(opcode,
+                           {riscv::Instruction::Register(rs1),
+                            riscv::Instruction::Register(rs2),
+                            riscv::Instruction::Immediate(imm)},
+                           address);
+}
+
+inline riscv::Instruction createJType(riscv::Instruction::Opcode opcode,
+                                      uint32_t rd, int64_t imm,
+                                      uint64_t address = 0x1000) {
+  return createInstruction(
+      opcode,
+      {riscv::Instruction::Register(rd), riscv::Instruction::Immediate(imm)},
+      address);
+}
+
+// IR instructions of one kind
+
+template <typename Kind>
+size_t count(const std::vector<ir::Instruction> &instructions) {
+  return std::count_if(instructions.begin(), instructions.end(),
+                       [](const ir::Instruction &inst) {
+                         return std::holds_alternative<Kind>(inst.kind);
+                       });
+}
+
+template <typename Kind> size_t count(const ir::BasicBlock &block) {
+  return count<Kind>(block.instructions);
+}
+
+// Guest binaries
+
+// 0x1000 sum_to_n:  li a1, 0; li a2, 0
+// 0x1008 loop:      bge a2, a0, done; add a1, a1, a2; addi a2, a2, 1; j loop
+// 0x1018 done:      mv a0, a1; ret
+// 0x1020 call_sum:  addi sp, sp, -16; sd ra, 8(sp); jal sum_to_n
+//                   addi a0, a0, 100; ld ra, 8(sp); addi sp, sp, 16; ret
+constexpr uint64_t SUM_TEXT_BASE = 0x1000;
+const std::vector<uint8_t> SUM_TEXT = {
+    0x93, 0x05, 0x00, 0x00, 0x13, 0x06, 0x00, 0x00, 0x63, 0x58, 0xa6, 0x00,
+    0xb3, 0x85, 0xc5, 0x00, 0x13, 0x06, 0x16, 0x00, 0x6f, 0xf0, 0x5f, 0xff,
+    0x13, 0x85, 0x05, 0x00, 0x67, 0x80, 0x00, 0x00, 0x13, 0x01, 0x01, 0xff,
+    0x23, 0x34, 0x11, 0x00, 0xef, 0xf0, 0x9f, 0xfd, 0x13, 0x05, 0x45, 0x06,
+    0x83, 0x30, 0x81, 0x00, 0x13, 0x01, 0x01, 0x01, 0x67, 0x80, 0x00, 0x00};
+
+// A file in the temp directory no other test process uses
+inline std::string tempPath(const std::string &name) {
+  return (std::filesystem::temp_directory_path() /
+          ("dinorisc-" + std::to_string(getpid()) + "-" + name))
+      .string();
+}
+
+// Write a RISC-V executable holding text at base, with a symbol for each
+// function. Returns false if the file can't be written.
+inline bool writeExecutable(const std::string &path,
+                            const std::vector<uint8_t> &text, uint64_t base,
+                            uint64_t entry,
+                            const std::vector<FunctionSymbol> &functions) {
+  ELFIO::elfio writer;
+  writer.create(ELFIO::ELFCLASS64, ELFIO::ELFDATA2LSB);
+  writer.set_os_abi(ELFIO::ELFOSABI_NONE);
+  writer.set_type(ELFIO::ET_EXEC);
+  writer.set_machine(ELFIO::EM_RISCV);
+  writer.set_entry(entry);
+
+  ELFIO::section *textSection = writer.sections.add(".text");
+  textSection->set_type(ELFIO::SHT_PROGBITS);
+  textSection->set_flags(ELFIO::SHF_ALLOC | ELFIO::SHF_EXECINSTR);
+  textSection->set_addr_align(4);
+  textSection->set_address(base);
+  textSection->set_data(reinterpret_cast<const char *>(text.data()),
+                        text.size());
+
+  ELFIO::section *strtab = writer.sections.add(".strtab");
+  strtab->set_type(ELFIO::SHT_STRTAB);
+
+  ELFIO::section *symtab = writer.sections.add(".symtab");
+  symtab->set_type(ELFIO::SHT_SYMTAB);
+  symtab->set_addr_align(8);
+  symtab->set_entry_size(writer.get_default_entry_size(ELFIO::SHT_SYMTAB));
+  symtab->set_link(strtab->get_index());
+
+  ELFIO::string_section_accessor strings(strtab);
+  ELFIO::symbol_section_accessor symbols(writer, symtab);
+  for (const auto &function : functions) {
+    symbols.add_symbol(strings, function.name.c_str(), function.address,
+                       function.size, ELFIO::STB_GLOBAL, ELFIO::STT_FUNC, 0,
+                       textSection->get_index());
+  }
+
+  return writer.save(path);
+}
+
+// SUM_TEXT with both functions as symbols, entered at call_sum
+inline bool writeSumExecutable(const std::string &path) {
+  return writeExecutable(path, SUM_TEXT, SUM_TEXT_BASE, SUM_TEXT_BASE + 0x20,
+                         {{"sum_to_n", SUM_TEXT_BASE, 0x20},
+                          {"call_sum", SUM_TEXT_BASE + 0x20, 0x1c}});
+}
+
+} // namespace test
+} // namespace dinorisc
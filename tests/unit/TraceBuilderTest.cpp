@@ -0,0 +1,112 @@
+#include "Lifter.h"
+#include "RISCV/Decoder.h"
+#include "TraceBuilder.h"
+#include <catch2/catch_test_macros.hpp>
+#include <vector>
+
+using namespace dinorisc;
+
+namespace {
+
+constexpr uint64_t TEXT_BASE = 0x1000;
+
+// 0x1000: addi a0, a0, 1
+// 0x1004: j    0x100c
+// 0x1008: addi a0, a0, 2
+// 0x100c: beq  a0, a1, 0x1018
+// 0x1010: addi a1, a1, -1
+// 0x1014: bnez a1, 0x1000
+// 0x1018: ret
+// 0x101c: jal  ra, 0x1004
+const std::vector<uint8_t> TEXT = {
+    0x13, 0x05, 0x15, 0x00, 0x6f, 0x00, 0x80, 0x00, 0x13, 0x05, 0x25,
+    0x00, 0x63, 0x06, 0xb5, 0x00, 0x93, 0x85, 0xf5, 0xff, 0xe3, 0x96,
+    0x05, 0xfe, 0x67, 0x80, 0x00, 0x00, 0xef, 0xf0, 0x9f, 0xfe};
+
+std::vector<uint64_t> addresses(const Trace &trace) {
+  std::vector<uint64_t> result;
+  for (const auto &inst : trace.instructions) {
+    result.push_back(inst.address);
+  }
+  return result;
+}
+
+} // namespace
+
+TEST_CASE("TraceBuilder - Trace formation", "[trace]") {
+  riscv::Decoder decoder;
+  TraceBuilder builder(decoder, TEXT, TEXT_BASE);
+
+  SECTION("Follows jumps and likely branch sides") {
+    // Through the jump, past the forward beq, and stopping at the backward
+    // bnez whose likely target is already on the trace
+    Trace trace = builder.buildTrace(0x1000);
+    REQUIRE(addresses(trace) ==
+            std::vector<uint64_t>{0x1000, 0x1004, 0x100c, 0x1010, 0x1014});
+    REQUIRE(trace.blockCount == 3);
+  }
+
+  SECTION("Single block limit") {
+    Trace trace = builder.buildTrace(0x1000, 1);
+    REQUIRE(addresses(trace) == std::vector<uint64_t>{0x1000, 0x1004});
+    REQUIRE(trace.blockCount == 1);
+  }
+
+  SECTION("Calls and returns end the trace") {
+    REQUIRE(addresses(builder.buildTrace(0x101c)) ==
+            std::vector<uint64_t>{0x101c});
+    REQUIRE(addresses(builder.buildTrace(0x1018)) ==
+            std::vector<uint64_t>{0x1018});
+  }
+
+  SECTION("Backward branch is followed into the loop body") {
+    // bnez at 0x1014 is likely taken, continuing at 0x1000. The trace ends
+    // at the beq whose fall-through is back at its start.
+    Trace trace = builder.buildTrace(0x1010);
+    REQUIRE(addresses(trace) ==
+            std::vector<uint64_t>{0x1010, 0x1014, 0x1000, 0x1004, 0x100c});
+    REQUIRE(trace.blockCount == 3);
+  }
+
+  SECTION("PC outside the text section") {
+    REQUIRE_THROWS_AS(builder.buildTrace(0x2000), RuntimeError);
+  }
+}
+
+TEST_CASE("TraceBuilder - Lifting traces", "[trace][lifter]") {
+  riscv::Decoder decoder;
+  TraceBuilder builder(decoder, TEXT, TEXT_BASE);
+  Lifter lifter;
+
+  Trace trace = builder.buildTrace(0x1000);
+  ir::BasicBlock block = lifter.liftTrace(trace.instructions);
+
+  // The beq leaves the trace when taken; the jump needs no code
+  std::vector<ir::SideExit> sideExits;
+  for (const auto &inst : block.instructions) {
+    if (std::holds_alternative<ir::SideExit>(inst.kind)) {
+      sideExits.push_back(std::get<ir::SideExit>(inst.kind));
+    }
+  }
+  REQUIRE(sideExits.size() == 1);
+  REQUIRE(sideExits[0].target == 0x1018);
+
+  // a0 was modified before the side exit and is written back by it
+  REQUIRE(sideExits[0].writes.size() == 1);
+  REQUIRE(sideExits[0].writes[0].regNumber == 10);
+
+  // What follows the beq doesn't run when it's taken
+  auto beq = std::find_if(
+      trace.instructions.begin(), trace.instructions.end(),
+      [](const riscv::Instruction &inst) {
+        return inst.opcode == riscv::Instruction::Opcode::BEQ;
+      });
+  REQUIRE(sideExits[0].skippedInstructions ==
+          static_cast<uint64_t>(trace.instructions.end() - beq - 1));
+
+  // The trace ends with the loop's back edge
+  REQUIRE(std::holds_alternative<ir::CondBranch>(block.terminator.kind));
+  auto &condBranch = std::get<ir::CondBranch>(block.terminator.kind);
+  REQUIRE(condBranch.trueBlock == 0x1000);
+  REQUIRE(condBranch.falseBlock == 0x1018);
+}
@@ -0,0 +1,114 @@
+#include "Error.h"
+#include "TranslationPool.h"
+#include <atomic>
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <thread>
+
+using namespace dinorisc;
+
+namespace {
+
+// Compile function standing in for the translator: one "instruction" per
+// request, failing for odd addresses
+Translation fakeCompile(const TranslationRequest &request) {
+  if (request.pc & 1) {
+    throw LoweringError("Odd address");
+  }
+  Translation translation;
+  translation.guestAddress = request.pc;
+  translation.tier = request.tier;
+  translation.counterIndex = request.counterIndex;
+  translation.blockCount = 1;
+  translation.machineCode = {0x1f, 0x20, 0x03, 0xd5};
+  translation.exits = {{0, request.pc + 4}};
+  return translation;
+}
+
+// Wait for the workers to finish everything queued, then take pc
+std::optional<Translation> takeWhenDone(TranslationPool &pool, uint64_t pc) {
+  for (int i = 0; i < 1000; ++i) {
+    if (pool.getCompleted() + pool.getFailures() + pool.getCancelled() ==
+        pool.getQueued()) {
+      return pool.take(pc);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+TEST_CASE("TranslationPool - Background translation", "[speculation]") {
+  TranslationPool pool(2, fakeCompile);
+  REQUIRE(pool.getThreadCount() == 2);
+
+  SECTION("Finished translations are handed over once") {
+    REQUIRE(pool.enqueue({0x1000, 0, 3}));
+    auto translation = takeWhenDone(pool, 0x1000);
+    REQUIRE(translation.has_value());
+    REQUIRE(translation->guestAddress == 0x1000);
+    REQUIRE(translation->counterIndex == 3);
+    REQUIRE(translation->machineCode.size() == 4);
+    REQUIRE(translation->exits.size() == 1);
+    REQUIRE(translation->exits[0].targetAddress == 0x1004);
+
+    REQUIRE_FALSE(pool.contains(0x1000));
+    REQUIRE_FALSE(pool.take(0x1000).has_value());
+    REQUIRE(pool.getTaken() == 1);
+  }
+
+  SECTION("Blocks are only queued once") {
+    REQUIRE(pool.enqueue({0x2000, 1, std::nullopt}));
+    REQUIRE_FALSE(pool.enqueue({0x2000, 1, std::nullopt}));
+    REQUIRE(pool.contains(0x2000));
+    takeWhenDone(pool, 0x2000);
+    REQUIRE(pool.getQueued() == 1);
+  }
+
+  SECTION("Failures are dropped") {
+    REQUIRE(pool.enqueue({0x3001, 1, std::nullopt}));
+    REQUIRE_FALSE(takeWhenDone(pool, 0x3001).has_value());
+    REQUIRE(pool.getFailures() == 1);
+    REQUIRE_FALSE(pool.contains(0x3001));
+  }
+
+  SECTION("Reset drops finished work") {
+    for (uint64_t pc = 0x4000; pc < 0x4100; pc += 4) {
+      pool.enqueue({pc, 1, std::nullopt});
+    }
+    pool.reset();
+    for (uint64_t pc = 0x4000; pc < 0x4100; pc += 4) {
+      REQUIRE_FALSE(pool.contains(pc));
+    }
+    REQUIRE(pool.getQueued() == 64);
+  }
+}
+
+TEST_CASE("TranslationPool - Cancellation", "[speculation]") {
+  // Hold the only worker on the first request so the second stays queued
+  std::atomic<bool> release(false);
+  TranslationPool pool(1, [&](const TranslationRequest &request) {
+    while (!release) {
+      std::this_thread::yield();
+    }
+    return fakeCompile(request);
+  });
+
+  REQUIRE(pool.enqueue({0x1000, 1, std::nullopt}));
+  REQUIRE(pool.enqueue({0x2000, 1, std::nullopt}));
+
+  // Taking a block nobody has started on cancels it
+  REQUIRE_FALSE(pool.take(0x2000).has_value());
+  REQUIRE(pool.getCancelled() == 1);
+  REQUIRE_FALSE(pool.contains(0x2000));
+
+  release = true;
+  REQUIRE(takeWhenDone(pool, 0x1000).has_value());
+}
+
+TEST_CASE("TranslationPool - Without threads", "[speculation]") {
+  TranslationPool pool(0, fakeCompile);
+  REQUIRE_FALSE(pool.enqueue({0x1000, 1, std::nullopt}));
+  REQUIRE_FALSE(pool.contains(0x1000));
+}
@@ -0,0 +1,154 @@
+#include "BinaryTranslator.h"
+#include "Error.h"
+#include "GuestContext.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void printUsage(const char *programName) {
+  std::cout << "Usage: " << programName
+            << " [options] <riscv_binary> <function_name> [arg1] [arg2] ...\n";
+  std::cout << "Calls a function from 1 up to N threads at once, each with "
+               "its own guest\n"
+            << "context, and reports how throughput scales\n";
+  std::cout << "Options:\n";
+  std::cout << "  --threads=N              Most threads to run (default: "
+               "hardware threads)\n";
+  std::cout << "  --calls=N                Calls per thread (default 1000)\n";
+}
+
+// Parse "<name>=<value>" into value. Returns false if option is a different
+// option and throws if the value isn't a number.
+static bool parseOption(const std::string &option, const std::string &name,
+                        uint64_t &value) {
+  std::string prefix = name + "=";
+  if (option.rfind(prefix, 0) != 0) {
+    return false;
+  }
+  value = std::stoull(option.substr(prefix.size()));
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t callsPerThread = 1000;
+  int firstPositional = 1;
+  for (; firstPositional < argc; ++firstPositional) {
+    std::string option = argv[firstPositional];
+    if (option.rfind("--", 0) != 0) {
+      break;
+    }
+
+    try {
+      if (!parseOption(option, "--threads", maxThreads) &&
+          !parseOption(option, "--calls", callsPerThread)) {
+        throw std::invalid_argument(option);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Error: Invalid option '" << option << "'.\n";
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - firstPositional < 2 || maxThreads == 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::string inputPath = argv[firstPositional];
+  std::string functionName = argv[firstPositional + 1];
+  std::vector<uint64_t> functionArgs;
+  for (int i = firstPositional + 2; i < argc && functionArgs.size() < 8; ++i) {
+    try {
+      functionArgs.push_back(std::stoull(argv[i]));
+    } catch (const std::exception &e) {
+      std::cerr << "Error: Invalid argument '" << argv[i]
+                << "'. Arguments must be integers.\n";
+      return 1;
+    }
+  }
+
+  try {
+    dinorisc::BinaryTranslator translator;
+    std::ostream discard(nullptr);
+    translator.setLog(discard);
+    translator.load(inputPath);
+
+    auto functionAddr = translator.getFunctionAddress(functionName);
+    if (!functionAddr.has_value()) {
+      throw dinorisc::ELFError("Function '" + functionName +
+                               "' not found in binary");
+    }
+
+    // Contexts are created up front so shadow memory allocation isn't
+    // timed
+    std::vector<std::unique_ptr<dinorisc::GuestContext>> contexts;
+    for (uint64_t i = 0; i < maxThreads; ++i) {
+      contexts.push_back(std::make_unique<dinorisc::GuestContext>());
+    }
+
+    auto callFunction = [&](dinorisc::GuestContext &context) {
+      context.reset();
+      dinorisc::GuestState &state = context.getState();
+      for (size_t i = 0; i < functionArgs.size(); ++i) {
+        state.writeRegister(10 + i, functionArgs[i]);
+      }
+      return translator.run(context, functionAddr.value());
+    };
+
+    // Warm up the code cache so every thread count sees the same code
+    uint64_t result = callFunction(*contexts[0]);
+    std::cout << "Function " << functionName << " returned: " << result
+              << "\n";
+
+    double baseline = 0;
+    for (uint64_t threads = 1; threads <= maxThreads; ++threads) {
+      std::vector<std::thread> workers;
+      std::vector<std::exception_ptr> failures(threads);
+      auto start = std::chrono::steady_clock::now();
+      for (uint64_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+          try {
+            for (uint64_t call = 0; call < callsPerThread; ++call) {
+              callFunction(*contexts[t]);
+            }
+          } catch (...) {
+            failures[t] = std::current_exception();
+          }
+        });
+      }
+      for (auto &worker : workers) {
+        worker.join();
+      }
+      for (const auto &failure : failures) {
+        if (failure) {
+          std::rethrow_exception(failure);
+        }
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      double callsPerSecond = threads * callsPerThread / elapsed.count();
+      if (threads == 1) {
+        baseline = callsPerSecond;
+      }
+      std::cout << std::setw(3) << threads << " threads: " << std::fixed
+                << std::setprecision(0) << callsPerSecond << " calls/s, "
+                << std::setprecision(2) << callsPerSecond / baseline
+                << "x\n";
+    }
+
+    translator.printStatistics();
+    return 0;
+  } catch (const dinorisc::Error &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
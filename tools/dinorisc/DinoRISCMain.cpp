@@ -1,29 +1,233 @@
+#include "BatchRunner.h"
 #include "BinaryTranslator.h"
+#include "ControlFlowGraph.h"
+#include "ELFReader.h"
 #include "Error.h"
+#include "Optimization/PassManager.h"
+#include "RISCV/Decoder.h"
+#include "Session.h"
+#include <fstream>
 #include <iostream>
 #include <string>
 
 static void printUsage(const char *programName) {
   std::cout << "Usage: " << programName
-            << " <riscv_binary> <function_name> [arg1] [arg2] ...\n";
+            << " [options] <riscv_binary> <function_name> [arg1] [arg2] ...\n";
+  std::cout << "       " << programName
+            << " --batch=FILE [options] <riscv_binary> <function_name>\n";
+  std::cout << "       " << programName << " --dump-cfg <riscv_binary>\n";
   std::cout
       << "Executes RISC-V 64-bit binaries using dynamic binary translation\n";
   std::cout
       << "Arguments are passed to the function as integer parameters (max 8)\n";
+  std::cout << "Options:\n";
+  std::cout << "  -O<level>                IR optimization level, 0 to "
+            << dinorisc::optimization::PassManager::MAX_LEVEL << " (default "
+            << dinorisc::optimization::PassManager::DEFAULT_LEVEL << ")\n";
+  std::cout << "  --tier-up-threshold=N    Executions before a block is "
+               "retranslated as a\n"
+            << "                           trace (default "
+            << dinorisc::BinaryTranslator::DEFAULT_TIER_UP_THRESHOLD
+            << ", 0 translates traces up front)\n";
+  std::cout << "  --interpret-threshold=N  Executions in the interpreter "
+               "before a block is\n"
+            << "                           translated (default "
+            << dinorisc::BinaryTranslator::DEFAULT_INTERPRET_THRESHOLD
+            << ")\n";
+  std::cout << "  --interpret-only         Never translate, only interpret\n";
+  std::cout << "  --code-cache-size=BYTES  Translated code kept before the "
+               "code cache is\n"
+            << "                           flushed (default "
+            << dinorisc::BinaryTranslator::DEFAULT_CODE_CACHE_SIZE
+            << ", at least "
+            << dinorisc::BinaryTranslator::MIN_CODE_CACHE_SIZE << ")\n";
+  std::cout << "  --code-cache-blocks=N    Translated blocks kept before the "
+               "code cache is\n"
+            << "                           flushed (default 0, no limit)\n";
+  std::cout << "  --aot-cache=FILE         Map translations of the whole "
+               "binary from FILE,\n"
+            << "                           building it first if it is missing "
+               "or stale\n";
+  std::cout << "  --speculation-threads=N  Threads translating likely "
+               "successors in the\n"
+            << "                           background (default "
+            << dinorisc::TranslationPool::defaultThreadCount()
+            << " here, 0 disables)\n";
+  std::cout << "  --instruction-limit=N    Fail once the guest has run N "
+               "instructions\n"
+            << "                           (default 0, no limit)\n";
+  std::cout << "  --time-limit=MS          Fail once the guest has run for MS "
+               "milliseconds\n"
+            << "                           (default 0, no limit)\n";
+  std::cout << "  --batch=FILE             Call the function once per argument "
+               "tuple in FILE\n"
+            << "                           (- for stdin), writing a0,a1 per "
+               "call to stdout\n";
+  std::cout << "  --batch-format=FORMAT    csv (default, one tuple per line) "
+               "or binary\n"
+            << "                           (little-endian 64-bit words)\n";
+  std::cout << "  --batch-arity=N          Arguments per call; required for "
+               "binary input\n";
+  std::cout << "  --dump-cfg               Print the statically recovered "
+               "blocks of each\n"
+            << "                           function instead of running "
+               "anything\n";
+}
+
+// Recover the control flow graph of a binary and print it
+static int dumpControlFlowGraph(const std::string &inputPath) {
+  try {
+    dinorisc::ELFReader elfReader;
+    elfReader.loadFile(inputPath);
+    const auto &text = elfReader.getTextSection();
+
+    dinorisc::riscv::Decoder decoder;
+    dinorisc::ControlFlowGraph cfg(decoder, text.data, text.virtualAddress,
+                                   elfReader.getEntryPoint(),
+                                   elfReader.getFunctionSymbols());
+    cfg.dump(std::cout);
+    return 0;
+  } catch (const dinorisc::Error &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+// Call a function for every argument tuple of a batch in one session,
+// streaming results to stdout and the summary to stderr
+static int runBatch(dinorisc::Session &session, const std::string &inputPath,
+                    const std::string &functionName,
+                    const std::string &batchPath,
+                    dinorisc::BatchFormat format, uint64_t arity) {
+  std::ifstream file;
+  std::istream *input = &std::cin;
+  if (batchPath != "-") {
+    file.open(batchPath, std::ios::binary);
+    if (!file) {
+      std::cerr << "Error: Can't open batch file '" << batchPath << "'.\n";
+      return 1;
+    }
+    input = &file;
+  }
+
+  // stdout only carries results
+  std::ostream discard(nullptr);
+  session.getTranslator().setLog(discard);
+  session.load(inputPath);
+
+  dinorisc::BatchReader reader(*input, format, arity);
+  dinorisc::BatchWriter writer(std::cout, format);
+  dinorisc::BatchRunner runner(session, session.resolve(functionName));
+  dinorisc::BatchStatistics statistics = runner.run(reader, writer);
+  std::cout.flush();
+
+  std::cerr << "Batch: " << statistics.calls << " calls in "
+            << statistics.seconds << " s, "
+            << static_cast<uint64_t>(statistics.getCallsPerSecond())
+            << " calls/s, p50 " << statistics.p50Nanoseconds << " ns, p99 "
+            << statistics.p99Nanoseconds << " ns\n";
+  return 0;
+}
+
+// Parse "<name>=<value>" into value. Returns false if option is a different
+// option and throws if the value isn't a number.
+static bool parseOption(const std::string &option, const std::string &name,
+                        uint64_t &value) {
+  std::string prefix = name + "=";
+  if (option.rfind(prefix, 0) != 0) {
+    return false;
+  }
+  value = std::stoull(option.substr(prefix.size()));
+  return true;
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 3) {
+  // Options come before the positional arguments
+  uint64_t tierUpThreshold =
+      dinorisc::BinaryTranslator::DEFAULT_TIER_UP_THRESHOLD;
+  uint64_t interpretThreshold =
+      dinorisc::BinaryTranslator::DEFAULT_INTERPRET_THRESHOLD;
+  uint64_t codeCacheSize = dinorisc::BinaryTranslator::DEFAULT_CODE_CACHE_SIZE;
+  uint64_t codeCacheBlocks = 0;
+  uint64_t speculationThreads = dinorisc::TranslationPool::defaultThreadCount();
+  uint64_t instructionLimit = 0;
+  uint64_t timeLimit = 0;
+  uint64_t batchArity = 0;
+  unsigned optimizationLevel =
+      dinorisc::optimization::PassManager::DEFAULT_LEVEL;
+  std::string aotCachePath;
+  std::string batchPath;
+  dinorisc::BatchFormat batchFormat = dinorisc::BatchFormat::CSV;
+  bool dumpCfg = false;
+  int firstPositional = 1;
+  for (; firstPositional < argc; ++firstPositional) {
+    std::string option = argv[firstPositional];
+    if (option.rfind("--", 0) != 0 && option.rfind("-O", 0) != 0) {
+      break;
+    }
+
+    try {
+      if (parseOption(option, "--tier-up-threshold", tierUpThreshold) ||
+          parseOption(option, "--interpret-threshold", interpretThreshold) ||
+          parseOption(option, "--code-cache-size", codeCacheSize) ||
+          parseOption(option, "--code-cache-blocks", codeCacheBlocks) ||
+          parseOption(option, "--speculation-threads", speculationThreads) ||
+          parseOption(option, "--instruction-limit", instructionLimit) ||
+          parseOption(option, "--time-limit", timeLimit) ||
+          parseOption(option, "--batch-arity", batchArity)) {
+        continue;
+      }
+
+      const std::string aotCacheOption = "--aot-cache=";
+      const std::string batchOption = "--batch=";
+      if (option.rfind("-O", 0) == 0) {
+        size_t parsed = 0;
+        optimizationLevel = std::stoul(option.substr(2), &parsed);
+        if (parsed != option.size() - 2 ||
+            optimizationLevel >
+                dinorisc::optimization::PassManager::MAX_LEVEL) {
+          throw std::invalid_argument(option);
+        }
+      } else if (option.rfind(aotCacheOption, 0) == 0) {
+        aotCachePath = option.substr(aotCacheOption.size());
+      } else if (option.rfind(batchOption, 0) == 0) {
+        batchPath = option.substr(batchOption.size());
+      } else if (option == "--batch-format=csv") {
+        batchFormat = dinorisc::BatchFormat::CSV;
+      } else if (option == "--batch-format=binary") {
+        batchFormat = dinorisc::BatchFormat::Binary;
+      } else if (option == "--dump-cfg") {
+        dumpCfg = true;
+      } else if (option == "--interpret-only") {
+        interpretThreshold = dinorisc::BinaryTranslator::INTERPRET_ONLY;
+      } else {
+        throw std::invalid_argument(option);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Error: Invalid option '" << option << "'.\n";
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (dumpCfg && argc - firstPositional == 1) {
+    return dumpControlFlowGraph(argv[firstPositional]);
+  }
+
+  if (dumpCfg || argc - firstPositional < 2 ||
+      (!batchPath.empty() && argc - firstPositional != 2)) {
     printUsage(argv[0]);
     return 1;
   }
 
-  std::string inputPath = argv[1];
-  std::string functionName = argv[2];
+  std::string inputPath = argv[firstPositional];
+  std::string functionName = argv[firstPositional + 1];
 
-  // Parse function arguments (starting from argv[3])
+  // Parse function arguments (following the function name)
   std::vector<uint64_t> functionArgs;
-  for (int i = 3; i < argc && functionArgs.size() < 8; ++i) {
+  for (int i = firstPositional + 2;
+       i < argc && functionArgs.size() < dinorisc::Session::MAX_ARGUMENTS;
+       ++i) {
     try {
       uint64_t arg = std::stoull(argv[i]);
       functionArgs.push_back(arg);
@@ -35,14 +239,30 @@ int main(int argc, char *argv[]) {
   }
 
   try {
-    dinorisc::BinaryTranslator translator;
+    dinorisc::Session session;
+    dinorisc::BinaryTranslator &translator = session.getTranslator();
 
-    translator.setArgumentRegisters(functionArgs);
+    translator.setTierUpThreshold(tierUpThreshold);
+    translator.setInterpretThreshold(interpretThreshold);
+    translator.setCodeCacheLimits(codeCacheSize, codeCacheBlocks);
+    translator.setAotCachePath(aotCachePath);
+    translator.setSpeculationThreads(speculationThreads);
+    translator.setInstructionLimit(instructionLimit);
+    translator.setTimeLimit(timeLimit);
+    translator.setOptimizationLevel(optimizationLevel);
+
+    if (!batchPath.empty()) {
+      return runBatch(session, inputPath, functionName, batchPath, batchFormat,
+                      batchArity);
+    }
 
-    int functionResult = translator.executeFunction(inputPath, functionName);
+    session.load(inputPath);
+    dinorisc::CallResult result = session.call(functionName, functionArgs);
+    translator.printStatistics();
 
-    std::cout << "Function " << functionName << " returned: " << functionResult
-              << "\n";
+    // Values narrower than 64 bits come back sign-extended
+    std::cout << "Function " << functionName
+              << " returned: " << static_cast<int64_t>(result.a0) << "\n";
     return 0;
   } catch (const dinorisc::Error &e) {
     std::cerr << "Error: " << e.what() << "\n";